@@ -208,6 +208,16 @@ G1Element operator*(const G1Element& a, const bn_t& k)
 G1Element operator*(const bn_t& k, const G1Element& a) { return a * k; }
 
 
+G1Affine::G1Affine(const G1Element &element): element(element)
+{
+    element.ToNative(&p);
+    g1_norm(p, p);
+}
+
+void G1Affine::ToNative(g1_t* output) const {
+    g1_copy(*output, this->p);
+}
+
 
 // G2Element definitions below
 
@@ -27,6 +27,7 @@ extern "C" {
 
 namespace bls {
 class G1Element;
+class G1Affine;
 class G2Element;
 class GTElement;
 class BNWrapper;
@@ -66,6 +67,23 @@ private:
     }
 };
 
+// A G1 point that takes part in many pairings, such as a public key of a
+// static signer set, cached in affine form. Plain elements, e.g. sums of
+// keys, are projective and pay a field inversion in every pairing to get
+// there. Only the point is cached, not the line coefficients of the Miller
+// loop, so the loop itself costs as much as with a plain element.
+class G1Affine {
+public:
+    explicit G1Affine(const G1Element &element);
+
+    const G1Element &GetElement() const { return element; }
+    void ToNative(g1_t* output) const;
+
+private:
+    G1Element element;
+    g1_t p;
+};
+
 class G2Element {
 public:
     static const size_t SIZE = 96;
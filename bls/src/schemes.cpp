@@ -87,8 +87,41 @@ bool CoreMPL::Verify(
     const uint8_t *dst,
     int dst_len)
 {
-    G1Element genneg = G1Element::Generator().Negate();
-    G2Element hashedPoint = G2Element::FromMessage(message, dst, dst_len);
+    return CoreMPL::VerifyHashed(
+        pubkey,
+        CoreMPL::HashToPoint(message, dst, dst_len),
+        signature);
+}
+
+G2Element CoreMPL::HashToPoint(
+    const vector<uint8_t> &message,
+    const uint8_t *dst,
+    int dst_len)
+{
+    return G2Element::FromMessage(message, dst, dst_len);
+}
+
+G2Element CoreMPL::SignHashed(
+    const PrivateKey &seckey,
+    const G2Element &hashedPoint)
+{
+    return seckey * hashedPoint;
+}
+
+bool CoreMPL::VerifyHashed(
+    const G1Element &pubkey,
+    const G2Element &hashedPoint,
+    const G2Element &signature)
+{
+    return CoreMPL::VerifyAffine(G1Affine(pubkey), hashedPoint, signature);
+}
+
+bool CoreMPL::VerifyAffine(
+    const G1Affine &pubkey,
+    const G2Element &hashedPoint,
+    const G2Element &signature)
+{
+    static const G1Affine genneg(G1Element::Generator().Negate());
 
     g1_t *g1s = new g1_t[2];
     g2_t *g2s = new g2_t[2];
@@ -556,6 +589,20 @@ bool PopSchemeMPL::FastAggregateVerify(
         PopSchemeMPL::CIPHERSUITE_ID_LEN);
 }
 
+bool PopSchemeMPL::FastAggregateVerifyHashed(
+    const vector<G1Element> &pubkeys,
+    const G2Element &hashedPoint,
+    const G2Element &signature)
+{
+    int n = pubkeys.size();
+    if (n <= 0)
+        return false;
+
+    G1Element pkagg = CoreMPL::Aggregate(pubkeys);
+
+    return CoreMPL::VerifyHashed(pkagg, hashedPoint, signature);
+}
+
 bool PopSchemeMPL::FastAggregateVerify(
     const vector<vector<uint8_t>> &pubkeys,
     const vector<uint8_t> &message,
@@ -68,6 +68,28 @@ public:
         const uint8_t *dst,
         int dst_len);
 
+    // Maps a message to the G2 point that is signed, so that it can be
+    // reused for every signature on the same message
+    static G2Element HashToPoint(
+        const vector<uint8_t> &message,
+        const uint8_t *dst,
+        int dst_len);
+
+    static G2Element SignHashed(
+        const PrivateKey &seckey,
+        const G2Element &hashedPoint);
+
+    static bool VerifyHashed(
+        const G1Element &pubkey,
+        const G2Element &hashedPoint,
+        const G2Element &signature);
+
+    // Same as VerifyHashed, for a public key already in affine form
+    static bool VerifyAffine(
+        const G1Affine &pubkey,
+        const G2Element &hashedPoint,
+        const G2Element &signature);
+
     static vector<uint8_t> Aggregate(const vector<vector<uint8_t>> &signatures);
 
     static G2Element Aggregate(const vector<G2Element> &signatures);
@@ -324,6 +346,44 @@ public:
         const vector<uint8_t> &message,
         const vector<uint8_t> &signature);
 
+    // Variants of Sign, Verify and FastAggregateVerify that take the message
+    // already mapped to G2 by HashToPoint
+    static G2Element HashToPoint(const vector<uint8_t> &message)
+    {
+        return CoreMPL::HashToPoint(
+            message,
+            PopSchemeMPL::CIPHERSUITE_ID,
+            PopSchemeMPL::CIPHERSUITE_ID_LEN);
+    }
+
+    static G2Element SignHashed(
+        const PrivateKey &seckey,
+        const G2Element &hashedPoint)
+    {
+        return CoreMPL::SignHashed(seckey, hashedPoint);
+    }
+
+    static bool VerifyHashed(
+        const G1Element &pubkey,
+        const G2Element &hashedPoint,
+        const G2Element &signature)
+    {
+        return CoreMPL::VerifyHashed(pubkey, hashedPoint, signature);
+    }
+
+    static bool VerifyAffine(
+        const G1Affine &pubkey,
+        const G2Element &hashedPoint,
+        const G2Element &signature)
+    {
+        return CoreMPL::VerifyAffine(pubkey, hashedPoint, signature);
+    }
+
+    static bool FastAggregateVerifyHashed(
+        const vector<G1Element> &pubkeys,
+        const G2Element &hashedPoint,
+        const G2Element &signature);
+
     static PrivateKey DeriveChildSk(const PrivateKey& sk, uint32_t index) {
         return CoreMPL::DeriveChildSk(sk, index);
     }
@@ -141,6 +141,17 @@ std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
     return std::make_pair(ret[0], ret[1]);
 }
 
+hotstuff::LinkEmu make_link(double delay_ms, double jitter_ms, double mbit, double loss_pct) {
+    if (loss_pct < 0 || loss_pct >= 100)
+        throw HotStuffError("invalid link loss: %.2f%%", loss_pct);
+    hotstuff::LinkEmu link;
+    link.delay = delay_ms / 1e3;
+    link.jitter = jitter_ms / 1e3;
+    link.bandwidth = mbit * 1e6 / 8;
+    link.loss = loss_pct / 100;
+    return link;
+}
+
 salticidae::BoxObj<HotStuffApp> papp = nullptr;
 
 int main(int argc, char **argv) {
@@ -176,6 +187,39 @@ int main(int argc, char **argv) {
     auto opt_fanout = Config::OptValInt::create(2); // 2 by default
     auto opt_piped_latency = Config::OptValInt::create(10); // 10ms by default
     auto opt_async_blocks = Config::OptValInt::create(0); // 0 by default
+    auto opt_auto_pipeline = Config::OptValFlag::create(false);
+    auto opt_tree_reopt_period = Config::OptValDouble::create(0); // static tree by default
+    auto opt_tree_probe_bytes = Config::OptValInt::create(65536); // 64k by default
+    auto opt_tree_relay_timeout = Config::OptValDouble::create(0); // no reconfiguration by default
+    auto opt_tree_max_failures = Config::OptValInt::create(3);
+    auto opt_level_fanout = Config::OptValStr::create(); // uniform fan-out by default
+    auto opt_topology = Config::OptValStr::create();
+    auto opt_tree_file = Config::OptValStr::create();
+    auto opt_relay_policy = Config::OptValStr::create("full");
+    auto opt_relay_deadline = Config::OptValDouble::create(0.1);
+    auto opt_ntrees = Config::OptValInt::create(1);
+    auto opt_erasure = Config::OptValFlag::create(false);
+    auto opt_optimistic_verify = Config::OptValFlag::create(false);
+    auto opt_veri_batch = Config::OptValDouble::create(0); // no batching by default
+    auto opt_veri_batch_max = Config::OptValInt::create(64);
+    auto opt_nsigner = Config::OptValInt::create(1);
+    auto opt_nworker_max = Config::OptValInt::create(0); // no growth by default
+    auto opt_thread_layout = Config::OptValStr::create("");
+    auto opt_prune_depth = Config::OptValInt::create(1000);
+    auto opt_prune_mem = Config::OptValInt::create(0); // no cap by default
+    auto opt_wal_dir = Config::OptValStr::create(""); // no log by default
+    auto opt_wal_max = Config::OptValInt::create(64);
+    auto opt_blk_store = Config::OptValStr::create(""); // committed blocks in memory only by default
+    auto opt_blk_store_seg = Config::OptValInt::create(64);
+    auto opt_sync_batch = Config::OptValInt::create(256);
+    auto opt_sync_parallel = Config::OptValInt::create(4);
+    auto opt_sync_rate = Config::OptValDouble::create(16);
+    auto opt_sync_gap = Config::OptValInt::create(64);
+    auto opt_link_delay = Config::OptValDouble::create(0); // no link emulation by default
+    auto opt_link_jitter = Config::OptValDouble::create(0);
+    auto opt_link_bandwidth = Config::OptValDouble::create(0);
+    auto opt_link_loss = Config::OptValDouble::create(0);
+    auto opt_links = Config::OptValStrVec::create();
 
     config.add_opt("block-size", opt_blk_size, Config::SET_VAL);
     config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL);
@@ -192,7 +236,9 @@ int main(int argc, char **argv) {
     config.add_opt("prop-delay", opt_prop_delay, Config::SET_VAL, 't', "set the delay that follows the timeout for the Round-Robin Pacemaker");
     config.add_opt("imp-timeout", opt_imp_timeout, Config::SET_VAL, 'u', "set impeachment timeout (for sticky)");
     config.add_opt("nworker", opt_nworker, Config::SET_VAL, 'n', "the number of threads for verification");
+    config.add_opt("nworker-max", opt_nworker_max, Config::SET_VAL, 'N', "the number of threads verification may grow to under backlog");
     config.add_opt("repnworker", opt_repnworker, Config::SET_VAL, 'm', "the number of threads for replica network");
+    config.add_opt("thread-layout", opt_thread_layout, Config::SET_VAL, 'C', "pin the threads: <class>:<cores or nodeN>;... with the classes main, verify, sign, net, client, wal");
     config.add_opt("repburst", opt_repburst, Config::SET_VAL, 'b', "");
     config.add_opt("clinworker", opt_clinworker, Config::SET_VAL, 'M', "the number of threads for client network");
     config.add_opt("cliburst", opt_cliburst, Config::SET_VAL, 'B', "");
@@ -203,6 +249,37 @@ int main(int argc, char **argv) {
     config.add_opt("fan-out", opt_fanout, Config::SET_VAL, 'F', "fanout");
     config.add_opt("piped_latency", opt_piped_latency, Config::SET_VAL, 'P', "Latency between the block pipelining");
     config.add_opt("async_blocks", opt_async_blocks, Config::SET_VAL, 'A', "Async blocks to pipeline");
+    config.add_opt("auto-pipeline", opt_auto_pipeline, Config::SWITCH_ON, 'y', "tune async_blocks (as the upper bound) and piped_latency from the QC latencies");
+    config.add_opt("tree-reopt-period", opt_tree_reopt_period, Config::SET_VAL, 'T', "seconds between latency/bandwidth-aware tree re-optimizations (0 to disable)");
+    config.add_opt("tree-probe-bytes", opt_tree_probe_bytes, Config::SET_VAL, 'W', "the padding of the link probes used to estimate bandwidth");
+    config.add_opt("tree-relay-timeout", opt_tree_relay_timeout, Config::SET_VAL, 'R', "seconds to wait for the votes of a block before reconfiguring the tree (0 to disable)");
+    config.add_opt("tree-max-failures", opt_tree_max_failures, Config::SET_VAL, 'X', "the number of failed trees before falling back to a star");
+    config.add_opt("level-fanout", opt_level_fanout, Config::SET_VAL, 'L', "comma-separated fan-out of each tree level (the last one repeats)");
+    config.add_opt("topology", opt_topology, Config::SET_VAL, 'O', "Kollaps topology file to infer a region-aware tree from (rooted at replica 0)");
+    config.add_opt("tree-file", opt_tree_file, Config::SET_VAL, 'e', "file with the initial tree, one \"<parent>: <children>\" line per internal replica and optionally \"root <rid>\"");
+    config.add_opt("relay-policy", opt_relay_policy, Config::SET_VAL, 'Y', "when internal nodes forward partial aggregates (full, threshold, deadline)");
+    config.add_opt("relay-deadline", opt_relay_deadline, Config::SET_VAL, 'D', "seconds an internal node waits before the child latencies are known (for deadline)");
+    config.add_opt("trees", opt_ntrees, Config::SET_VAL, 'K', "the number of trees with disjoint internal nodes the pipelined blocks rotate over");
+    config.add_opt("erasure", opt_erasure, Config::SWITCH_ON, 'E', "disseminate proposals as Reed-Solomon chunks");
+    config.add_opt("optimistic-verify", opt_optimistic_verify, Config::SWITCH_ON, 'V', "verify only the aggregates and bisect the signers of an invalid one");
+    config.add_opt("veri-batch", opt_veri_batch, Config::SET_VAL, 'v', "milliseconds signature checks wait to be verified in one batch (0 to disable)");
+    config.add_opt("veri-batch-max", opt_veri_batch_max, Config::SET_VAL, 'Q', "the largest batch of signature checks");
+    config.add_opt("nsigner", opt_nsigner, Config::SET_VAL, 'g', "the number of threads signing the own votes (0 to sign on the event loop)");
+    config.add_opt("prune-depth", opt_prune_depth, Config::SET_VAL, 'r', "the number of committed blocks kept in memory (0 keeps the whole chain)");
+    config.add_opt("prune-mem", opt_prune_mem, Config::SET_VAL, 'z', "MB the blocks in memory may take before fewer committed ones are kept (0 for no cap)");
+    config.add_opt("wal-dir", opt_wal_dir, Config::SET_VAL, 'f', "directory of the write-ahead logs (wal-<idx>) the replicas recover their state from");
+    config.add_opt("wal-max", opt_wal_max, Config::SET_VAL, 'G', "MB a write-ahead log may grow to before it is compacted");
+    config.add_opt("blk-store", opt_blk_store, Config::SET_VAL, 'H', "directory of the on-disk block stores (store-<idx>) the pruned blocks are served from");
+    config.add_opt("blk-store-seg", opt_blk_store_seg, Config::SET_VAL, 'I', "MB per segment file of the block store");
+    config.add_opt("sync-batch", opt_sync_batch, Config::SET_VAL, 'J', "blocks per catch-up request for missing ancestors (0 fetches them one by one)");
+    config.add_opt("sync-parallel", opt_sync_parallel, Config::SET_VAL, 'Z', "catch-up requests in flight to different replicas");
+    config.add_opt("sync-rate", opt_sync_rate, Config::SET_VAL, 'x', "MB/s served to the replicas catching up (0 for no limit)");
+    config.add_opt("sync-gap", opt_sync_gap, Config::SET_VAL, 'q', "blocks a proposal must be above the highest delivered one to start a catch-up");
+    config.add_opt("link-delay", opt_link_delay, Config::SET_VAL, 'U', "emulated one-way delay (ms) of every outgoing link");
+    config.add_opt("link-jitter", opt_link_jitter, Config::SET_VAL, 'j', "emulated jitter (ms) of every outgoing link");
+    config.add_opt("link-bandwidth", opt_link_bandwidth, Config::SET_VAL, 'w', "emulated bandwidth (Mbit/s) of every outgoing link (0 for unlimited)");
+    config.add_opt("link-loss", opt_link_loss, Config::SET_VAL, 'o', "emulated loss (%) of every outgoing link");
+    config.add_opt("link", opt_links, Config::APPEND, 'k', "emulate a link: <from>, <to>, <delay ms>, <jitter ms>, <Mbit/s>, <loss %> (* matches any replica)");
 
     EventContext ec;
     config.parse(argc, argv);
@@ -238,6 +315,9 @@ int main(int argc, char **argv) {
 
     NetAddr plisten_addr{split_ip_port_cport(binding_addr).first};
 
+    hotstuff::thread_layout = hotstuff::ThreadLayout::parse(opt_thread_layout->get());
+    hotstuff::thread_layout.pin(hotstuff::THREAD_MAIN);
+
     auto parent_limit = opt_parent_limit->get();
     hotstuff::pacemaker_bt pmaker;
     if (opt_pace_maker->get() == "dummy")
@@ -290,6 +370,51 @@ int main(int argc, char **argv) {
 
     papp->set_fanout(opt_fanout->get());
     papp->set_piped_latency(opt_piped_latency->get(), opt_async_blocks->get());
+    papp->set_auto_pipeline(opt_auto_pipeline->get());
+    papp->set_tree_reopt(opt_tree_reopt_period->get(), opt_tree_probe_bytes->get());
+    papp->set_tree_reconf(opt_tree_relay_timeout->get(), opt_tree_max_failures->get());
+    std::vector<uint32_t> level_fanouts;
+    if (!opt_level_fanout->get().empty())
+        for (const auto &f: trim_all(split(opt_level_fanout->get(), ",")))
+            level_fanouts.push_back(std::stoul(f));
+    papp->set_topology(level_fanouts, opt_topology->get(), opt_tree_file->get());
+    papp->set_ntrees(opt_ntrees->get());
+    papp->set_erasure(opt_erasure->get());
+    papp->set_optimistic_verify(opt_optimistic_verify->get());
+    papp->set_veri_batch(opt_veri_batch->get() / 1e3, opt_veri_batch_max->get());
+    papp->set_sign_workers(opt_nsigner->get());
+    papp->set_max_veri_workers(opt_nworker_max->get());
+    papp->set_pruning(opt_prune_depth->get(), (size_t)opt_prune_mem->get() << 20);
+    if (!opt_wal_dir->get().empty())
+        papp->set_wal(opt_wal_dir->get() + "/wal-" + std::to_string(idx),
+                    (size_t)opt_wal_max->get() << 20);
+    papp->set_sync(opt_sync_batch->get(), opt_sync_parallel->get(),
+                    opt_sync_rate->get() * 1048576, opt_sync_gap->get());
+    if (!opt_blk_store->get().empty())
+        papp->set_blk_store(opt_blk_store->get() + "/store-" + std::to_string(idx),
+                            (size_t)opt_blk_store_seg->get() << 20);
+    papp->set_link_default(make_link(opt_link_delay->get(), opt_link_jitter->get(),
+                                    opt_link_bandwidth->get(), opt_link_loss->get()));
+    /* later entries override earlier ones */
+    for (const auto &s: opt_links->get())
+    {
+        auto res = trim_all(split(s, ","));
+        if (res.size() != 6)
+            throw HotStuffError("invalid link info");
+        if (res[0] != "*" && std::stoi(res[0]) != idx) continue;
+        auto link = make_link(std::stod(res[2]), std::stod(res[3]),
+                            std::stod(res[4]), std::stod(res[5]));
+        for (ReplicaID rid = 0; rid < replicas.size(); rid++)
+            if (rid != idx && (res[1] == "*" || std::stoi(res[1]) == rid))
+                papp->set_link(rid, link);
+    }
+    auto &relay_policy = opt_relay_policy->get();
+    if (relay_policy == "threshold")
+        papp->set_relay_policy(hotstuff::RELAY_THRESHOLD, opt_relay_deadline->get());
+    else if (relay_policy == "deadline")
+        papp->set_relay_policy(hotstuff::RELAY_DEADLINE, opt_relay_deadline->get());
+    else if (relay_policy != "full")
+        throw HotStuffError("unknown relay policy: %s", relay_policy.c_str());
 
     auto shutdown = [&](int) { papp->stop(); };
     salticidae::SigEvent ev_sigint(ec, shutdown);
@@ -340,7 +465,10 @@ HotStuffApp::HotStuffApp(uint32_t blk_size,
 
     /* register the handlers for msg from clients */
     cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_request_cmd_handler, this, _1, _2));
-    cn.start();
+    {
+        hotstuff::ThreadLayout::Scope _(hotstuff::thread_layout, hotstuff::THREAD_CLIENT);
+        cn.start();
+    }
     cn.listen(clisten_addr);
 }
 
@@ -358,7 +486,6 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
     ev_stat_timer = TimerEvent(ec, [this](TimerEvent &) {
         HotStuff::print_stat();
         HotStuffApp::print_stat();
-        //HotStuffCore::prune(100);
         ev_stat_timer.add(stat_period);
     });
     ev_stat_timer.add(stat_period);
@@ -371,6 +498,7 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
     HOTSTUFF_LOG_INFO("** starting the system with parameters **");
     HOTSTUFF_LOG_INFO("blk_size = %lu", blk_size);
     HOTSTUFF_LOG_INFO("conns = %lu", HotStuff::size());
+    HOTSTUFF_LOG_INFO("thread layout = %s", hotstuff::thread_layout.to_string().c_str());
     HOTSTUFF_LOG_INFO("** starting the event loop...");
     HotStuff::start(reps);
     cn.reg_conn_handler([this](const salticidae::ConnPool::conn_t &_conn, bool connected) {
@@ -381,8 +509,14 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
             client_conns.erase(conn);
         return true;
     });
-    req_thread = std::thread([this]() { req_ec.dispatch(); });
-    resp_thread = std::thread([this]() { resp_ec.dispatch(); });
+    req_thread = std::thread([this]() {
+        hotstuff::thread_layout.enter(hotstuff::THREAD_CLIENT);
+        req_ec.dispatch();
+    });
+    resp_thread = std::thread([this]() {
+        hotstuff::thread_layout.enter(hotstuff::THREAD_CLIENT);
+        resp_ec.dispatch();
+    });
     /* enter the event main loop */
     ec.dispatch();
 }
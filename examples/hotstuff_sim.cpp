@@ -0,0 +1,721 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A discrete-event simulator of a Kauri cluster: all replicas run the real
+ * HotStuffCore in one process on a virtual clock, the network and the BLS
+ * operations are replaced by a cost model, so the effect of the tree shape,
+ * the pipelining and the crypto costs can be explored for hundreds of
+ * replicas without a testbed. */
+
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "salticidae/stream.h"
+#include "salticidae/util.h"
+
+#include "hotstuff/type.h"
+#include "hotstuff/entity.h"
+#include "hotstuff/consensus.h"
+#include "hotstuff/hotstuff.h"
+#include "hotstuff/topology.h"
+
+using salticidae::Config;
+using salticidae::trim_all;
+using salticidae::split;
+using salticidae::htole;
+using salticidae::letoh;
+
+using hotstuff::HotStuffCore;
+using hotstuff::HotStuffError;
+using hotstuff::Topology;
+using hotstuff::ReplicaID;
+using hotstuff::ReplicaConfig;
+using hotstuff::uint256_t;
+using hotstuff::bytearray_t;
+using hotstuff::DataStream;
+using hotstuff::block_t;
+using hotstuff::Block;
+using hotstuff::Proposal;
+using hotstuff::Vote;
+using hotstuff::VoteRelay;
+using hotstuff::Finality;
+using hotstuff::PartCert;
+using hotstuff::QuorumCert;
+using hotstuff::PubKey;
+using hotstuff::PrivKey;
+using hotstuff::part_cert_bt;
+using hotstuff::quorum_cert_bt;
+using hotstuff::promise_t;
+using hotstuff::VeriPool;
+using hotstuff::MsgPropose;
+using hotstuff::MsgVote;
+using hotstuff::MsgRelay;
+
+/** size of a compressed BLS12-381 signature (G2) */
+static const size_t sim_sig_size = 96;
+
+/** A partial certificate that is as large as a BLS signature and always
+ * verifies, its cost is charged by the simulator. */
+class PartCertSim: public PartCert {
+    uint256_t obj_hash;
+
+    public:
+    PartCertSim() = default;
+    PartCertSim(const uint256_t &obj_hash): obj_hash(obj_hash) {}
+
+    bool verify(const PubKey &) override { return true; }
+    promise_t verify(const PubKey &, VeriPool &) override {
+        return promise_t([](promise_t &pm) { pm.resolve(true); });
+    }
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    PartCertSim *clone() override { return new PartCertSim(*this); }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash << bytearray_t(sim_sig_size);
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> obj_hash;
+        s.get_data_inplace(sim_sig_size);
+    }
+};
+
+/** An aggregate that tracks the signers in a bitmap (as the BLS one does)
+ * plus a signature-sized blob. */
+class QuorumCertSim: public QuorumCert {
+    uint256_t obj_hash;
+    std::vector<uint8_t> signers;
+    uint32_t nsigners;
+
+    public:
+    QuorumCertSim(): nsigners(0) {}
+    QuorumCertSim(const ReplicaConfig &config, const uint256_t &obj_hash):
+        obj_hash(obj_hash), signers((config.nreplicas + 7) / 8, 0), nsigners(0) {}
+
+    void add_part(const ReplicaConfig &, ReplicaID rid, const PartCert &) override {
+        if (signers[rid >> 3] & (1 << (rid & 7))) return;
+        signers[rid >> 3] |= 1 << (rid & 7);
+        nsigners++;
+    }
+
+    bool merge_quorum(const QuorumCert &qc) override {
+        const auto &other = static_cast<const QuorumCertSim &>(qc);
+        for (size_t i = 0; i < signers.size() && i < other.signers.size(); i++)
+        {
+            uint8_t fresh = other.signers[i] & ~signers[i];
+            signers[i] |= fresh;
+            nsigners += __builtin_popcount(fresh);
+        }
+        return true;
+    }
+
+    bool has_n(uint32_t n) override { return nsigners >= n; }
+    uint32_t get_n() const { return nsigners; }
+    void compute() override {}
+    bool verify(const ReplicaConfig &) override { return true; }
+    promise_t verify(const ReplicaConfig &, VeriPool &) override {
+        return promise_t([](promise_t &pm) { pm.resolve(true); });
+    }
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    QuorumCertSim *clone() override { return new QuorumCertSim(*this); }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash << htole((uint32_t)signers.size()) << bytearray_t(signers)
+          << bytearray_t(sim_sig_size);
+    }
+
+    void unserialize(DataStream &s) override {
+        uint32_t len;
+        s >> obj_hash >> len;
+        len = letoh(len);
+        auto base = s.get_data_inplace(len);
+        signers = std::vector<uint8_t>(base, base + len);
+        nsigners = 0;
+        for (const auto &b: signers) nsigners += __builtin_popcount(b);
+        s.get_data_inplace(sim_sig_size);
+    }
+};
+
+/** CPU cost of the BLS operations, in seconds */
+struct CryptoCost {
+    double sign;
+    double verify;
+    /** add one signature to an aggregate */
+    double agg;
+    /** add one public key to the aggregated key of a quorum */
+    double pkagg;
+    /** verify the aggregates only, not every vote and child aggregate */
+    bool optimistic;
+};
+
+class SimReplica;
+
+class Simulator {
+    struct Event {
+        double time;
+        uint64_t seq;
+        std::function<void()> fn;
+        bool operator<(const Event &other) const {
+            return time > other.time || (time == other.time && seq > other.seq);
+        }
+    };
+
+    std::priority_queue<Event> events;
+    uint64_t seq;
+    std::mt19937_64 rng;
+
+    double latency;
+    double jitter;
+    /** bytes per second of the uplink of every replica (0 for unlimited) */
+    double bandwidth;
+    std::vector<double> uplink_free;
+    /** the verification threads of every replica */
+    std::vector<std::vector<double>> lanes;
+    std::vector<double> cpu_busy;
+
+    public:
+    double now;
+    double warmup;
+    CryptoCost cost;
+    ReplicaID leader;
+    std::vector<SimReplica *> replicas;
+
+    /* statistics of the leader after the warm-up */
+    uint64_t ndecided;
+    std::vector<double> commit_lat;
+    uint64_t nmsgs;
+    uint64_t nbytes;
+
+    Simulator(size_t nreplicas, size_t nworker, double latency, double jitter,
+            double bandwidth, const CryptoCost &cost, ReplicaID leader, double warmup):
+        seq(0), rng(0), latency(latency), jitter(jitter), bandwidth(bandwidth),
+        uplink_free(nreplicas, 0),
+        lanes(nreplicas, std::vector<double>(std::max<size_t>(nworker, 1), 0)),
+        cpu_busy(nreplicas, 0),
+        now(0), warmup(warmup), cost(cost), leader(leader),
+        ndecided(0), nmsgs(0), nbytes(0) {}
+
+    void at(double time, std::function<void()> fn) {
+        events.push(Event{std::max(time, now), seq++, std::move(fn)});
+    }
+
+    /** Send `size` bytes: the message is serialized on the uplink of `from`
+     * and arrives after the propagation delay. */
+    void send(ReplicaID from, size_t size, std::function<void()> fn) {
+        double depart = std::max(now, uplink_free[from]);
+        if (bandwidth > 0) depart += size / bandwidth;
+        uplink_free[from] = depart;
+        double delay = latency;
+        if (jitter > 0)
+            delay += std::uniform_real_distribution<double>(0, jitter)(rng);
+        if (now >= warmup)
+        {
+            nmsgs++;
+            nbytes += size;
+        }
+        at(depart + delay, std::move(fn));
+    }
+
+    /** Run `fn` once a verification thread of `rid` spent `secs` on it. */
+    void compute(ReplicaID rid, double secs, std::function<void()> fn) {
+        auto &l = lanes[rid];
+        auto lane = std::min_element(l.begin(), l.end());
+        double done = std::max(now, *lane) + secs;
+        *lane = done;
+        if (now >= warmup) cpu_busy[rid] += secs;
+        at(done, std::move(fn));
+    }
+
+    void run(double until) {
+        while (!events.empty() && events.top().time <= until)
+        {
+            /* the handler may schedule further events */
+            Event ev = events.top();
+            events.pop();
+            now = ev.time;
+            ev.fn();
+        }
+        now = until;
+    }
+
+    double get_cpu_busy(ReplicaID rid) const { return cpu_busy[rid]; }
+    double get_nworker() const { return lanes.empty() ? 1 : lanes[0].size(); }
+};
+
+/** A replica running the unmodified HotStuffCore; the roles of HotStuffBase
+ * (tree dissemination, vote aggregation, the dummy pace maker of the fixed
+ * proposer) are replayed on the virtual clock. */
+class SimReplica: public HotStuffCore {
+    Simulator *sim;
+    Topology topo;
+    /** number of replicas below in the tree */
+    size_t nsubtree;
+    size_t blk_size;
+    std::mt19937_64 rng;
+
+    /* proposer state */
+    block_t last_proposed;
+    block_t hqc_tail;
+    bool locked;
+    bool beat_scheduled;
+    double last_block_time;
+    std::unordered_map<uint256_t, double> propose_time;
+
+    /* proposals whose ancestors are not there yet */
+    std::vector<Proposal> stashed;
+    /* votes that arrived ahead of their block */
+    std::unordered_map<uint256_t, std::vector<std::function<void()>>> blk_waiting;
+
+    bool is_leader() const { return get_id() == sim->leader; }
+
+    std::vector<uint256_t> make_cmds() {
+        std::vector<uint256_t> cmds;
+        cmds.reserve(blk_size);
+        bytearray_t raw(32);
+        for (size_t i = 0; i < blk_size; i++)
+        {
+            for (size_t j = 0; j < raw.size(); j += 8)
+            {
+                uint64_t r = rng();
+                memmove(raw.data() + j, &r, 8);
+            }
+            cmds.push_back(uint256_t(raw));
+        }
+        return cmds;
+    }
+
+    void reg_proposal() {
+        async_wait_proposal().then([this](const Proposal &prop) {
+            if (prop.blk->get_height() > hqc_tail->get_height())
+                hqc_tail = prop.blk;
+            reg_proposal();
+        });
+    }
+
+    void send_to(ReplicaID to, size_t size, std::function<void(SimReplica *)> fn) {
+        Simulator *s = sim;
+        sim->send(get_id(), size, [s, to, fn]() { fn(s->replicas[to]); });
+    }
+
+    void schedule_beat(double delay) {
+        if (beat_scheduled) return;
+        beat_scheduled = true;
+        sim->at(sim->now + delay, [this]() {
+            beat_scheduled = false;
+            beat();
+        });
+    }
+
+    /* mirrors HotStuffBase::beat() with PMWaitQC: a normal block waits for
+     * the QC of the previous one, piped blocks fill the gap every
+     * piped_latency */
+    void beat() {
+        const auto &cfg = get_config();
+        if ((int32_t)pipeline.size() > cfg.async_blocks + 1) return;
+        if (!locked)
+        {
+            last_block_time = sim->now;
+            block_t bnew = on_propose(make_cmds(), std::vector<block_t>{hqc_tail});
+            propose_time[bnew->get_hash()] = sim->now;
+            last_proposed = bnew;
+            locked = true;
+            async_qc_finish(bnew).then([this]() {
+                locked = false;
+                /* do not propose from within the vote processing */
+                schedule_beat(0);
+            });
+            /* the clients keep the proposer busy, pipeline in the meantime */
+            if (cfg.async_blocks > 0)
+                schedule_beat(cfg.piped_latency / 1000.0);
+            return;
+        }
+        if ((int32_t)pipeline.size() >= cfg.async_blocks) return;
+        double wait = last_block_time + cfg.piped_latency / 1000.0 - sim->now;
+        if (wait > 0)
+        {
+            schedule_beat(wait);
+            return;
+        }
+        block_t highest = last_proposed;
+        if (!pipeline.empty() && pipeline.back_height() > highest->get_height())
+            highest = storage->find_blk(pipeline.back());
+        std::vector<block_t> parents{hqc_tail};
+        if (parents[0]->get_height() < highest->get_height())
+            parents.insert(parents.begin(), highest);
+        block_t piped_block = storage->add_blk(new Block(parents, make_cmds(),
+                                                hqc.second->clone(), bytearray_t(),
+                                                parents[0]->get_height() + 1,
+                                                last_proposed,
+                                                nullptr));
+        pipeline.push(piped_block->get_hash(), piped_block->get_height());
+        propose_time[piped_block->get_hash()] = sim->now;
+        last_block_time = sim->now;
+        do_broadcast_proposal(Proposal(get_id(), piped_block, nullptr));
+        schedule_beat(cfg.piped_latency / 1000.0);
+    }
+
+    void deliver(const Proposal &prop) {
+        block_t blk = prop.blk;
+        if (blk->is_delivered()) return;
+        for (const auto &phash: blk->get_parent_hashes())
+        {
+            block_t p = storage->find_blk(phash);
+            if (p == nullptr || !p->is_delivered())
+            {
+                stashed.push_back(prop);
+                return;
+            }
+        }
+        if (storage->find_blk(blk->get_qc()->get_obj_hash()) == nullptr)
+        {
+            stashed.push_back(prop);
+            return;
+        }
+        on_deliver_blk(blk);
+        on_receive_proposal(prop);
+        std::vector<Proposal> pending;
+        pending.swap(stashed);
+        for (const auto &p: pending) deliver(p);
+    }
+
+    void wake_waiting(const uint256_t &blk_hash) {
+        auto it = blk_waiting.find(blk_hash);
+        if (it == blk_waiting.end()) return;
+        auto fns = std::move(it->second);
+        blk_waiting.erase(it);
+        for (auto &fn: fns) fn();
+    }
+
+    /** the check of a complete aggregate, which the optimistic mode relies on */
+    void after_check(std::function<void()> then) {
+        if (sim->cost.optimistic)
+            sim->compute(get_id(), sim->cost.verify, std::move(then));
+        else
+            then();
+    }
+
+    /** Common path of votes and relayed aggregates: `secs` of verification,
+     * then `add` folds the signatures into the aggregate of the block. */
+    void on_part(const uint256_t &blk_hash, double secs,
+                std::function<void(quorum_cert_bt &)> add) {
+        if (is_leader() && pipeline.contains(blk_hash))
+        {
+            block_t blk = storage->find_blk(blk_hash);
+            if (!blk->is_delivered()) process_block(blk, false);
+        }
+        block_t blk = storage->find_blk(blk_hash);
+        if (blk == nullptr)
+        {
+            blk_waiting[blk_hash].push_back([this, blk_hash, secs, add]() {
+                on_part(blk_hash, secs, add);
+            });
+            return;
+        }
+        if (blk->get_self_qc() == nullptr)
+        {
+            blk->get_self_qc() = create_quorum_cert(blk_hash);
+            blk->get_self_qc()->add_part(config, get_id(), *create_part_cert(*priv_key, blk_hash));
+        }
+        if (blk->get_self_qc()->has_n(config.nmajority)) return;
+
+        sim->compute(get_id(), secs, [this, blk, add]() {
+            auto &qc = blk->get_self_qc();
+            if (qc->has_n(config.nmajority)) return;
+            if (!is_leader())
+            {
+                if (qc->has_n(nsubtree + 1)) return;
+                add(qc);
+                if (!qc->has_n(nsubtree + 1)) return;
+                qc->compute();
+                after_check([this, blk]() {
+                    MsgRelay m(VoteRelay(blk->get_hash(), blk->get_self_qc()->clone(), this));
+                    DataStream data = m.serialized;
+                    send_to(topo.get_parent(get_id()), data.size(), [data](SimReplica *r) {
+                        r->on_relay(DataStream(data));
+                    });
+                });
+                return;
+            }
+            add(qc);
+            if (!qc->has_n(config.nmajority)) return;
+            qc->compute();
+            after_check([this, blk]() { finish_qc(blk); });
+        });
+    }
+
+    public:
+    SimReplica(Simulator *sim, ReplicaID rid, const Topology &topo, size_t blk_size):
+        HotStuffCore(rid, new hotstuff::PrivKeyDummy()),
+        sim(sim), topo(topo),
+        nsubtree(topo.get_descendants(rid).size()),
+        blk_size(blk_size), rng(rid),
+        locked(false), beat_scheduled(false), last_block_time(0) {
+        /* keep the memory of hundreds of replicas bounded */
+        set_prune(10, 0);
+    }
+
+    void start() {
+        last_proposed = hqc_tail = get_genesis();
+        numberOfChildren = nsubtree;
+        if (!is_leader()) return;
+        reg_proposal();
+        schedule_beat(0);
+    }
+
+    void on_proposal(DataStream &&s) {
+        MsgPropose msg(std::move(s));
+        /* relay right away, as HotStuffBase::propose_handler does */
+        for (const auto &c: topo.get_children(get_id()))
+        {
+            DataStream data = msg.serialized;
+            send_to(c, data.size(), [data](SimReplica *r) {
+                r->on_proposal(DataStream(data));
+            });
+        }
+        /* check the QC of the block and sign the vote */
+        double secs = sim->cost.verify + config.nmajority * sim->cost.pkagg + sim->cost.sign;
+        DataStream data = std::move(msg.serialized);
+        sim->compute(get_id(), secs, [this, data]() {
+            MsgPropose m(DataStream(data), true);
+            m.postponed_parse(this);
+            if (m.proposal.blk == nullptr) return;
+            wake_waiting(m.proposal.blk->get_hash());
+            deliver(m.proposal);
+        });
+    }
+
+    void on_vote(DataStream &&s) {
+        auto msg = std::make_shared<MsgVote>(std::move(s));
+        msg->postponed_parse(this);
+        double verify = sim->cost.optimistic ? 0 : sim->cost.verify;
+        on_part(msg->vote.blk_hash, verify + sim->cost.agg,
+            [this, msg](quorum_cert_bt &qc) {
+                qc->add_part(config, msg->vote.voter, *msg->vote.cert);
+            });
+    }
+
+    void on_relay(DataStream &&s) {
+        auto msg = std::make_shared<MsgRelay>(std::move(s));
+        msg->postponed_parse(this);
+        auto n = static_cast<QuorumCertSim &>(*msg->vote.cert).get_n();
+        double verify = sim->cost.optimistic ? 0 : sim->cost.verify + n * sim->cost.pkagg;
+        on_part(msg->vote.blk_hash, verify + sim->cost.agg,
+            [msg](quorum_cert_bt &qc) {
+                qc->merge_quorum(*msg->vote.cert);
+            });
+    }
+
+    protected:
+    void do_broadcast_proposal(const Proposal &prop) override {
+        /* the self-vote */
+        sim->compute(get_id(), sim->cost.sign, []() {});
+        MsgPropose m(prop, 0);
+        for (const auto &c: topo.get_children(get_id()))
+        {
+            DataStream data = m.serialized;
+            send_to(c, data.size(), [data](SimReplica *r) {
+                r->on_proposal(DataStream(data));
+            });
+        }
+    }
+
+    void do_vote(Proposal, const Vote &vote) override {
+        if (topo.get_children(get_id()).empty())
+        {
+            MsgVote m(vote);
+            DataStream data = m.serialized;
+            send_to(topo.get_parent(get_id()), data.size(), [data](SimReplica *r) {
+                r->on_vote(DataStream(data));
+            });
+            return;
+        }
+        block_t blk = get_delivered_blk(vote.blk_hash);
+        if (blk->get_self_qc() == nullptr)
+        {
+            blk->get_self_qc() = create_quorum_cert(vote.blk_hash);
+            blk->get_self_qc()->add_part(config, vote.voter, *vote.cert);
+        }
+    }
+
+    void do_decide(Finality &&) override {
+        if (is_leader() && sim->now >= sim->warmup) sim->ndecided++;
+    }
+
+    void do_consensus(const block_t &blk) override {
+        auto it = propose_time.find(blk->get_hash());
+        if (it != propose_time.end())
+        {
+            if (it->second >= sim->warmup)
+                sim->commit_lat.push_back(sim->now - it->second);
+            propose_time.erase(it);
+        }
+    }
+
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertSim(blk_hash);
+    }
+
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        PartCert *pc = new PartCertSim();
+        s >> *pc;
+        return pc;
+    }
+
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertSim(get_config(), blk_hash);
+    }
+
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        QuorumCert *qc = new QuorumCertSim();
+        s >> *qc;
+        return qc;
+    }
+};
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.gen.conf");
+
+    auto opt_blk_size = Config::OptValInt::create(1);
+    auto opt_replicas = Config::OptValStrVec::create();
+    auto opt_fixed_proposer = Config::OptValInt::create(1);
+    auto opt_nworker = Config::OptValInt::create(1);
+    auto opt_fanout = Config::OptValInt::create(2);
+    auto opt_level_fanout = Config::OptValStr::create();
+    auto opt_piped_latency = Config::OptValInt::create(10);
+    auto opt_async_blocks = Config::OptValInt::create(0);
+    auto opt_help = Config::OptValFlag::create(false);
+    auto opt_nreplicas = Config::OptValInt::create(0); // from the replica list by default
+    auto opt_duration = Config::OptValDouble::create(10);
+    auto opt_warmup = Config::OptValDouble::create(1);
+    auto opt_latency = Config::OptValDouble::create(50);
+    auto opt_jitter = Config::OptValDouble::create(0);
+    auto opt_bandwidth = Config::OptValDouble::create(1000);
+    auto opt_sign_us = Config::OptValDouble::create(400);
+    auto opt_verify_us = Config::OptValDouble::create(1600);
+    auto opt_agg_us = Config::OptValDouble::create(5);
+    auto opt_pkagg_us = Config::OptValDouble::create(2);
+    auto opt_optimistic = Config::OptValFlag::create(false);
+
+    config.add_opt("block-size", opt_blk_size, Config::SET_VAL);
+    config.add_opt("replica", opt_replicas, Config::APPEND, 'a', "add an replica to the list");
+    config.add_opt("proposer", opt_fixed_proposer, Config::SET_VAL, 'l', "set the fixed proposer");
+    config.add_opt("nworker", opt_nworker, Config::SET_VAL, 'n', "the number of threads for verification");
+    config.add_opt("fan-out", opt_fanout, Config::SET_VAL, 'F', "fanout");
+    config.add_opt("level-fanout", opt_level_fanout, Config::SET_VAL, 'L', "comma-separated fan-out of each tree level (the last one repeats)");
+    config.add_opt("piped_latency", opt_piped_latency, Config::SET_VAL, 'P', "Latency between the block pipelining");
+    config.add_opt("async_blocks", opt_async_blocks, Config::SET_VAL, 'A', "Async blocks to pipeline");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.add_opt("sim-replicas", opt_nreplicas, Config::SET_VAL, 'N', "the number of simulated replicas (overrides the replica list)");
+    config.add_opt("sim-duration", opt_duration, Config::SET_VAL, 'd', "virtual seconds to simulate");
+    config.add_opt("sim-warmup", opt_warmup, Config::SET_VAL, 'w', "virtual seconds excluded from the statistics");
+    config.add_opt("sim-latency", opt_latency, Config::SET_VAL, 'e', "one-way link latency in ms");
+    config.add_opt("sim-jitter", opt_jitter, Config::SET_VAL, 'j', "uniformly distributed extra latency in ms");
+    config.add_opt("sim-bandwidth", opt_bandwidth, Config::SET_VAL, 'g', "uplink bandwidth of every replica in Mbit/s (0 for unlimited)");
+    config.add_opt("sim-sign-us", opt_sign_us, Config::SET_VAL, 'S', "microseconds to sign a vote");
+    config.add_opt("sim-verify-us", opt_verify_us, Config::SET_VAL, 'V', "microseconds to verify a signature (pairing check)");
+    config.add_opt("sim-agg-us", opt_agg_us, Config::SET_VAL, 'G', "microseconds to add a signature to an aggregate");
+    config.add_opt("sim-pkagg-us", opt_pkagg_us, Config::SET_VAL, 'K', "microseconds to add a public key to an aggregated key");
+    config.add_opt("sim-optimistic", opt_optimistic, Config::SWITCH_ON, 'O', "verify only the complete aggregates (see optimistic-verify)");
+
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        exit(0);
+    }
+
+    size_t nreplicas = opt_nreplicas->get() > 0 ? opt_nreplicas->get() : opt_replicas->get().size();
+    if (nreplicas == 0)
+        throw HotStuffError("no replicas to simulate");
+    ReplicaID leader = opt_fixed_proposer->get();
+    if (leader >= nreplicas)
+        throw HotStuffError("proposer out of range");
+
+    std::vector<uint32_t> fanouts;
+    if (!opt_level_fanout->get().empty())
+        for (const auto &f: trim_all(split(opt_level_fanout->get(), ",")))
+            fanouts.push_back(std::stoul(f));
+    if (fanouts.empty())
+        fanouts.push_back(std::max(opt_fanout->get(), 1));
+    /* the tree of HotStuffBase::start(): the proposer is the root */
+    std::vector<ReplicaID> order{leader};
+    for (ReplicaID rid = 0; rid < nreplicas; rid++)
+        if (rid != leader) order.push_back(rid);
+    Topology topo = Topology::from_order(order, fanouts);
+
+    CryptoCost cost{opt_sign_us->get() / 1e6, opt_verify_us->get() / 1e6,
+                    opt_agg_us->get() / 1e6, opt_pkagg_us->get() / 1e6,
+                    opt_optimistic->get()};
+    Simulator sim(nreplicas, opt_nworker->get(),
+                opt_latency->get() / 1e3, opt_jitter->get() / 1e3,
+                opt_bandwidth->get() * 1e6 / 8, cost, leader, opt_warmup->get());
+
+    std::vector<std::unique_ptr<SimReplica>> reps;
+    for (ReplicaID rid = 0; rid < nreplicas; rid++)
+    {
+        reps.emplace_back(new SimReplica(&sim, rid, topo, opt_blk_size->get()));
+        sim.replicas.push_back(reps.back().get());
+    }
+    for (auto &r: reps)
+    {
+        for (ReplicaID rid = 0; rid < nreplicas; rid++)
+        {
+            DataStream s;
+            s << htole((uint32_t)rid);
+            r->add_replica(rid, salticidae::PeerId(s.get_hash()), new hotstuff::PubKeyDummy());
+        }
+        r->set_fanout(fanouts[0]);
+        r->set_piped_latency(opt_piped_latency->get(), opt_async_blocks->get());
+        r->on_init((nreplicas - 1) / 3);
+    }
+    for (auto &r: reps) r->start();
+
+    double duration = opt_duration->get();
+    sim.run(duration);
+
+    double span = std::max(duration - sim.warmup, 1e-9);
+    auto &lat = sim.commit_lat;
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&lat](double p) {
+        return lat.empty() ? 0 : lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))] * 1e3;
+    };
+    double avg = 0;
+    for (const auto &l: lat) avg += l;
+    if (!lat.empty()) avg = avg / lat.size() * 1e3;
+
+    printf("replicas %lu, tree height %u, fan-out %u, nworker %d, async_blocks %d\n",
+            nreplicas, topo.get_height(), fanouts[0], opt_nworker->get(), opt_async_blocks->get());
+    printf("throughput: %.1f cmds/s (%lu blocks in %.1f virtual sec)\n",
+            sim.ndecided / span, lat.size(), span);
+    printf("commit latency: avg %.1f ms, p50 %.1f ms, p99 %.1f ms\n",
+            avg, pct(0.5), pct(0.99));
+    printf("proposer cpu: %.1f%%, messages: %lu (%.1f MB)\n",
+            sim.get_cpu_busy(leader) / (span * sim.get_nworker()) * 100,
+            sim.nmsgs, sim.nbytes / 1e6);
+    return 0;
+}
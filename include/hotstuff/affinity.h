@@ -0,0 +1,97 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_AFFINITY_H
+#define _HOTSTUFF_AFFINITY_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sched.h>
+#include <sys/time.h>
+
+namespace hotstuff {
+
+/** The kinds of threads a replica runs. */
+enum ThreadClass {
+    /** the event loop of the protocol */
+    THREAD_MAIN,
+    /** VeriPool workers */
+    THREAD_VERIFY,
+    /** SignPool workers */
+    THREAD_SIGN,
+    /** the workers of the replica network */
+    THREAD_NET,
+    /** the client request/response threads and the client network */
+    THREAD_CLIENT,
+    /** the writer of the write-ahead log */
+    THREAD_WAL,
+    THREAD_NCLASSES
+};
+
+/** The cores every class of threads is pinned to. */
+class ThreadLayout {
+    /** empty for the classes that float freely */
+    std::vector<int> cpus[THREAD_NCLASSES];
+
+    static std::vector<int> parse_cpus(const std::string &spec);
+
+    public:
+    /** Parse a layout like "main:0;verify:1-3,8;net:node1", which pins
+     * every named class to a list of cores or to the cores of a NUMA
+     * node. */
+    static ThreadLayout parse(const std::string &spec);
+
+    /** Pin the calling thread to the cores of `cls`. */
+    void pin(ThreadClass cls) const;
+    /** Pin the calling thread and name it after `cls`, for a thread that
+     * belongs to the class for its whole life. */
+    void enter(ThreadClass cls) const;
+    std::string to_string() const;
+
+    /** Pins (and names) the calling thread for the threads it spawns in
+     * its scope, which inherit both. Used for the threads started inside
+     * salticidae. */
+    class Scope {
+        cpu_set_t mask;
+        char name[16];
+        public:
+        Scope(const ThreadLayout &layout, ThreadClass cls);
+        ~Scope();
+    };
+};
+
+/** the layout of this process */
+extern ThreadLayout thread_layout;
+
+/** CPU utilization of the threads of this process (from /proc), grouped
+ * by thread name. */
+class ThreadCpuStat {
+    std::unordered_map<long, unsigned long long> last_ticks;
+    struct timeval last;
+
+    public:
+    ThreadCpuStat();
+    /** name -> (number of threads, percent of a core) since the last call;
+     * a thread started since then shows up from the next call on */
+    std::map<std::string, std::pair<size_t, double>> sample();
+};
+
+}
+
+#endif
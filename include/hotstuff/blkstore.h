@@ -0,0 +1,130 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_BLKSTORE_H
+#define _HOTSTUFF_BLKSTORE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hotstuff/entity.h"
+
+namespace hotstuff {
+
+/** The committed chain on disk, for serving the blocks pruned from memory.
+ *
+ * Blocks are appended in their serialized (wire) form to segment files of
+ * a fixed size, which stay mapped so that a block can be sent right from
+ * the page cache. Two memory-mapped files index them: one entry per
+ * height, and an open-addressing hash table from the block hash to its
+ * height. Nothing is synced, a crash loses at most the tail, which is
+ * dropped upon opening the store again. */
+class BlockStore {
+    public:
+    using raw_t = std::pair<const uint8_t *, size_t>;
+
+    private:
+    struct Entry {
+        uint8_t hash[32];
+        uint64_t offset;
+        uint32_t seg;
+        uint32_t len;
+    };
+
+    struct Segment {
+        int fd;
+        uint8_t *map;
+        size_t map_len;
+        size_t size;
+    };
+
+    struct IndexHeader {
+        uint64_t magic;
+        uint64_t count;
+        uint32_t base_height;
+        uint32_t pad;
+    };
+
+    std::string dir;
+    size_t seg_size;
+    std::vector<Segment> segs;
+
+    /* height index */
+    int idx_fd;
+    uint8_t *idx_map;
+    size_t idx_cap;
+    IndexHeader *header() const { return reinterpret_cast<IndexHeader *>(idx_map); }
+    Entry *entries() const { return reinterpret_cast<Entry *>(idx_map + sizeof(IndexHeader)); }
+
+    /* hash index, the slots hold height - base_height + 1 (0 is empty) */
+    struct HashHeader {
+        /** entries of the height index it covers */
+        uint64_t count;
+        uint64_t cap;
+    };
+    int hidx_fd;
+    uint8_t *hidx_map;
+    HashHeader *hash_header() const { return reinterpret_cast<HashHeader *>(hidx_map); }
+    uint32_t *slots() const { return reinterpret_cast<uint32_t *>(hidx_map + sizeof(HashHeader)); }
+
+    size_t nbytes;
+
+    std::string seg_name(uint32_t seg) const;
+    void open_segment(uint32_t seg, size_t min_len);
+    /** Map `fd` with room for `cap` bytes. */
+    static uint8_t *map_file(int fd, size_t cap, bool writable);
+    void grow_index(size_t count);
+    void build_hash_index(size_t cap);
+    void hash_insert(uint64_t pos);
+    /** position of the entry of `hash` in the height index, or -1 */
+    int64_t hash_find(const uint256_t &hash) const;
+    raw_t get_entry(uint64_t pos) const;
+
+    public:
+    BlockStore(const std::string &dir, size_t seg_size = 64 << 20);
+    ~BlockStore();
+
+    BlockStore(const BlockStore &) = delete;
+    BlockStore &operator=(const BlockStore &) = delete;
+
+    /** Append a committed block, above the highest one stored. Returns
+     * false if the block is stored already or out of order. */
+    bool put(const Block &blk);
+
+    bool contains(const uint256_t &hash) const { return hash_find(hash) >= 0; }
+    /** The serialized block, pointing into the mapped segment, or
+     * (nullptr, 0). */
+    raw_t get_raw(const uint256_t &hash) const;
+    raw_t get_raw_by_height(uint32_t height) const;
+    uint256_t get_hash(uint32_t height) const;
+
+    bool empty() const { return header()->count == 0; }
+    /** heights of the lowest and the highest stored block */
+    uint32_t get_base_height() const { return header()->base_height; }
+    uint32_t get_top_height() const {
+        return header()->base_height + header()->count - 1;
+    }
+    /** heights covered, those skipped included */
+    size_t get_nblocks() const { return header()->count; }
+    size_t get_nsegments() const { return segs.size(); }
+    size_t get_bytes() const { return nbytes; }
+};
+
+}
+
+#endif
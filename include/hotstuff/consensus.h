@@ -19,13 +19,16 @@
 #define _HOTSTUFF_CONSENSUS_H
 
 #include <cassert>
+#include <deque>
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "hotstuff/promise.hpp"
 #include "hotstuff/type.h"
 #include "hotstuff/entity.h"
 #include "hotstuff/crypto.h"
+#include "hotstuff/pipeline.h"
 
 namespace hotstuff {
 
@@ -69,6 +72,35 @@ class HotStuffCore {
     protected:
     ReplicaID id;                  /**< identity of the replica itself */
 
+    /* bounded-memory pruning */
+    uint32_t prune_depth;
+    size_t prune_max_bytes;
+    /** committed blocks still kept, lowest first */
+    std::deque<block_t> committed;
+    /** detached blocks yet to be released */
+    std::vector<block_t> prune_garbage;
+    /** blocks still referenced when they were to be released */
+    std::vector<block_t> prune_held;
+    /** smoothed footprint of a committed block */
+    double avg_blk_bytes;
+
+    /** whether either limit of set_prune() is on */
+    bool pruning() const { return prune_depth || prune_max_bytes; }
+    /** Detach the committed blocks beyond the retention from the chain. */
+    void prune_cut();
+    void release_pruned(const block_t &blk);
+
+    /* write-ahead logging */
+    bool log_enabled;
+    /** blocks in the log from b_exec up, the committed ones below are
+     * not needed to recover */
+    std::unordered_set<uint256_t> logged;
+    /** Log blk and the ancestors of it that are not in the log yet. */
+    void log_chain(const block_t &blk);
+    /** Log the state a vote depends on, before the vote is signed. */
+    void log_state();
+    bytearray_t state_record() const;
+
     block_t get_delivered_blk(const uint256_t &blk_hash);
 
     block_t get_potentially_not_delivered_blk(const uint256_t &blk_hash);
@@ -79,6 +111,10 @@ class HotStuffCore {
 
     void on_qc_finish(const block_t &blk);
 
+    /** Finish the completed QC (self_qc) of blk, holding it back until the
+     * pipelined blocks proposed before it are finished. */
+    void finish_qc(const block_t &blk);
+
 /* === auxilliary variables === */
 privkey_bt priv_key;
 /** block containing the QC for the highest block having one */
@@ -146,27 +182,32 @@ public:
      * functions should be implemented by the user to specify the behavior upon
      * the events. */
 
-    // Pipelined block hash.
-    std::deque<uint256_t> piped_queue;
-
-    // Pipelined block hash.
-    std::deque<uint256_t> rdy_queue;
+    /** Pipelined blocks in flight. */
+    PipelineWindow pipeline;
 
-    // Last regular block height.
-    int b_normal_height = 0;
+    /* pruning statistics, part_* are reset by the user */
+    mutable size_t part_pruned;
+    mutable size_t part_reclaimed;
+    size_t total_reclaimed;
 
     /* Block hex to us time spent on block*/
     std::map<uint256_t, long> stats;
-
-    // If already a piped block was submitted.
-    bool piped_submitted = false;
-
-    // Last sent out block time.
-    mutable struct timeval last_block_time;
 protected:
     /** Called by HotStuffCore upon the decision being made for cmd. */
     virtual void do_decide(Finality &&fin) = 0;
     virtual void do_consensus(const block_t &blk) = 0;
+    /** Called by HotStuffCore when blocks were detached for pruning, the
+     * user should call prune_step() until they are released, in small
+     * steps so that the event loop does not stall. The default releases
+     * them all at once. */
+    virtual void schedule_prune() { prune_step(SIZE_MAX); }
+    /** Called by HotStuffCore for every block it is about to release, to
+     * drop the per-block state kept outside of the core. */
+    virtual void do_prune(const block_t &) {}
+    /** Called by HotStuffCore with a record to append to the write-ahead
+     * log, see set_logging(). The vote that follows a state record must
+     * not go out before the record is durable. */
+    virtual void do_log(bytearray_t &&) {}
     /** Called by HotStuffCore upon broadcasting a new proposal.
      * The user should send the proposal message to all replicas except for
      * itself. */
@@ -181,6 +222,10 @@ protected:
     public:
     /** Create a partial certificate that proves the vote for a block. */
     virtual part_cert_bt create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) = 0;
+    /** Create the partial certificate of an own vote, possibly in the
+     * background. The promise resolves with the new certificate (PartCert *,
+     * owned by the receiver); by default it is created right away. */
+    virtual promise_t async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash);
     /** Create a partial certificate from its seralized form. */
     virtual part_cert_bt parse_part_cert(DataStream &s) = 0;
     /** Create a quorum certificate that proves 2f+1 votes for a block. */
@@ -196,6 +241,26 @@ protected:
     void add_replica(ReplicaID rid, const PeerId &peer_id, pubkey_bt &&pub_key);
     /** Try to prune blocks lower than last committed height - staleness. */
     void prune(uint32_t staleness);
+    /** Keep `depth` committed blocks (0 keeps all) and fewer of them when
+     * the blocks in memory would take more than `max_bytes` (0 for no cap).
+     * The blocks beyond are detached upon every commit and released in
+     * steps, see schedule_prune(). */
+    void set_prune(uint32_t depth, size_t max_bytes) {
+        prune_depth = depth;
+        prune_max_bytes = max_bytes;
+    }
+    /** Release up to `budget` detached blocks, returns whether some are
+     * left. */
+    bool prune_step(size_t budget);
+    /** Turn on the records passed to do_log(). */
+    void set_logging(bool enabled) { log_enabled = enabled; }
+    /** The records that reproduce the logged state, to replace a log that
+     * has grown too long: b_exec and the blocks above it. */
+    std::vector<bytearray_t> log_snapshot();
+    /** Rebuild the state from the records of a log, should be called after
+     * on_init() and before the protocol runs. Returns the number of blocks
+     * recovered. */
+    size_t restore(const std::vector<bytearray_t> &recs);
 
     /* PaceMaker can use these functions to monitor the core protocol state
      * transition */
@@ -211,6 +276,8 @@ protected:
     /* Other useful functions */
     const block_t &get_genesis() const { return b0; }
     const block_t &get_hqc() { return hqc.first; }
+    /** the last committed block */
+    const block_t &get_exec() const { return b_exec; }
     const ReplicaConfig &get_config() const { return config; }
     ReplicaID get_id() const { return id; }
     const std::set<block_t> get_tails() const { return tails; }
@@ -17,12 +17,17 @@
 #ifndef _HOTSTUFF_CRYPTO_H
 #define _HOTSTUFF_CRYPTO_H
 
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <openssl/rand.h>
 
 #include "secp256k1.h"
 #include "salticidae/crypto.h"
 #include "hotstuff/type.h"
 #include "hotstuff/task.h"
+#include "hotstuff/slab.h"
 #include "bls/src/bls.hpp"
 #include <libnet.h>
 
@@ -62,7 +67,12 @@ class QuorumCert: public Serializable, public Cloneable {
     public:
     virtual ~QuorumCert() = default;
     virtual void add_part(const ReplicaConfig &config, ReplicaID replica, const PartCert &pc) = 0;
-    virtual void merge_quorum(const QuorumCert &qc) = 0;
+    /** Add the signers of `qc`. Returns false, leaving the certificate as
+     * it is, if the two share signers in a way that cannot be merged; the
+     * missing votes then have to be collected one by one. */
+    virtual bool merge_quorum(const QuorumCert &qc) = 0;
+    /** the replicas that signed, empty if not tracked */
+    virtual std::vector<ReplicaID> get_signers() const { return {}; }
     virtual bool has_n(uint32_t n) = 0;
     virtual void compute() = 0;
     virtual promise_t verify(const ReplicaConfig &config, VeriPool &vpool) = 0;
@@ -198,9 +208,10 @@ class QuorumCertDummy: public QuorumCert {
     {
         qty++;
     }
-    void merge_quorum(const QuorumCert & qc) override
+    bool merge_quorum(const QuorumCert & qc) override
     {
         qty += ((QuorumCertDummy&) qc).qty;
+        return true;
     }
     bool has_n(const uint32_t n) override
     {
@@ -495,7 +506,7 @@ class QuorumCertSecp256k1: public QuorumCert {
         rids.set(rid);
     }
 
-    void merge_quorum(const QuorumCert &qc) override {
+    bool merge_quorum(const QuorumCert &qc) override {
         if (qc.get_obj_hash() != obj_hash)
             throw std::invalid_argument("QuorumCert does match the block hash");
         for (const std::pair<const unsigned short, SigSecp256k1>& sig : dynamic_cast<const QuorumCertSecp256k1 &>(qc).sigs) {
@@ -503,6 +514,13 @@ class QuorumCertSecp256k1: public QuorumCert {
                     sig.first, sig.second));
             rids.set(sig.first);
         }
+        return true;
+    }
+
+    std::vector<ReplicaID> get_signers() const override {
+        std::vector<ReplicaID> ret;
+        for (const auto &sig: sigs) ret.push_back(sig.first);
+        return ret;
     }
 
     bool has_n(const uint32_t n) override {
@@ -534,31 +552,85 @@ class QuorumCertSecp256k1: public QuorumCert {
     }
 };
 
+    /** The G2 points the signed hashes map to. All votes and certificates
+     * of a block sign its hash, so hash-to-curve runs once per block rather
+     * than once per signature. Shared by the event loop and the
+     * verification workers. */
+    class HashPointCacheBLS {
+        static const size_t capacity = 128;
+
+        std::mutex mlock;
+        std::unordered_map<const uint256_t, bls::G2Element> points;
+        /** insertion order, for eviction */
+        std::deque<uint256_t> order;
+
+    public:
+        bls::G2Element get(const uint256_t &msg);
+    };
+
+    extern HashPointCacheBLS bls_hash_points;
+
+    /** The signatures that are known to be valid: votes by (hash, signer
+     * key, signature) and aggregates by (hash, signer bitmap, signature).
+     * A certificate merged from known-valid parts only, or seen before, is
+     * accepted without another pairing check. */
+    class VeriLedgerBLS {
+        static const size_t capacity = 8192;
+
+        std::mutex mlock;
+        std::unordered_set<uint256_t> proven;
+        /** insertion order, for eviction */
+        std::deque<uint256_t> order;
+
+    public:
+        static uint256_t vote_key(const uint256_t &obj_hash,
+                                const bls::G1Element &pub,
+                                const bls::G2Element &sig);
+        static uint256_t qc_key(const uint256_t &obj_hash,
+                                const salticidae::Bits &rids,
+                                const bls::G2Element &sig);
+        bool has(const uint256_t &key);
+        void add(const uint256_t &key);
+    };
+
+    extern VeriLedgerBLS bls_veri_ledger;
+
+    /** the points held by keys, signatures and certificates */
+    extern TypedSlabPool<bls::G1Element> bls_g1_slab;
+    extern TypedSlabPool<bls::G2Element> bls_g2_slab;
+
     class PrivKeyBLS;
     class PubKeyBLS: public PubKey {
         static const auto _olen = bls::G1Element::SIZE;
         friend class SigSecBLS;
         friend class SigSecBLSAgg;
         friend class QuorumCertAggBLS;
+        friend class PubKeyAggCacheBLS;
+        friend class SigVeriTaskBLS;
+        friend class PartCertBLSAgg;
 
         bls::G1Element* data = nullptr;
 
+        static SlabPool slab;
+
     public:
+        static void *operator new(size_t size) { return slab.alloc(size); }
+        static void operator delete(void *p, size_t size) { slab.free(p, size); }
 
         PubKeyBLS() :
                 PubKey() {}
 
         PubKeyBLS(const bytearray_t &raw_bytes) :
                 PubKeyBLS() {
-            data = new bls::G1Element(bls::G1Element::FromBytes(&raw_bytes[0]));
+            data = bls_g1_slab.create(bls::G1Element::FromBytes(&raw_bytes[0]));
         }
 
         PubKeyBLS(const PubKeyBLS &obj) {
-            data = new bls::G1Element(*(obj.data));
+            data = bls_g1_slab.create(*(obj.data));
         }
 
         ~PubKeyBLS() override {
-            delete data;
+            bls_g1_slab.destroy(data);
             data = nullptr;
         }
 
@@ -579,7 +651,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             static const auto _exc = std::invalid_argument("ill-formed public key");
 
             try {
-                data = new bls::G1Element(bls::G1Element::FromBytes(s.get_data_inplace(_olen)));
+                data = bls_g1_slab.create(bls::G1Element::FromBytes(s.get_data_inplace(_olen)));
             } catch (std::ios_base::failure &) {
                 throw _exc;
             }
@@ -594,8 +666,15 @@ class QuorumCertSecp256k1: public QuorumCert {
         static const auto nbytes = bls::PrivateKey::PRIVATE_KEY_SIZE;
         friend class SigSecBLS;
 
+        void load(const bls::PrivateKey &key) {
+            data = new bls::PrivateKey(key);
+            pub = bls_g1_slab.create(key.GetG1Element());
+        }
+
     public:
         bls::PrivateKey* data = nullptr;
+        /** the public key, derived once */
+        bls::G1Element* pub = nullptr;
 
         PrivKeyBLS():
                 PrivKey() {}
@@ -605,7 +684,7 @@ class QuorumCertSecp256k1: public QuorumCert {
                 {
                     static const auto _exc = std::invalid_argument("ill-formed public key");
                     try {
-                        data = new bls::PrivateKey(bls::PrivateKey::FromBytes(&raw_bytes[0]));
+                        load(bls::PrivateKey::FromBytes(&raw_bytes[0]));
                     } catch (std::ios_base::failure &) {
                         throw _exc;
                     }
@@ -615,6 +694,8 @@ class QuorumCertSecp256k1: public QuorumCert {
         {
             delete data;
             data = nullptr;
+            bls_g1_slab.destroy(pub);
+            pub = nullptr;
         }
 
         void serialize(DataStream &s) const override {
@@ -627,7 +708,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             static const auto _exc = std::invalid_argument("ill-formed public key");
             try {
                 const uint8_t* dat = s.get_data_inplace(bls::PrivateKey::PRIVATE_KEY_SIZE);
-                data = new bls::PrivateKey(bls::PrivateKey(bls::PrivateKey::FromBytes(dat)));
+                load(bls::PrivateKey::FromBytes(dat));
             } catch (std::ios_base::failure &) {
                 throw _exc;
             }
@@ -638,7 +719,7 @@ class QuorumCertSecp256k1: public QuorumCert {
                                     19, 18, 12, 89,  6,   static_cast<unsigned char>(rand() % 250), 18, 102, 58,  209, 82,
                                     12, 62, 89, 110, 182, static_cast<unsigned char>(rand() % 250),   44, 20,  254, 22};
 
-            data = new bls::PrivateKey(bls::PopSchemeMPL::KeyGen(seed));
+            load(bls::PopSchemeMPL::KeyGen(seed));
         }
 
         inline pubkey_bt get_pubkey() const override;
@@ -649,7 +730,7 @@ class QuorumCertSecp256k1: public QuorumCert {
     }
 
     PubKeyBLS::PubKeyBLS(const PrivKeyBLS &priv_key): PubKey() {
-        data = new bls::G1Element(priv_key.data->GetG1Element());
+        data = bls_g1_slab.create(*priv_key.pub);
     }
 
     class SigSecBLS: public Serializable {
@@ -672,18 +753,18 @@ class QuorumCertSecp256k1: public QuorumCert {
 
         SigSecBLS (const SigSecBLS &obj)
         {
-            data = new bls::G2Element(*(obj.data));
+            data = bls_g2_slab.create(*(obj.data));
         }
 
         SigSecBLS (bls::G2Element sig):
                 Serializable()
                 {
-                    data = new bls::G2Element(sig);
+                    data = bls_g2_slab.create(sig);
                 }
 
         ~SigSecBLS() override
         {
-            delete data;
+            bls_g2_slab.destroy(data);
             data = nullptr;
         }
 
@@ -701,7 +782,7 @@ class QuorumCertSecp256k1: public QuorumCert {
         void unserialize(DataStream &s) override {
             static const auto _exc = std::invalid_argument("ill-formed signature");
             try {
-                data = new bls::G2Element(bls::G2Element::FromBytes(s.get_data_inplace(bls::G2Element::SIZE)));
+                data = bls_g2_slab.create(bls::G2Element::FromBytes(s.get_data_inplace(bls::G2Element::SIZE)));
             } catch (std::ios_base::failure &) {
                 throw _exc;
             }
@@ -712,7 +793,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             //gettimeofday(&timeStart, nullptr);
 
             check_msg_length(msg);
-            data = new bls::G2Element(bls::PopSchemeMPL::Sign(*priv_key.data, arrToVec(msg)));
+            data = bls_g2_slab.create(bls::PopSchemeMPL::SignHashed(*priv_key.data, bls_hash_points.get(msg)));
 
             //gettimeofday(&timeEnd, nullptr);
 
@@ -728,7 +809,7 @@ class QuorumCertSecp256k1: public QuorumCert {
 
             //struct timeval timeStart, timeEnd;
             //gettimeofday(&timeStart, nullptr);
-            bool td = bls::PopSchemeMPL::Verify(*(pub_key.data), arrToVec(msg), *data);
+            bool td = bls::PopSchemeMPL::VerifyHashed(*(pub_key.data), bls_hash_points.get(msg), *data);
 
             /*gettimeofday(&timeEnd, nullptr);
 
@@ -741,10 +822,32 @@ class QuorumCertSecp256k1: public QuorumCert {
         }
     };
 
-    class SigVeriTaskBLS: public VeriTask {
+    /** A BLS signature check that can be batched with others. With random
+     * 64-bit weights r_i, a batch is valid if
+     * prod e(r_i * pub_i, H(msg_i)) = e(g1, sum r_i * sig_i), which does
+     * not hold with probability 1 - 2^-64 if any of the tasks is invalid. The
+     * tasks on the same message share H(msg) and a single pairing. */
+    class BLSVeriTask: public BatchVeriTask {
+    protected:
+        virtual const uint256_t &get_msg() const = 0;
+        virtual const bls::G1Element &get_pub() const = 0;
+        virtual const bls::G2Element &get_sig() const = 0;
+
+    public:
+        bool verify_batch(const std::vector<BatchVeriTask *> &tasks) override;
+        std::type_index batch_kind() const override { return typeid(BLSVeriTask); }
+    };
+
+    class SigVeriTaskBLS: public BLSVeriTask {
         uint256_t msg;
         PubKeyBLS pubkey;
         SigSecBLS sig;
+
+    protected:
+        const uint256_t &get_msg() const override { return msg; }
+        const bls::G1Element &get_pub() const override { return *pubkey.data; }
+        const bls::G2Element &get_sig() const override { return *sig.data; }
+
     public:
         SigVeriTaskBLS(const uint256_t &msg,
                           const PubKeyBLS &pubkey,
@@ -802,9 +905,14 @@ class QuorumCertSecp256k1: public QuorumCert {
                 throw std::invalid_argument("the message should be 32-bytes");
         }
 
+        static SlabPool slab;
+
     public:
         bls::G2Element* data = nullptr;
 
+        static void *operator new(size_t size) { return slab.alloc(size); }
+        static void operator delete(void *p, size_t size) { slab.free(p, size); }
+
         SigSecBLSAgg ():
                 Serializable(){}
         SigSecBLSAgg(const uint256_t &digest,
@@ -815,18 +923,18 @@ class QuorumCertSecp256k1: public QuorumCert {
 
         SigSecBLSAgg (const SigSecBLSAgg &obj)
         {
-            data = new bls::G2Element(*(obj.data));
+            data = bls_g2_slab.create(*(obj.data));
         }
 
         SigSecBLSAgg (bls::G2Element sig):
                 Serializable()
         {
-            data = new bls::G2Element(sig);
+            data = bls_g2_slab.create(sig);
         }
 
         ~SigSecBLSAgg() override
         {
-            delete data;
+            bls_g2_slab.destroy(data);
             data = nullptr;
         }
 
@@ -844,7 +952,7 @@ class QuorumCertSecp256k1: public QuorumCert {
         void unserialize(DataStream &s) override {
             static const auto _exc = std::invalid_argument("ill-formed signature");
             try {
-                data = new bls::G2Element(bls::G2Element::FromBytes(s.get_data_inplace(bls::G2Element::SIZE)));
+                data = bls_g2_slab.create(bls::G2Element::FromBytes(s.get_data_inplace(bls::G2Element::SIZE)));
             } catch (std::ios_base::failure &) {
                 throw _exc;
             }
@@ -855,7 +963,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             //gettimeofday(&timeStart, nullptr);
 
             check_msg_length(msg);
-            data = new bls::G2Element(bls::PopSchemeMPL::Sign(*priv_key.data, arrToVec(msg)));
+            data = bls_g2_slab.create(bls::PopSchemeMPL::SignHashed(*priv_key.data, bls_hash_points.get(msg)));
 
             //gettimeofday(&timeEnd, nullptr);
 
@@ -872,7 +980,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             struct timeval timeStart, timeEnd;
             gettimeofday(&timeStart, nullptr);
 
-            bool td = bls::PopSchemeMPL::Verify(*(pub_key.data), arrToVec(msg), *data);
+            bool td = bls::PopSchemeMPL::VerifyHashed(*(pub_key.data), bls_hash_points.get(msg), *data);
 
             gettimeofday(&timeEnd, nullptr);
 
@@ -885,15 +993,22 @@ class QuorumCertSecp256k1: public QuorumCert {
         }
     };
 
-    class SigVeriTaskBLSAgg: public VeriTask {
+    class SigVeriTaskBLSAgg: public BLSVeriTask {
         uint256_t msg;
-        vector<bls::G1Element> pubs;
+        bls::G1Affine pub;
         SigSecBLSAgg sig;
+
+    protected:
+        const uint256_t &get_msg() const override { return msg; }
+        const bls::G1Element &get_pub() const override { return pub.GetElement(); }
+        const bls::G2Element &get_sig() const override { return *sig.data; }
+
     public:
+        /** `pub` is the aggregate of the public keys of all signers */
         SigVeriTaskBLSAgg(uint256_t msg,
-                          vector<bls::G1Element> pubs,
+                          const bls::G1Affine &pub,
                           const SigSecBLSAgg &sig):
-                msg(std::move(msg)), pubs(std::move(pubs)), sig(sig) {}
+                msg(std::move(msg)), pub(pub), sig(sig) {}
         virtual ~SigVeriTaskBLSAgg() = default;
 
         bool verify() override {
@@ -901,7 +1016,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             //struct timeval timeStart, timeEnd;
             //gettimeofday(&timeStart, nullptr);
 
-            bool valid = bls::PopSchemeMPL::FastAggregateVerify(pubs, arrToVec(msg.to_bytes()), *sig.data);
+            bool valid = bls::PopSchemeMPL::VerifyAffine(pub, bls_hash_points.get(msg), *sig.data);
 
             //gettimeofday(&timeEnd, nullptr);
 
@@ -913,25 +1028,69 @@ class QuorumCertSecp256k1: public QuorumCert {
         }
     };
 
+    /** Aggregated BLS public keys by signer bitmap. In a stable tree the
+     * same bitmaps show up in the certificates of every block, so their
+     * aggregate is looked up instead of summed again. A new bitmap that
+     * differs from the last one in a few bits is derived from it. The
+     * aggregates are kept in affine form, which saves the inversion of
+     * every pairing against them. */
+    class PubKeyAggCacheBLS {
+        static const size_t capacity = 256;
+
+        std::unordered_map<std::string, bls::G1Affine> aggs;
+        /** insertion order, for eviction */
+        std::deque<std::string> order;
+        std::string last_key;
+        salticidae::Bits last_rids;
+
+        static std::string make_key(const salticidae::Bits &rids);
+
+    public:
+        /** aggregate of the public keys of the replicas set in `rids` */
+        const bls::G1Affine &get(const ReplicaConfig &config, const salticidae::Bits &rids);
+        void clear() {
+            aggs.clear();
+            order.clear();
+            last_key.clear();
+        }
+    };
+
     class PartCertBLSAgg: public SigSecBLSAgg, public PartCert {
         uint256_t obj_hash;
 
+        static SlabPool slab;
+
     public:
+        static void *operator new(size_t size) { return slab.alloc(size); }
+        static void operator delete(void *p, size_t size) { slab.free(p, size); }
+
         PartCertBLSAgg() = default;
         PartCertBLSAgg(const PrivKeyBLS &priv_key, const uint256_t &obj_hash):
                 SigSecBLSAgg(obj_hash, priv_key),
                 PartCert(),
-                obj_hash(obj_hash) { }
+                obj_hash(obj_hash) {
+            bls_veri_ledger.add(VeriLedgerBLS::vote_key(obj_hash, *priv_key.pub, *data));
+        }
 
         bool verify(const PubKey &pub_key) override {
-            return SigSecBLSAgg::verify(obj_hash,
-                                        dynamic_cast<const PubKeyBLS &>(pub_key));
+            const auto &pub = dynamic_cast<const PubKeyBLS &>(pub_key);
+            uint256_t key = VeriLedgerBLS::vote_key(obj_hash, *pub.data, *data);
+            if (bls_veri_ledger.has(key)) return true;
+            bool valid = SigSecBLSAgg::verify(obj_hash, pub);
+            if (valid) bls_veri_ledger.add(key);
+            return valid;
         }
 
         promise_t verify(const PubKey &pub_key, VeriPool &vpool) override {
-            return vpool.verify(new SigVeriTaskBLS(obj_hash,
-                                                   dynamic_cast<const PubKeyBLS &>(pub_key),
-                                                   SigSecBLS(*this->data)));
+            const auto &pub = dynamic_cast<const PubKeyBLS &>(pub_key);
+            uint256_t key = VeriLedgerBLS::vote_key(obj_hash, *pub.data, *data);
+            if (bls_veri_ledger.has(key))
+                return promise_t([](promise_t &pm) { pm.resolve(true); });
+            return vpool.verify(new SigVeriTaskBLS(obj_hash, pub,
+                                                   SigSecBLS(*this->data))).then([key](bool valid) {
+                if (valid) bls_veri_ledger.add(key);
+                return valid;
+            });
         }
 
         const uint256_t &get_obj_hash() const override { return obj_hash; }
@@ -953,26 +1112,83 @@ class QuorumCertSecp256k1: public QuorumCert {
 
 
     class QuorumCertAggBLS: public QuorumCert {
+        /** number of buffered signatures folded at once, so that a single
+         * field inversion is shared by the whole batch */
+        static const size_t fold_batch = 16;
+
         uint256_t obj_hash;
         salticidae::Bits rids;
         SigSecBLSAgg* theSig = nullptr;
-        vector<bls::G2Element> sigs;
+        /** running sum of the folded signatures */
+        bls::G2Element* agg = nullptr;
+        /** signatures (or partial aggregates) not folded yet, never more
+         * than fold_batch */
+        vector<bls::G2Element> pending;
         uint32_t n = 0;
+        /** every part is in the ledger, so is the aggregate */
+        bool proven = true;
+
+        /** normalize the pending points together (Montgomery's trick) and
+         * add them to the running sum with mixed additions */
+        void fold_pending();
+
+        void push_sig(const bls::G2Element &sig) {
+            if (pending.empty()) pending.reserve(fold_batch);
+            pending.push_back(sig);
+            if (pending.size() >= fold_batch) fold_pending();
+        }
+
+        bool vote_proven(const ReplicaConfig &config, ReplicaID rid,
+                        const bls::G2Element &sig) const;
+
+        /** take over the signers of `other`, a superset of ours */
+        void assign(const QuorumCertAggBLS &other) {
+            /* the copy frees what is replaced */
+            QuorumCertAggBLS old(other);
+            std::swap(theSig, old.theSig);
+            std::swap(agg, old.agg);
+            rids = other.rids;
+            pending = other.pending;
+            n = other.n;
+            proven = other.theSig != nullptr ?
+                bls_veri_ledger.has(VeriLedgerBLS::qc_key(obj_hash, other.rids, *other.theSig->data)) :
+                other.proven;
+        }
+
+        /** a combined certificate is extended by further parts */
+        void reopen() {
+            if (theSig == nullptr) return;
+            if (agg == nullptr) agg = bls_g2_slab.create(*theSig->data);
+            delete theSig;
+            theSig = nullptr;
+        }
+
+        static SlabPool slab;
 
     public:
+        static void *operator new(size_t size) { return slab.alloc(size); }
+        static void operator delete(void *p, size_t size) { slab.free(p, size); }
+
         QuorumCertAggBLS() = default;
         QuorumCertAggBLS(const ReplicaConfig &config, const uint256_t &obj_hash);
-        QuorumCertAggBLS (const QuorumCertAggBLS &other): obj_hash(other.obj_hash), rids(other.rids)
+        QuorumCertAggBLS (const QuorumCertAggBLS &other):
+                obj_hash(other.obj_hash), rids(other.rids),
+                pending(other.pending), n(other.n), proven(other.proven)
         {
             if (other.theSig != nullptr) {
                 theSig = new SigSecBLSAgg(*other.theSig);
             }
+            if (other.agg != nullptr) {
+                agg = bls_g2_slab.create(*other.agg);
+            }
         }
 
         ~QuorumCertAggBLS() override
         {
             delete theSig;
             theSig = nullptr;
+            bls_g2_slab.destroy(agg);
+            agg = nullptr;
         }
 
         void calculateN() {
@@ -987,42 +1203,39 @@ class QuorumCertSecp256k1: public QuorumCert {
         void add_part(const ReplicaConfig &config, ReplicaID rid, const PartCert &pc) override {
             if (pc.get_obj_hash() != obj_hash)
                 throw std::invalid_argument("PartCert does match the block hash");
+            /* a replica may re-vote after a tree reconfiguration */
+            if (rids[rid] == 1) return;
             rids.set(rid);
-            calculateN();
-
-            //if (theSig == nullptr) {
-            //    theSig = new SigSecBLSAgg(*dynamic_cast<const PartCertBLSAgg &>(pc).data);
-            //    sigs.push_back(*theSig->data);
-            //    return;
-            //}
-            if (sigs.empty() && theSig != nullptr) {
-                sigs.push_back(*theSig->data);
-                delete theSig;
-                theSig = nullptr;
-            }
-            sigs.push_back(*dynamic_cast<const SigSecBLSAgg &>(pc).data);
-            //bls::G2Element sig1 = *theSig->data;
-            //bls::G2Element sig2 = *dynamic_cast<const SigSecBLSAgg &>(pc).data;
-
-            //struct timeval timeStart, timeEnd;
-            //gettimeofday(&timeStart, nullptr);
-
-            //bls::G2Element sig = bls::PopSchemeMPL::Aggregate({sig1, sig2});
-
-            //gettimeofday(&timeEnd, nullptr);
+            n++;
 
-            //std::cout << "Aggregating Sigs: "
-            //          << ((timeEnd.tv_sec - timeStart.tv_sec) * 1000000 + timeEnd.tv_usec - timeStart.tv_usec)
-            //          << " us to execute."
-            //          << std::endl;
-
-            //*theSig->data = sig;
+            reopen();
+            const bls::G2Element &sig = *dynamic_cast<const PartCertBLSAgg &>(pc).data;
+            proven = proven && vote_proven(config, rid, sig);
+            push_sig(sig);
         }
 
-        void merge_quorum(const QuorumCert &qc) override {
+        bool merge_quorum(const QuorumCert &qc) override {
             if (qc.get_obj_hash()!= obj_hash) throw std::invalid_argument("QuorumCert does match the block hash");
 
-            salticidae::Bits newRids = dynamic_cast<const QuorumCertAggBLS &>(qc).rids;
+            const auto &other = dynamic_cast<const QuorumCertAggBLS &>(qc);
+            const salticidae::Bits &newRids = other.rids;
+            /* aggregates that share signers (votes re-routed after a tree
+             * reconfiguration) cannot be added without counting a signature
+             * twice, unless one of them holds the other */
+            bool overlap = false, covered = true, covers = true;
+            for (unsigned int i = 0; i < std::max(rids.size(), newRids.size()); i++) {
+                bool ours = i < rids.size() && rids[i] == 1;
+                bool theirs = i < newRids.size() && newRids[i] == 1;
+                overlap = overlap || (ours && theirs);
+                covered = covered && (ours || !theirs);
+                covers = covers && (theirs || !ours);
+            }
+            if (overlap) {
+                if (covered) return true;
+                if (!covers) return false;
+                assign(other);
+                return true;
+            }
             for (unsigned int i = 0;i < newRids.size();i++) {
                 if (newRids[i] == 1) {
                     rids.set(i);
@@ -1030,36 +1243,24 @@ class QuorumCertSecp256k1: public QuorumCert {
             }
             calculateN();
 
-            if (sigs.empty() && theSig != nullptr) {
-                sigs.push_back(*theSig->data);
-                delete theSig;
-                theSig = nullptr;
-            }
-
-            for (bls::G2Element el : dynamic_cast<const QuorumCertAggBLS &>(qc).sigs) {
-                sigs.push_back(el);
-            }
-
-            if (dynamic_cast<const QuorumCertAggBLS &>(qc).theSig != nullptr) {
-                sigs.push_back(*dynamic_cast<const QuorumCertAggBLS &>(qc).theSig->data);
+            reopen();
+            if (other.theSig != nullptr) {
+                if (proven)
+                    proven = bls_veri_ledger.has(VeriLedgerBLS::qc_key(obj_hash, other.rids, *other.theSig->data));
+                push_sig(*other.theSig->data);
+                return true;
             }
+            proven = proven && other.proven;
+            if (other.agg != nullptr) push_sig(*other.agg);
+            for (const bls::G2Element &el : other.pending) push_sig(el);
+            return true;
+        }
 
-            //bls::G2Element sig1 = *theSig->data;
-            //bls::G2Element sig2 = *dynamic_cast<const QuorumCertAggBLS &>(qc).theSig->data;
-
-            //struct timeval timeStart,timeEnd;
-            //gettimeofday(&timeStart, nullptr);
-
-            //bls::G2Element sig = bls::PopSchemeMPL::Aggregate({sig1, sig2});
-
-            //gettimeofday(&timeEnd, nullptr);
-
-            //std::cout << "Aggregating Sigs: "
-            //          << ((timeEnd.tv_sec - timeStart.tv_sec) * 1000000 + timeEnd.tv_usec - timeStart.tv_usec)
-            //          << " us to execute."
-            //          << std::endl;
-
-            //*theSig->data = sig;
+        std::vector<ReplicaID> get_signers() const override {
+            std::vector<ReplicaID> ret;
+            for (unsigned int i = 0; i < rids.size(); i++)
+                if (rids[i] == 1) ret.push_back(i);
+            return ret;
         }
 
         bool has_n(const uint32_t t) override {
@@ -1072,8 +1273,8 @@ class QuorumCertSecp256k1: public QuorumCert {
                 struct timeval timeStart,timeEnd;
                 gettimeofday(&timeStart, nullptr);
 
-                theSig = new SigSecBLSAgg(bls::PopSchemeMPL::Aggregate(sigs));
-                sigs.clear();
+                fold_pending();
+                theSig = new SigSecBLSAgg(agg == nullptr ? bls::G2Element::Infinity() : *agg);
 
                 gettimeofday(&timeEnd, nullptr);
 
@@ -1097,7 +1298,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             bool combined = (theSig != nullptr);
             s << obj_hash << rids << combined;
             if (combined) {
-                if (theSig == nullptr || !sigs.empty()) {
+                if (theSig == nullptr || !pending.empty()) {
                     throw std::runtime_error("sigs not aggregated before sending!");
                 }
                 theSig->serialize(s);
@@ -1108,6 +1309,7 @@ class QuorumCertSecp256k1: public QuorumCert {
             bool combined;
             s >> obj_hash >> rids >> combined;
             calculateN();
+            proven = false;
             if (combined) {
                 theSig = new SigSecBLSAgg();
                 theSig->unserialize(s);
@@ -29,6 +29,7 @@
 #include "hotstuff/type.h"
 #include "hotstuff/util.h"
 #include "hotstuff/crypto.h"
+#include "hotstuff/slab.h"
 
 namespace hotstuff {
 
@@ -67,6 +68,9 @@ class ReplicaConfig {
     int32_t piped_latency;
     int32_t async_blocks;
 
+    /** aggregated public keys of the BLS quorum certificates */
+    mutable PubKeyAggCacheBLS bls_agg_pubs;
+
     ReplicaConfig(): nreplicas(0), nmajority(0) {}
 
     void add_replica(ReplicaID rid, const ReplicaInfo &info) {
@@ -141,7 +145,12 @@ class Block {
 
     std::unordered_set<ReplicaID> voted;
 
+    static SlabPool slab;
+
     public:
+    static void *operator new(size_t size) { return slab.alloc(size); }
+    static void operator delete(void *p, size_t size) { slab.free(p, size); }
+
     Block():
         qc(nullptr),
         qc_ref(nullptr),
@@ -207,8 +216,14 @@ class Block {
 
     const block_t &get_qc_ref() const { return qc_ref; }
 
+    /** the aggregate this replica collects for the block */
+    quorum_cert_bt &get_self_qc() { return self_qc; }
+
     const bytearray_t &get_extra() const { return extra; }
 
+    /** approximate heap footprint of the block, for the pruning policy */
+    size_t get_mem_size() const;
+
     operator std::string () const {
         DataStream s;
         s << "<block "
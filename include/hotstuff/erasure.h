@@ -0,0 +1,56 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_ERASURE_H
+#define _HOTSTUFF_ERASURE_H
+
+#include <vector>
+#include <utility>
+
+#include "salticidae/util.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Systematic Reed-Solomon code over GF(2^8): the data is split into `k`
+ * chunks and extended to `n` (at most 256) chunks with a Cauchy matrix, so
+ * that any `k` of them give back the data. */
+class ReedSolomon {
+    size_t k;
+    size_t n;
+    /** (n - k) x k parity rows */
+    std::vector<std::vector<uint8_t>> parity;
+
+    public:
+    ReedSolomon(): k(0), n(0) {}
+    ReedSolomon(size_t k, size_t n);
+
+    size_t get_k() const { return k; }
+    size_t get_n() const { return n; }
+    /** length of every chunk for `len` bytes of data */
+    size_t chunk_size(size_t len) const { return (len + k - 1) / k; }
+
+    std::vector<bytearray_t> encode(const bytearray_t &data) const;
+    /** Reassemble `len` bytes of data from chunks (index, bytes). Returns
+     * false when there are fewer than `k` distinct well-formed chunks. */
+    bool decode(const std::vector<std::pair<uint16_t, bytearray_t>> &chunks,
+                size_t len, bytearray_t &data) const;
+};
+
+}
+
+#endif
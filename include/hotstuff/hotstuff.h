@@ -18,7 +18,9 @@
 #ifndef _HOTSTUFF_CORE_H
 #define _HOTSTUFF_CORE_H
 
+#include <map>
 #include <queue>
+#include <random>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -27,6 +29,10 @@
 #include "salticidae/msg.h"
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
+#include "hotstuff/topology.h"
+#include "hotstuff/erasure.h"
+#include "hotstuff/wal.h"
+#include "hotstuff/blkstore.h"
 
 namespace hotstuff {
 
@@ -36,16 +42,54 @@ using salticidae::_1;
 using salticidae::_2;
 
 const double ent_waiting_timeout = 10;
+/** how long a range request of the catch-up may go unanswered */
+const double sync_timeout = 2;
+const uint32_t sync_max_retries = 8;
+/** the most blocks a replica puts in one catch-up answer */
+const uint32_t sync_max_blocks = 1024;
+const double tree_probe_timeout = 1;
 const double double_inf = 1e10;
+/** how much later than its slowest child an internal node waits */
+const double relay_deadline_slack = 1.5;
+
+/** When an internal node forwards the aggregate of its subtree. */
+enum RelayPolicy {
+    /** once every replica of the subtree has voted */
+    RELAY_FULL = 0x0,
+    /** once enough of the subtree voted to keep the quorum reachable */
+    RELAY_THRESHOLD = 0x1,
+    /** once the deadline derived from the child latencies expires */
+    RELAY_DEADLINE = 0x2
+};
+
+/** lower bound of the TCP retransmission timeout (sec), the delay an
+ * emulated loss adds to a message */
+const double link_rto_min = 0.2;
+
+/** Emulated properties of an outgoing link. */
+struct LinkEmu {
+    double delay;       /**< one-way delay (sec) */
+    double jitter;      /**< uniformly distributed extra delay (sec) */
+    double bandwidth;   /**< bytes/sec, 0 for unlimited */
+    double loss;        /**< probability that a transmission is lost */
+    LinkEmu(): delay(0), jitter(0), bandwidth(0), loss(0) {}
+    bool is_null() const {
+        return delay == 0 && jitter == 0 && bandwidth == 0 && loss == 0;
+    }
+};
 
 /** Network message format for HotStuff. */
 struct MsgPropose {
     static const opcode_t opcode = 0x0;
     DataStream serialized;
+    /** the tree the block is disseminated and aggregated along */
+    uint8_t tree;
     Proposal proposal;
-    MsgPropose(const Proposal &);
-    /** Only move the data to serialized, do not parse immediately. */
-    MsgPropose(DataStream &&s): serialized(std::move(s)) {}
+    MsgPropose(const Proposal &, uint8_t tree);
+    /** Only move the data to serialized, do not parse immediately (the tree
+     * is peeked so that the message can be relayed right away). */
+    MsgPropose(DataStream &&s): serialized(std::move(s)),
+        tree(serialized.size() ? *serialized.data() : 0) {}
     MsgPropose(DataStream stream, bool wut): serialized(std::move(stream)) {}
 
     /** Parse the serialized data to blks now, with `hsc->storage`. */
@@ -74,7 +118,9 @@ struct MsgRespBlock {
     static const opcode_t opcode = 0x3;
     DataStream serialized;
     std::vector<block_t> blks;
-    MsgRespBlock(const std::vector<block_t> &blks);
+    /** `raw` are blocks serialized already, as kept by a BlockStore */
+    MsgRespBlock(const std::vector<block_t> &blks,
+                const std::vector<BlockStore::raw_t> &raw = {});
     MsgRespBlock(DataStream &&s): serialized(std::move(s)) {}
     void postponed_parse(HotStuffCore *hsc);
 };
@@ -88,6 +134,102 @@ struct MsgRelay {
     void postponed_parse(HotStuffCore *hsc);
 };
 
+/** Link probe, answered by a MsgPong padded with `resp_size` bytes. */
+struct MsgPing {
+    static const opcode_t opcode = 0x5;
+    DataStream serialized;
+    uint64_t sent_us;
+    uint32_t resp_size;
+    MsgPing(uint64_t sent_us, uint32_t resp_size);
+    MsgPing(DataStream &&s);
+};
+
+struct MsgPong {
+    static const opcode_t opcode = 0x6;
+    DataStream serialized;
+    uint64_t sent_us;
+    uint32_t resp_size;
+    /** vote arrival delays (in us) the responder observed from its children */
+    std::vector<std::pair<ReplicaID, uint32_t>> vote_lats;
+    MsgPong(uint64_t sent_us, uint32_t resp_size,
+            const std::vector<std::pair<ReplicaID, uint32_t>> &vote_lats);
+    MsgPong(DataStream &&s);
+};
+
+/** Announces the replica placement of a new tree epoch. */
+struct MsgTree {
+    static const opcode_t opcode = 0x7;
+    DataStream serialized;
+    uint32_t epoch;
+    std::vector<ReplicaID> order;
+    /** per-level fan-outs the tree is built with from `order` */
+    std::vector<uint32_t> fanouts;
+    /** in-flight blocks whose votes have to be re-sent along the new tree */
+    std::vector<uint256_t> pending;
+    MsgTree(uint32_t epoch, const std::vector<ReplicaID> &order,
+            const std::vector<uint32_t> &fanouts,
+            const std::vector<uint256_t> &pending);
+    MsgTree(DataStream &&s);
+};
+
+/** Erasure-coded chunks of a proposal. */
+struct MsgChunk {
+    static const opcode_t opcode = 0x8;
+    DataStream serialized;
+    uint256_t blk_hash;
+    /** the tree the block is disseminated along */
+    uint8_t tree;
+    /** length of the encoded MsgPropose payload */
+    uint32_t len;
+    /** the chunks of a whole subtree, still to be handed down the tree */
+    bool relay;
+    std::vector<std::pair<uint16_t, bytearray_t>> chunks;
+    MsgChunk(const uint256_t &blk_hash, uint8_t tree, uint32_t len, bool relay,
+            const std::vector<std::pair<uint16_t, bytearray_t>> &chunks);
+    MsgChunk(DataStream &&s);
+};
+
+/** Asks for the ancestors of `anchor` with heights from `high` down to
+ * `low`, to catch up with a range of blocks at once. */
+struct MsgReqSync {
+    static const opcode_t opcode = 0x9;
+    DataStream serialized;
+    uint256_t anchor;
+    uint32_t low;
+    uint32_t high;
+    MsgReqSync(const uint256_t &anchor, uint32_t low, uint32_t high);
+    MsgReqSync(DataStream &&s);
+};
+
+/** The answer to a MsgReqSync: the ancestors found, highest first. */
+struct MsgRespSync {
+    static const opcode_t opcode = 0xa;
+    DataStream serialized;
+    uint256_t anchor;
+    /** 0 when the anchor is unknown to the sender */
+    uint32_t anchor_height;
+    /** the range requested */
+    uint32_t low;
+    uint32_t high;
+    std::vector<std::pair<uint32_t, block_t>> blks;
+    /** `payload` holds `nblks` pairs of a height and a serialized block */
+    MsgRespSync(const uint256_t &anchor, uint32_t anchor_height,
+                uint32_t low, uint32_t high,
+                uint32_t nblks, const bytearray_t &payload);
+    MsgRespSync(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** Asks a replica to send its own vote for a block straight back, when
+ * an aggregate holding it could not be merged. */
+struct MsgReqVote {
+    static const opcode_t opcode = 0xb;
+    DataStream serialized;
+    uint256_t blk_hash;
+    MsgReqVote(const uint256_t &blk_hash);
+    MsgReqVote(DataStream &&s);
+};
+
 using promise::promise_t;
 
 class HotStuffBase;
@@ -112,6 +254,8 @@ class FetchContext: public promise_t {
     inline void send(const PeerId &replica);
     inline void reset_timeout();
     inline void add_replica(const PeerId &replica, bool fetch_now = true);
+    /** Ask all the known replicas again, right away. */
+    inline void resend();
 };
 
 class BlockDeliveryContext: public promise_t {
@@ -152,6 +296,12 @@ class HotStuffBase: public HotStuffCore {
     EventContext ec;
     salticidae::ThreadCall tcall;
     VeriPool vpool;
+    /** signs the own votes, nullptr to sign on the event loop */
+    BoxObj<SignPool> spool;
+    /** CPU time of the threads, for print_stat */
+    mutable ThreadCpuStat cpu_stat;
+    /** the slab counters at the last print_stat */
+    mutable std::vector<SlabPool::Stat> last_slab;
     std::vector<PeerId> peers;
 
     private:
@@ -189,8 +339,320 @@ class HotStuffBase: public HotStuffCore {
     mutable double part_delivery_time_max;
     mutable std::unordered_map<const PeerId, uint32_t> part_fetched_replica;
 
-    mutable PeerId parentPeer;
-    mutable std::set<PeerId> childPeers;
+    /* the position of this replica in one of the trees */
+    struct TreeRoute {
+        PeerId parent;
+        std::set<PeerId> children;
+        /** number of replicas in the subtree below this one */
+        uint16_t nsubtree;
+        TreeRoute(): nsubtree(0) {}
+    };
+    /** the concurrent trees, trees[0] is `topo`; the others move disjoint
+     * sets of replicas to the internal positions */
+    std::vector<Topology> trees;
+    std::vector<TreeRoute> routes;
+    /** number of concurrent trees requested */
+    uint8_t ntrees;
+    /** the tree the next proposal goes to (round-robin) */
+    uint8_t next_tree;
+    std::unordered_map<const uint256_t, uint8_t> blk_tree;
+
+    /* tree placement */
+    struct LinkStat {
+        double rtt;         /**< smoothed round-trip time (sec) */
+        double bw;          /**< smoothed uplink bandwidth (bytes/sec) */
+        double vote_lat;    /**< smoothed vote arrival delay (sec) */
+        double probe_rtt;   /**< rtt of the last unpadded probe */
+        bool alive;         /**< answered the last probe round */
+        LinkStat(): rtt(0), bw(0), vote_lat(0), probe_rtt(0), alive(false) {}
+    };
+    std::unordered_map<const PeerId, ReplicaID> peer_rids;
+    std::unordered_map<ReplicaID, LinkStat> link_stats;
+    std::unordered_map<const uint256_t, timeval> vote_wait_start;
+    /** the current tree */
+    Topology topo;
+    /** per-level fan-outs the current tree is built with */
+    std::vector<uint32_t> tree_fanouts;
+    /** configured per-level fan-outs, empty uses the uniform config.fanout */
+    std::vector<uint32_t> level_fanouts;
+    /** Kollaps topology file to infer the initial region-aware tree from */
+    std::string topo_file;
+    /** file with the explicit initial tree (see Topology::from_file) */
+    std::string tree_file;
+    uint32_t tree_epoch;
+    /** seconds between re-optimizations, 0 keeps the static index-order tree */
+    double tree_period;
+    uint32_t tree_probe_bytes;
+    bool tree_probing;
+    TimerEvent tree_timer;
+
+    /* fault-triggered reconfiguration */
+    /** seconds the root waits for the QC of a block, 0 disables */
+    double tree_relay_timeout;
+    /** number of failed trees before falling back to a star */
+    uint32_t tree_max_failures;
+    uint32_t tree_failures;
+    bool tree_star;
+    std::unordered_map<const uint256_t, timeval> relay_deadline;
+    TimerEvent reconf_timer;
+    bool recovering;
+    timeval recover_start;
+    uint64_t nreconf;
+    mutable uint32_t part_reconf;
+    mutable uint32_t part_recovered;
+    mutable double part_recover_time;
+    mutable double part_recover_time_max;
+
+    /* incremental pruning, a batch of blocks per turn of the event loop */
+    TimerEvent prune_timer;
+    bool prune_scheduled;
+    size_t prune_batch;
+
+    /* write-ahead log of the protocol state, null when disabled */
+    std::string wal_fname;
+    size_t wal_max_bytes;
+    BoxObj<WriteAheadLog> wal;
+    /** compacts the log once wal_max_bytes were appended to the last
+     * snapshot */
+    TimerEvent wal_timer;
+    bool wal_rotating;
+    size_t wal_snapshot_size;
+    mutable size_t part_wal_records;
+    mutable size_t part_wal_nsync;
+    mutable size_t part_wal_bytes;
+
+    /* committed blocks on disk, null when disabled */
+    std::string blk_store_dir;
+    size_t blk_store_seg;
+    BoxObj<BlockStore> blk_store;
+    mutable uint32_t part_store_served;
+
+    /* range-based catch-up, see set_sync() */
+    uint32_t sync_batch;
+    uint32_t sync_parallel;
+    uint32_t sync_min_gap;
+    /** the highest block delivered so far */
+    uint32_t delivered_height;
+    /** bytes per second served to the replicas catching up (0 for no limit) */
+    double sync_serve_rate;
+    struct SyncRange {
+        uint32_t high;
+        PeerId peer;
+        timeval sent;
+    };
+    /** the blocks of one answer, highest first, each the first parent of
+     * the one before */
+    struct SyncAnswer {
+        std::vector<block_t> blks;
+        PeerId peer;
+    };
+    struct SyncJob {
+        uint256_t anchor;
+        /** the proposer that referred to the anchor */
+        PeerId origin;
+        /** as told by the replica that proved to have it (0 until then) */
+        uint32_t anchor_height;
+        /** the next height to deliver */
+        uint32_t next;
+        /** ranges to request, lowest first, and the requested ones by low */
+        std::deque<std::pair<uint32_t, uint32_t>> todo;
+        std::map<uint32_t, SyncRange> inflight;
+        /** answers waiting for the blocks above them, by their highest
+         * height, as the claimed heights are only trusted once the blocks
+         * link to the anchor */
+        std::map<uint32_t, SyncAnswer> unlinked;
+        /** the lowest height linked to the anchor (0 for none yet), and the
+         * hash the block below it must have */
+        uint32_t linked;
+        uint256_t expect;
+        /** the replicas that answered with blocks off the chain */
+        std::unordered_set<PeerId> bad;
+        /** blocks linked to the anchor, waiting for the lower ones */
+        std::map<uint32_t, block_t> blks;
+        bool delivering;
+        uint32_t nretries;
+        size_t ndelivered;
+        timeval start;
+    };
+    bool sync_active;
+    SyncJob sync;
+    size_t sync_peer;
+    TimerEvent sync_timer;
+    /* serving side, a token bucket in bytes */
+    std::deque<std::pair<PeerId, MsgReqSync>> sync_backlog;
+    double sync_tokens;
+    timeval sync_refill;
+    TimerEvent sync_serve_timer;
+    mutable uint32_t part_sync_served;
+    mutable size_t part_sync_served_blks;
+    mutable size_t part_sync_caught_up;
+
+    /* early partial-aggregate forwarding */
+    RelayPolicy relay_policy;
+    /** deadline (sec) used until the child latencies have been observed */
+    double relay_base_deadline;
+    struct RelayState {
+        timeval start;
+        bool expired;
+        /** the partial aggregate went up, later votes follow as deltas */
+        bool forwarded;
+        /** the whole subtree went up, to be erased */
+        bool done;
+        TimerEvent timer;
+        RelayState(): expired(false), forwarded(false), done(false) {}
+    };
+    std::unordered_map<const uint256_t, RelayState> relay_state;
+    mutable uint32_t part_relay_early;
+    mutable uint32_t part_relay_delta;
+    /** aggregates that could not be merged, their votes were re-requested */
+    mutable uint32_t part_relay_conflict;
+
+    /* pipeline tuning at the proposer, null when the depth and gap are fixed */
+    BoxObj<PipelineTuner> pipe_tuner;
+    mutable uint32_t part_pipe_qcs;
+    mutable double part_pipe_lat;
+
+    /* optimistic vote verification */
+    bool optimistic_verify;
+    struct OptParts {
+        timeval start;
+        /** the votes and child aggregates merged into self_qc */
+        std::vector<quorum_cert_bt> parts;
+        /** the own vote, to rebuild self_qc without signing again */
+        part_cert_bt own;
+    };
+    std::unordered_map<const uint256_t, OptParts> opt_parts;
+    mutable uint32_t part_opt_failed;
+    mutable uint32_t part_opt_blamed;
+
+    /* erasure-coded dissemination */
+    bool erasure;
+    ReedSolomon chunk_code;
+    struct ChunkState {
+        timeval start;
+        /** as told by the parent, once `known` */
+        uint8_t tree;
+        uint32_t len;
+        bool known;
+        std::vector<std::pair<uint16_t, bytearray_t>> chunks;
+        /** the replicas whose own chunk is in */
+        std::unordered_set<ReplicaID> senders;
+        /** failed reconstructions, each retry starts at another chunk */
+        uint32_t attempts;
+        /** the chunks of the subtree went down the tree */
+        bool relayed;
+        bool done;
+        ChunkState(): tree(0), len(0), known(false), attempts(0),
+            relayed(false), done(false) {}
+    };
+    std::unordered_map<const uint256_t, ChunkState> chunk_state;
+    mutable uint32_t part_decoded;
+    mutable uint32_t part_decode_failed;
+
+    /* link emulation */
+    LinkEmu link_default;
+    std::unordered_map<ReplicaID, LinkEmu> link_conf;
+    struct LinkQueue {
+        LinkEmu link;
+        /** the link is busy serializing earlier messages until then */
+        double free_at;
+        /** the release time of the last message, the link stays FIFO */
+        double last_release;
+        std::deque<std::pair<double, std::function<void()>>> pending;
+        TimerEvent timer;
+        LinkQueue(): free_at(0), last_release(0) {}
+    };
+    std::unordered_map<const PeerId, LinkQueue> link_queues;
+    bool link_emu;
+    std::mt19937 link_rng;
+    mutable uint32_t part_link_sent;
+    mutable uint32_t part_link_lost;
+    mutable double part_link_delay;
+
+    /** Make `tree` the current tree, the other trees take its shape with
+     * the replicas shifted. `fanouts` rebuild it level-wise when it is
+     * reconfigured. */
+    void build_tree(const Topology &tree, const std::vector<uint32_t> &fanouts);
+    uint8_t get_tree(const uint256_t &blk_hash) const;
+    const TreeRoute &get_route(const uint256_t &blk_hash) const {
+        return routes[get_tree(blk_hash)];
+    }
+    void switch_tree(const std::vector<ReplicaID> &order,
+                    const std::vector<uint32_t> &fanouts);
+    void apply_tree(uint32_t epoch, const std::vector<ReplicaID> &order,
+                    const std::vector<uint32_t> &fanouts,
+                    const std::vector<uint256_t> &pending);
+    void on_tree_failure();
+    void on_reconf_timer(TimerEvent &);
+    void send_tree_probes();
+    void optimize_tree();
+    double placement_cost(const LinkStat &stat) const;
+    void on_tree_timer(TimerEvent &);
+    void record_vote_arrival(ReplicaID rid, const uint256_t &blk_hash);
+    void on_pipe_qc(const timeval &sent);
+    void relay_track(const uint256_t &blk_hash);
+    double relay_deadline_for_children(uint8_t tree) const;
+    void on_relay_deadline(const uint256_t &blk_hash);
+    bool relay_ready(const block_t &blk);
+    void relay_forward(const block_t &blk);
+    void relay_delta(const block_t &blk, quorum_cert_bt &&delta);
+    void relay_done(const uint256_t &blk_hash);
+    /** Merge the aggregate `qc` into the certificate of `blk`. If the two
+     * share signers and cannot be merged, the votes of the signers of `qc`
+     * missing from the certificate are requested one by one instead. */
+    bool merge_or_request(const block_t &blk, const QuorumCert &qc);
+    /** add the own vote to self_qc of an internal node and send the
+     * aggregate up if it was the one missing */
+    void add_own_part(const block_t &blk, const part_cert_bt &part);
+    /** remember an unverified vote or child aggregate of self_qc */
+    void opt_record(const uint256_t &blk_hash, quorum_cert_bt &&part);
+    OptParts &opt_entry(const uint256_t &blk_hash);
+    bool opt_parts_valid(const uint256_t &blk_hash,
+                        const std::vector<quorum_cert_bt> &parts,
+                        size_t lo, size_t hi);
+    void opt_bisect(const uint256_t &blk_hash,
+                    const std::vector<quorum_cert_bt> &parts,
+                    size_t lo, size_t hi, std::vector<bool> &bad);
+    /** Find the invalid parts of a self_qc that failed verification and
+     * rebuild it without them. Returns whether the result is valid. */
+    bool opt_blame(const block_t &blk);
+    /** chunk index of a replica */
+    uint16_t chunk_of(ReplicaID rid) const { return rid % chunk_code.get_n(); }
+    std::vector<std::pair<uint16_t, bytearray_t>> subtree_chunks(
+        const Topology &tree, ReplicaID rid,
+        const std::vector<std::pair<uint16_t, bytearray_t>> &chunks) const;
+    void prune_chunk_state(const timeval &now);
+    /** Start catching up with the ancestors of `anchor`, unless already
+     * catching up. */
+    void start_sync(const uint256_t &anchor, const PeerId &origin);
+    /** whether the catch-up brings the block anyway, along with its
+     * ancestors */
+    bool in_sync(const uint256_t &blk_hash) const {
+        return sync_active && blk_hash == sync.anchor;
+    }
+    void sync_request();
+    /** Move the answers that now link to the anchor to `sync.blks`. */
+    void sync_link();
+    /** Drop the answer of `peer` for [low, high] as off the chain, and ask
+     * another replica. Returns false if the catch-up gave up. */
+    bool sync_reject(uint32_t low, uint32_t high, const PeerId &peer);
+    void sync_deliver();
+    void end_sync(bool done);
+    void on_sync_timer(TimerEvent &);
+    void serve_sync();
+    /** Answer one request, returns the bytes sent. */
+    size_t serve_sync_req(const PeerId &peer, const MsgReqSync &msg, size_t max_bytes);
+    void send_chunks(const Proposal &prop, uint8_t tree);
+    void try_decode(const uint256_t &blk_hash, const PeerId &peer);
+    void deliver_proposal(MsgPropose &msg, const PeerId &peer);
+    /** Send through the emulated link to `peer` (or directly without link
+     * emulation). */
+    template<typename MsgType>
+    void send_msg(const MsgType &msg, const PeerId &peer);
+    template<typename MsgType>
+    void multicast_msg(const MsgType &msg, const std::vector<PeerId> &dests);
+    void link_enqueue(const PeerId &peer, size_t size, std::function<void()> send);
+    void link_release(const PeerId &peer);
 
     void on_fetch_cmd(const command_t &cmd);
     void on_fetch_blk(const block_t &blk);
@@ -206,13 +668,31 @@ class HotStuffBase: public HotStuffCore {
     inline void req_blk_handler(MsgReqBlock &&, const Net::conn_t &);
     /** receives a block */
     inline void resp_blk_handler(MsgRespBlock &&, const Net::conn_t &);
+    /** answers a link probe */
+    inline void ping_handler(MsgPing &&, const Net::conn_t &);
+    /** receives the answer to a link probe */
+    inline void pong_handler(MsgPong &&, const Net::conn_t &);
+    /** switches to the tree of a new epoch */
+    inline void tree_handler(MsgTree &&, const Net::conn_t &);
+    /** receives erasure-coded chunks of a proposal */
+    inline void chunk_handler(MsgChunk &&, const Net::conn_t &);
+    /** answers a request for a range of ancestors */
+    inline void req_sync_handler(MsgReqSync &&, const Net::conn_t &);
+    /** receives a range of ancestors */
+    inline void resp_sync_handler(MsgRespSync &&, const Net::conn_t &);
+    /** sends the own vote to a replica that could not merge an aggregate */
+    inline void req_vote_handler(MsgReqVote &&, const Net::conn_t &);
 
     inline bool conn_handler(const salticidae::ConnPool::conn_t &, bool);
 
     void do_broadcast_proposal(const Proposal &) override;
     void do_vote(Proposal, const Vote &) override;
+    promise_t async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) override;
     void do_decide(Finality &&) override;
     void do_consensus(const block_t &blk) override;
+    void schedule_prune() override;
+    void do_prune(const block_t &blk) override;
+    void do_log(bytearray_t &&rec) override;
 
     protected:
 
@@ -245,6 +725,109 @@ class HotStuffBase: public HotStuffCore {
     ThreadCall &get_tcall() { return tcall; }
     PaceMaker *get_pace_maker() { return pmaker.get(); }
     void print_stat() const;
+    /** Enable latency/bandwidth-aware tree placement: the root probes every
+     * `period` seconds with `probe_bytes` padded probes and moves the
+     * best-connected replicas to the inner levels of the tree. */
+    void set_tree_reopt(double period, uint32_t probe_bytes) {
+        tree_period = period;
+        tree_probe_bytes = probe_bytes;
+    }
+    /** Enable fault-triggered reconfiguration: when a block misses its QC for
+     * `relay_timeout` seconds the root rotates the internal nodes, and falls
+     * back to a star after `max_failures` failed trees. */
+    void set_tree_reconf(double relay_timeout, uint32_t max_failures) {
+        tree_relay_timeout = relay_timeout;
+        tree_max_failures = max_failures;
+    }
+    /** Shape the tree with a fan-out per level (the last one repeats for
+     * deeper levels) instead of the uniform fan-out. The initial tree is
+     * read from `tree_fname` if given, or inferred from the Kollaps file
+     * `kollaps_fname`; reconfigurations build level-wise trees. Every
+     * tree is rooted at the proposer, a tree file rooted elsewhere is an
+     * error. */
+    void set_topology(const std::vector<uint32_t> &fanouts,
+                    const std::string &kollaps_fname,
+                    const std::string &tree_fname = "") {
+        level_fanouts = fanouts;
+        topo_file = kollaps_fname;
+        tree_file = tree_fname;
+    }
+    const Topology &get_topology() const { return topo; }
+    /** Let internal nodes forward a partial aggregate before their whole
+     * subtree voted (see RelayPolicy), late votes are sent up as delta
+     * aggregates. */
+    void set_relay_policy(RelayPolicy policy, double base_deadline) {
+        relay_policy = policy;
+        relay_base_deadline = base_deadline;
+    }
+    /** Disseminate and aggregate the pipelined blocks round-robin along `n`
+     * trees with disjoint internal nodes, spreading the relay and
+     * aggregation load over the replicas. */
+    void set_ntrees(uint8_t n) { ntrees = std::max<uint8_t>(n, 1); }
+    /** Disseminate proposals as Reed-Solomon chunks: every subtree gets the
+     * chunks of its replicas only, the replicas swap their own chunk and
+     * rebuild the block from any k of them. */
+    void set_erasure(bool enable) { erasure = enable; }
+    /** Do not verify the votes and child aggregates one by one, check the
+     * aggregate only and bisect the signers when it fails. */
+    void set_optimistic_verify(bool enable) { optimistic_verify = enable; }
+    /** Release the blocks more than `depth` below the last committed one,
+     * `batch` of them per turn of the event loop, and fewer blocks when
+     * they take more than `max_bytes`, see HotStuffCore::set_prune(). */
+    void set_pruning(uint32_t depth, size_t max_bytes, size_t batch = 64) {
+        set_prune(depth, max_bytes);
+        prune_batch = std::max(batch, (size_t)1);
+    }
+    /** Keep the protocol state (vheight, b_lock, hqc and the committed
+     * blocks) in a write-ahead log at `fname` and recover from it upon
+     * start(). Votes leave once their state is durable; the log is
+     * compacted when `max_bytes` were appended since the last compaction. */
+    void set_wal(const std::string &fname, size_t max_bytes = 64 << 20) {
+        wal_fname = fname;
+        wal_max_bytes = max_bytes;
+    }
+    /** Append the committed blocks to a BlockStore in `dir`, made of
+     * `seg_size`-byte segments, and serve the requests for the blocks
+     * pruned from memory from there. */
+    void set_blk_store(const std::string &dir, size_t seg_size = 64 << 20) {
+        blk_store_dir = dir;
+        blk_store_seg = seg_size;
+    }
+    /** Catch up with the ancestors missing from a proposal by requesting
+     * them in ranges of `batch` blocks, from up to `parallel` replicas at
+     * a time, instead of one parent at a time. The replicas serve such
+     * requests at up to `serve_rate` bytes per second (0 for no limit).
+     * Only an anchor more than `min_gap` blocks above the highest one
+     * delivered keeps the catch-up going, closer ones are left to the
+     * pipeline.
+     * A batch of 0 turns it off. */
+    void set_sync(uint32_t batch, uint32_t parallel, double serve_rate,
+                uint32_t min_gap = 64) {
+        sync_batch = batch;
+        sync_parallel = std::max(parallel, (uint32_t)1);
+        sync_serve_rate = serve_rate;
+        sync_min_gap = min_gap;
+    }
+    /** Let the proposer tune the pipeline depth and the gap between
+     * pipelined blocks from the QC latencies it observes, see
+     * PipelineTuner. The configured async_blocks (32 if unset) bounds the
+     * depth. */
+    void set_auto_pipeline(bool enable);
+    /** Check the batchable signatures (votes and QCs) of up to `window`
+     * seconds together, see VeriPool::set_batch(). */
+    void set_veri_batch(double window, size_t max) { vpool.set_batch(window, max); }
+    /** Let the verification pool grow up to `max` workers under backlog,
+     * see VeriPool::set_max_workers(). */
+    void set_max_veri_workers(size_t max) { vpool.set_max_workers(max); }
+    /** Sign the own votes with `n` worker threads (0 signs them on the
+     * event loop), the vote is sent once its signature is ready. */
+    void set_sign_workers(size_t n) { spool = n ? new SignPool(ec, n) : nullptr; }
+    /** Emulate the outgoing links in-process: every message is held back
+     * by the serialization time at `bandwidth`, the delay and jitter, and
+     * by a retransmission timeout for each emulated loss. `link` applies
+     * to the peers without a set_link() entry. */
+    void set_link_default(const LinkEmu &link) { link_default = link; }
+    void set_link(ReplicaID rid, const LinkEmu &link) { link_conf[rid] = link; }
     virtual void do_elected() {}
 //#ifdef HOTSTUFF_AUTOCLI
 //    virtual void do_demand_commands(size_t) {}
@@ -256,7 +839,7 @@ class HotStuffBase: public HotStuffCore {
     /** Returns a promise resolved (with block_t blk) when Block is fetched. */
     promise_t async_fetch_blk(const uint256_t &blk_hash, const PeerId *replica, bool fetch_now = true);
     /** Returns a promise resolved (with block_t blk) when Block is delivered (i.e. prefix is fetched). */
-    promise_t async_deliver_blk(const uint256_t &blk_hash,  const PeerId &replica);
+    promise_t async_deliver_blk(const uint256_t &blk_hash,  const PeerId &replica, bool fetch_now = true);
 
     };
 
@@ -382,7 +965,7 @@ FetchContext<ent_type>::FetchContext(
 template<EntityType ent_type>
 void FetchContext<ent_type>::send(const PeerId &replica) {
     hs->part_fetched_replica[replica]++;
-    hs->pn.send_msg(fetch_msg, replica);
+    hs->send_msg(fetch_msg, replica);
 }
 
 template<EntityType ent_type>
@@ -397,6 +980,41 @@ void FetchContext<ent_type>::add_replica(const PeerId &replica, bool fetch_now)
     replicas.insert(replica);
 }
 
+template<EntityType ent_type>
+void FetchContext<ent_type>::resend() {
+    for (const auto &replica: replicas)
+        send(replica);
+    reset_timeout();
+}
+
+template<typename MsgType>
+void HotStuffBase::send_msg(const MsgType &msg, const PeerId &peer) {
+    if (!link_emu)
+    {
+        pn.send_msg(msg, peer);
+        return;
+    }
+    auto m = std::make_shared<MsgType>(msg);
+    link_enqueue(peer, m->serialized.size(), [this, m, peer]() {
+        pn.send_msg(*m, peer);
+    });
+}
+
+template<typename MsgType>
+void HotStuffBase::multicast_msg(const MsgType &msg, const std::vector<PeerId> &dests) {
+    if (!link_emu)
+    {
+        pn.multicast_msg(msg, dests);
+        return;
+    }
+    /* every link has its own queue, the message is shared */
+    auto m = std::make_shared<MsgType>(msg);
+    for (const auto &peer: dests)
+        link_enqueue(peer, m->serialized.size(), [this, m, peer]() {
+            pn.send_msg(*m, peer);
+        });
+}
+
 }
 
 #endif
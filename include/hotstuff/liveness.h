@@ -144,29 +144,28 @@ class PMWaitQC: public virtual PaceMaker {
         if (!pending_beats.empty())
         {
             if (locked) {
-                struct timeval current_time;
-                gettimeofday(&current_time, NULL);
-
-                if (hsc->piped_queue.size() < hsc->get_config().async_blocks
-                && !hsc->piped_submitted
-                && ((current_time.tv_sec - hsc->last_block_time.tv_sec) * 1000000 + current_time.tv_usec - hsc->last_block_time.tv_usec) / 1000 > hsc->get_config().piped_latency) {
+                auto &pipeline = hsc->pipeline;
+                const auto &config = hsc->get_config();
+                if (pipeline.size() < config.async_blocks
+                && !pipeline.submitted
+                && pipeline.since_last_block() > config.piped_latency) {
                     HOTSTUFF_LOG_PROTO("Extra block");
                     auto pm = pending_beats.front();
                     pending_beats.pop();
-                    hsc->piped_submitted = true;
+                    pipeline.submitted = true;
                     pm.resolve(get_proposer());
                     return;
                 }
 
-                if (!hsc->piped_queue.empty() && hsc->b_normal_height > 0) {
-                    block_t piped_block = hsc->storage->find_blk(hsc->piped_queue.back());
-                    if ( piped_block->get_height() > hsc->get_config().async_blocks + 10 && hsc->b_normal_height < piped_block->get_height() - (hsc->get_config().async_blocks + 10)
-                            && ((current_time.tv_sec - hsc->last_block_time.tv_sec) * 1000000 + current_time.tv_usec - hsc->last_block_time.tv_usec) / 1000 > hsc->get_config().piped_latency) {
-                        HOTSTUFF_LOG_PROTO("Extra recovery block %d %d", hsc->b_normal_height, piped_block->get_height());
+                if (!pipeline.empty() && pipeline.normal_height > 0) {
+                    uint32_t piped_height = pipeline.back_height();
+                    if (piped_height > config.async_blocks + 10 && pipeline.normal_height < piped_height - (config.async_blocks + 10)
+                            && pipeline.since_last_block() > config.piped_latency) {
+                        HOTSTUFF_LOG_PROTO("Extra recovery block %d %d", pipeline.normal_height, piped_height);
 
                         auto pm = pending_beats.front();
                         pending_beats.pop();
-                        hsc->piped_submitted = true;
+                        pipeline.submitted = true;
                         pm.resolve(get_proposer());
                     }
                 }
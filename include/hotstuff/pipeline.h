@@ -0,0 +1,176 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_PIPELINE_H
+#define _HOTSTUFF_PIPELINE_H
+
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <sys/time.h>
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** The pipelined blocks a proposer has in flight, in proposal order.
+ *
+ * Slots live in a ring indexed by the sequence number of the proposal, with
+ * a hash index on top, so that lookups, proposals and completions are all
+ * O(1). A block whose QC completes before the ones proposed ahead of it
+ * stays in its slot until they are done, which makes the ring its own
+ * reorder buffer. */
+class PipelineWindow {
+    public:
+    enum SlotState {
+        SLOT_FREE,
+        /** proposed, waiting for its QC */
+        SLOT_INFLIGHT,
+        /** QC complete, waiting for an older block */
+        SLOT_CERTIFIED
+    };
+
+    private:
+    struct Slot {
+        uint256_t hash;
+        uint32_t height;
+        SlotState state = SLOT_FREE;
+    };
+
+    /** the size is a power of two */
+    std::vector<Slot> ring;
+    std::unordered_map<const uint256_t, uint64_t> index;
+    /** sequence numbers of the oldest occupied slot and of the next proposal */
+    uint64_t head;
+    uint64_t tail;
+
+    Slot &slot(uint64_t seq) { return ring[seq & (ring.size() - 1)]; }
+    const Slot &slot(uint64_t seq) const { return ring[seq & (ring.size() - 1)]; }
+    void resize(size_t cap);
+    /** skip the freed slots at the head */
+    void advance();
+
+    public:
+    /** height of the last block proposed the regular way */
+    uint32_t normal_height;
+    /** the pace maker handed out a beat for a pipelined block */
+    bool submitted;
+    /** when the last block (pipelined or not) went out */
+    struct timeval last_block_time;
+
+    PipelineWindow(size_t depth = 0);
+
+    /** Make room for `depth` blocks without growing the ring. */
+    void reserve(size_t depth);
+
+    size_t size() const { return index.size(); }
+    bool empty() const { return index.empty(); }
+    bool contains(const uint256_t &hash) const { return index.count(hash); }
+    SlotState get_state(const uint256_t &hash) const;
+    /** the newest pipelined block, the window must not be empty */
+    const uint256_t &back() const { return slot(tail - 1).hash; }
+    uint32_t back_height() const { return slot(tail - 1).height; }
+    /** in-flight blocks, oldest first */
+    std::vector<uint256_t> pending() const;
+
+    void push(const uint256_t &hash, uint32_t height);
+    /** Record that the QC of `hash` is complete and return the blocks whose
+     * QCs can now be finished, in order: nothing while an older block is
+     * still in flight, otherwise `hash` followed by the certified blocks
+     * behind it. A block outside the window is returned as it is. */
+    std::vector<uint256_t> certify(const uint256_t &hash);
+    /** Drop a block without finishing it. */
+    void erase(const uint256_t &hash);
+
+    void touch() { gettimeofday(&last_block_time, nullptr); }
+    /** milliseconds since the last block went out */
+    long since_last_block() const;
+};
+
+/** Picks the pipeline depth and the gap between pipelined blocks at the
+ * proposer, from the time its blocks take to get their QCs.
+ *
+ * It follows the rate-based scheme of BBR: the rate at which QCs complete
+ * is what the bottleneck (usually the uplink of the proposer) lets through,
+ * the lowest QC latency is the time a block takes through the tree with
+ * nothing queued. Blocks are paced at that rate, with one round in eight
+ * probing above and one draining below it, and as many are kept in flight
+ * as fit in two floor latencies. Queues then stay short while the uplink
+ * stays busy. The floor is re-measured every `floor_ttl` seconds with a
+ * single block in flight for one round. */
+class PipelineTuner {
+    static const size_t NROUNDS = 10;
+
+    uint32_t max_depth;
+    /** bounds of the gap (sec) */
+    double min_gap;
+    double max_gap;
+    /** how long a latency floor is trusted (sec) */
+    double floor_ttl;
+
+    double gap;
+    uint32_t depth;
+    /** smoothed QC latency */
+    double qc_lat;
+    double base_lat;
+    double base_stamp;
+    /** QCs per second over the last rounds, a round being a floor latency */
+    double rates[NROUNDS];
+    double max_rate;
+    size_t round;
+    double round_start;
+    size_t round_delivered;
+    size_t delivered;
+    enum {
+        /** doubling the rate every round until it stops growing */
+        TUNE_STARTUP,
+        /** emptying the queue the start-up left behind */
+        TUNE_DRAIN,
+        TUNE_CRUISE,
+        /** one block in flight to see the floor again */
+        TUNE_FLOOR
+    } mode;
+    double startup_rate;
+    size_t nflat;
+    double floor_lat;
+    size_t nadjust;
+
+    void next_round(double now);
+
+    public:
+    PipelineTuner(uint32_t max_depth, double gap,
+                double min_gap = 0.001, double max_gap = 1,
+                double floor_ttl = 10);
+
+    /** A QC completed `lat` seconds after the block went out, `now` is the
+     * time in seconds. Returns true when the depth or the gap changed. */
+    bool on_qc(double lat, double now);
+
+    uint32_t get_depth() const { return depth; }
+    /** the gap in ms, as config.piped_latency takes it */
+    int32_t get_gap_ms() const { return std::max((int32_t)(gap * 1000 + 0.5), (int32_t)1); }
+    double get_qc_lat() const { return qc_lat; }
+    double get_base_lat() const { return base_lat; }
+    /** QCs per second the bottleneck lets through */
+    double get_rate() const { return max_rate; }
+    bool in_startup() const { return mode == TUNE_STARTUP; }
+    size_t get_nadjust() const { return nadjust; }
+};
+
+}
+
+#endif
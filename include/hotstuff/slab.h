@@ -0,0 +1,145 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_SLAB_H
+#define _HOTSTUFF_SLAB_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace hotstuff {
+
+/** A pool of fixed-size objects, for the types made and dropped on the hot
+ * path (blocks, certificates, curve points).
+ *
+ * Every thread keeps two magazines of free objects and only takes the
+ * lock of the pool to trade a whole magazine with the depot, so most
+ * allocations and frees touch neither the lock nor the system allocator.
+ * Slabs are never given back: once the pool has grown to the working set,
+ * no new pages are faulted in. */
+class SlabPool {
+    /** a free object, the first of a magazine in the depot also links
+     * the next magazine */
+    struct FreeObj {
+        FreeObj *next;
+        FreeObj *next_mag;
+        size_t n;
+    };
+
+    /** a chain of free objects */
+    struct Magazine {
+        FreeObj *head;
+        size_t n;
+    };
+
+    struct Cache;
+    friend struct Cache;
+
+    const char *name;
+    size_t obj_size;
+    /** obj_size, rounded up to the alignment */
+    size_t stride;
+    size_t id;
+
+    /* shared by the threads, under `lock` */
+    std::mutex lock;
+    FreeObj *depot;
+    uint8_t *slab;
+    size_t slab_left;
+
+    /* statistics */
+    std::atomic<size_t> nslabs;
+    std::atomic<size_t> nalloc;
+    std::atomic<size_t> nfree;
+    std::atomic<size_t> nrefill;
+
+    /** new objects from the slabs, under `lock` */
+    Magazine carve();
+    Magazine get_full();
+    void put(Magazine m);
+    Cache &cache();
+
+    public:
+    /** objects per magazine */
+    static const size_t magazine_size = 64;
+    /** bytes per slab */
+    static const size_t slab_bytes = 64 << 10;
+    static const size_t max_pools = 16;
+
+    struct Stat {
+        const char *name;
+        size_t obj_size;
+        size_t nalloc;
+        size_t nfree;
+        /** trips to the depot, either way */
+        size_t nrefill;
+        size_t reserved;
+    };
+
+    SlabPool(const char *name, size_t obj_size);
+    /* the slabs outlive the pool, objects may still be freed by the
+     * threads exiting after it */
+    ~SlabPool() = default;
+
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    /** Memory for an object of `size` bytes; the sizes other than the one
+     * of the pool (derived classes) go to the global operator new. */
+    void *alloc(size_t size);
+    void free(void *p, size_t size);
+
+    /** the statistics of every pool, in the order of creation */
+    static std::vector<Stat> get_stats();
+};
+
+/** A SlabPool that constructs and destroys objects of a type not ours,
+ * e.g. the elements of the BLS library. */
+template<typename T>
+class TypedSlabPool: public SlabPool {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                "over-aligned type in a slab");
+
+    public:
+    TypedSlabPool(const char *name): SlabPool(name, sizeof(T)) {}
+
+    template<typename... Args>
+    T *create(Args &&...args) {
+        void *p = alloc(sizeof(T));
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            free(p, sizeof(T));
+            throw;
+        }
+    }
+
+    void destroy(T *obj) {
+        if (obj == nullptr) return;
+        obj->~T();
+        free(obj, sizeof(T));
+    }
+};
+
+}
+
+#endif
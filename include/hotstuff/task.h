@@ -17,32 +17,362 @@
 #ifndef _HOTSTUFF_WORKER_H
 #define _HOTSTUFF_WORKER_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <typeindex>
 #include <unordered_map>
 #include <unistd.h>
 
 #include "salticidae/event.h"
 #include "hotstuff/util.h"
+#include "hotstuff/affinity.h"
 
 namespace hotstuff {
 
+/** The lanes of VeriPool, the workers take the tasks of a lower lane
+ * first. */
+enum VeriLane {
+    /** the certificates that hold up the current round (relayed aggregates) */
+    VERI_QC = 0,
+    /** individual votes */
+    VERI_VOTE = 1,
+    /** the certificates carried by fetched or proposed blocks */
+    VERI_BLOCK = 2,
+    VERI_NLANES
+};
+
 class VeriTask {
     friend class VeriPool;
     bool result;
+    /** bookkeeping of VeriPool */
+    uint32_t slot;
+    uint8_t lane;
     public:
     virtual bool verify() = 0;
     virtual ~VeriTask() = default;
 };
 
+/** A task that can be checked together with other tasks of the same kind
+ * (see VeriPool::set_batch). */
+class BatchVeriTask: public VeriTask {
+    public:
+    /** Check all `tasks` (of the same kind as this one) at once: true if
+     * every one of them is valid, false if at least one is not. */
+    virtual bool verify_batch(const std::vector<BatchVeriTask *> &tasks) = 0;
+    /** the tasks of the same kind are batched together */
+    virtual std::type_index batch_kind() const { return typeid(*this); }
+};
+
 using salticidae::ThreadCall;
 using veritask_ut = BoxObj<VeriTask>;
-using mpmc_queue_t = salticidae::MPMCQueueEventDriven<VeriTask *>;
 using mpsc_queue_t = salticidae::MPSCQueueEventDriven<VeriTask *>;
 
+/** Checks signatures with a pool of worker threads. Every worker has a
+ * deque per lane, the tasks are dealt round-robin and an idle worker
+ * steals from the others, the lower lanes first. The pool grows beyond its
+ * `nworker` threads while the backlog is deep (see set_max_workers) and
+ * shrinks back when they idle. */
 class VeriPool {
-    mpmc_queue_t in_queue;
     mpsc_queue_t out_queue;
 
+    struct Worker {
+        std::thread handle;
+        std::mutex lock;
+        std::deque<VeriTask *> lanes[VERI_NLANES];
+    };
+
+    /** checks a batch at once, falls back to the individual checks when
+     * the batch fails */
+    class BatchJob: public VeriTask {
+        std::vector<BatchVeriTask *> tasks;
+        public:
+        BatchJob(std::vector<BatchVeriTask *> &&tasks): tasks(std::move(tasks)) {}
+        bool verify() override {
+            bool valid = tasks.size() > 1 && tasks[0]->verify_batch(tasks);
+            for (auto task: tasks)
+                task->result = valid || task->verify();
+            return valid;
+        }
+    };
+
+    /** allocated up to max_workers on the first task, never moved after */
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t min_workers;
+    size_t max_workers;
+    /** queued tasks per worker that make the pool grow */
+    size_t grow_depth;
+    /** seconds after which an idle extra worker quits */
+    double idle_timeout;
+    /** workers [0, nlive) take tasks, changed with wait_lock held */
+    std::atomic<size_t> nlive;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> nstolen;
+    std::atomic<bool> stopping;
+    std::mutex wait_lock;
+    std::condition_variable wait_cv;
+    size_t next_worker;
+
+    struct Slot {
+        veritask_ut task;
+        promise_t pm;
+    };
+    /** the pending tasks, indexed by VeriTask::slot */
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+
+    EventContext ec;
+    VeriLane lane;
+    /** seconds the batchable tasks wait for company (0 disables batching) */
+    double batch_window;
+    size_t batch_max;
+    std::unordered_map<std::type_index, std::vector<BatchVeriTask *>> batches;
+    TimerEvent batch_timer;
+    bool batch_armed;
+
+    void finish(VeriTask *task) {
+        Slot &s = slots[task->slot];
+        promise_t pm = std::move(s.pm);
+        veritask_ut owned = std::move(s.task);
+        free_slots.push_back(task->slot);
+        pm.resolve(task->result);
+    }
+
+    /** the next task for worker `idx`: its own oldest one, or the newest
+     * one of another worker, from the lowest lane that has any */
+    VeriTask *take(size_t idx) {
+        for (size_t l = 0; l < VERI_NLANES; l++)
+        {
+            size_t n = nlive.load();
+            for (size_t k = 0; k < n; k++)
+            {
+                Worker &w = *workers[(idx + k) % n];
+                std::lock_guard<std::mutex> _(w.lock);
+                auto &q = w.lanes[l];
+                if (q.empty()) continue;
+                VeriTask *task;
+                if (k == 0)
+                {
+                    task = q.front();
+                    q.pop_front();
+                }
+                else
+                {
+                    task = q.back();
+                    q.pop_back();
+                    nstolen++;
+                }
+                queued--;
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void run(size_t idx) {
+        thread_layout.enter(THREAD_VERIFY);
+        for (;;)
+        {
+            VeriTask *task = take(idx);
+            if (task != nullptr)
+            {
+                HOTSTUFF_LOG_DEBUG("%lx working on %u",
+                                    std::this_thread::get_id(), (uintptr_t)task);
+                task->result = task->verify();
+                out_queue.enqueue(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(wait_lock);
+            while (!stopping && queued.load() == 0)
+            {
+                auto timeout = std::chrono::duration<double>(idle_timeout);
+                if (wait_cv.wait_for(lk, timeout) == std::cv_status::timeout &&
+                    queued.load() == 0 && idx >= min_workers && idx + 1 == nlive.load())
+                {
+                    /* the last extra worker leaves, nothing is dealt to it
+                     * any more */
+                    nlive--;
+                    return;
+                }
+            }
+            if (stopping) return;
+        }
+    }
+
+    /** start worker `idx`, with wait_lock held */
+    void spawn(size_t idx) {
+        Worker &w = *workers[idx];
+        if (w.handle.joinable()) w.handle.join();
+        nlive++;
+        w.handle = std::thread([this, idx]() { run(idx); });
+    }
+
+    void enqueue(VeriTask *task) {
+        std::lock_guard<std::mutex> _(wait_lock);
+        if (workers.empty())
+        {
+            workers.resize(max_workers);
+            for (auto &w: workers) w.reset(new Worker());
+        }
+        size_t n = nlive.load();
+        while (n < min_workers) spawn(n++);
+        if (n < max_workers && queued.load() >= n * grow_depth)
+            spawn(n++);
+        {
+            Worker &w = *workers[next_worker++ % n];
+            std::lock_guard<std::mutex> _(w.lock);
+            w.lanes[task->lane].push_back(task);
+        }
+        queued++;
+        wait_cv.notify_one();
+    }
+
+    void submit_batch(std::vector<BatchVeriTask *> &&tasks) {
+        std::vector<BatchVeriTask *> members = tasks;
+        VeriLane prev = lane;
+        lane = VERI_NLANES;
+        for (auto task: members)
+            lane = std::min(lane, (VeriLane)task->lane);
+        verify(new BatchJob(std::move(tasks))).then([this, members](bool) {
+            for (auto task: members)
+                finish(task);
+        });
+        lane = prev;
+    }
+
+    void flush_batches() {
+        for (auto &b: batches)
+            if (!b.second.empty()) submit_batch(std::move(b.second));
+        batches.clear();
+    }
+
+    void add_to_batch(BatchVeriTask *task) {
+        auto &b = batches[task->batch_kind()];
+        b.push_back(task);
+        if (b.size() >= batch_max)
+        {
+            submit_batch(std::move(b));
+            b.clear();
+        }
+        else if (!batch_armed)
+        {
+            batch_timer.add(batch_window);
+            batch_armed = true;
+        }
+    }
+
+    public:
+    /** Route the tasks submitted while it lives to another lane. */
+    class LaneGuard {
+        VeriPool &vpool;
+        VeriLane prev;
+        public:
+        LaneGuard(VeriPool &vpool, VeriLane lane): vpool(vpool), prev(vpool.lane) {
+            vpool.lane = lane;
+        }
+        ~LaneGuard() { vpool.lane = prev; }
+    };
+
+    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128):
+            min_workers(std::max<size_t>(nworker, 1)),
+            max_workers(min_workers),
+            grow_depth(8),
+            idle_timeout(5),
+            nlive(0), queued(0), nstolen(0), stopping(false),
+            next_worker(0),
+            ec(ec), lane(VERI_VOTE),
+            batch_window(0), batch_max(0), batch_armed(false) {
+        out_queue.reg_handler(ec, [this, burst_size](mpsc_queue_t &q) {
+            size_t cnt = burst_size;
+            VeriTask *task;
+            while (q.try_dequeue(task))
+            {
+                finish(task);
+                if (!--cnt) return true;
+            }
+            return false;
+        });
+    }
+
+    ~VeriPool() {
+        {
+            std::lock_guard<std::mutex> _(wait_lock);
+            stopping = true;
+        }
+        wait_cv.notify_all();
+        for (auto &w: workers)
+            if (w->handle.joinable()) w->handle.join();
+    }
+
+    /** Let the pool grow up to `max` workers while more than `depth` tasks
+     * per worker are queued. Has to be called before the first task. */
+    void set_max_workers(size_t max, size_t depth = 8) {
+        assert(workers.empty());
+        max_workers = std::max(max, min_workers);
+        grow_depth = std::max<size_t>(depth, 1);
+    }
+
+    /** Hold the batchable tasks back for up to `window` seconds (or until
+     * `max` of a kind are pending) and check them with one batch check
+     * each. The promise of every task is still resolved separately. */
+    void set_batch(double window, size_t max) {
+        batch_window = window;
+        batch_max = std::max<size_t>(max, 1);
+        batch_timer = TimerEvent(ec, [this](TimerEvent &) {
+            batch_armed = false;
+            flush_batches();
+        });
+    }
+
+    promise_t verify(veritask_ut &&task) {
+        auto ptr = task.get();
+        if (free_slots.empty())
+        {
+            free_slots.push_back(slots.size());
+            slots.emplace_back();
+        }
+        ptr->slot = free_slots.back();
+        ptr->lane = lane;
+        free_slots.pop_back();
+        Slot &s = slots[ptr->slot];
+        s.task = std::move(task);
+        s.pm = promise_t([](promise_t &){});
+        promise_t pm = s.pm;
+        auto btask = batch_window > 0 ? dynamic_cast<BatchVeriTask *>(ptr) : nullptr;
+        if (btask != nullptr)
+            add_to_batch(btask);
+        else
+            enqueue(ptr);
+        return pm;
+    }
+
+    size_t get_queued() const { return queued.load(); }
+    size_t get_nworker() const { return nlive.load(); }
+    size_t get_nstolen() const { return nstolen.load(); }
+};
+
+/** Signing work that is kept off the event loop (see SignPool). */
+class SignTask {
+    public:
+    virtual void sign() = 0;
+    virtual ~SignTask() = default;
+};
+
+using signtask_ut = BoxObj<SignTask>;
+using sign_mpmc_queue_t = salticidae::MPMCQueueEventDriven<SignTask *>;
+using sign_mpsc_queue_t = salticidae::MPSCQueueEventDriven<SignTask *>;
+
+/** Worker threads for the signatures of the own votes. They are kept apart
+ * from VeriPool, so that a signature does not queue up behind the checks of
+ * the votes of other blocks. */
+class SignPool {
+    sign_mpmc_queue_t in_queue;
+    sign_mpsc_queue_t out_queue;
+
     struct Worker {
         std::thread handle;
         EventContext ec;
@@ -50,17 +380,17 @@ class VeriPool {
     };
 
     std::vector<Worker> workers;
-    std::unordered_map<VeriTask *, std::pair<veritask_ut, promise_t>> pms;
+    std::unordered_map<SignTask *, std::pair<signtask_ut, promise_t>> pms;
 
     public:
-    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128) {
-        out_queue.reg_handler(ec, [this, burst_size](mpsc_queue_t &q) {
+    SignPool(EventContext ec, size_t nworker, size_t burst_size = 128) {
+        out_queue.reg_handler(ec, [this, burst_size](sign_mpsc_queue_t &q) {
             size_t cnt = burst_size;
-            VeriTask *task;
+            SignTask *task;
             while (q.try_dequeue(task))
             {
                 auto it = pms.find(task);
-                it->second.second.resolve(task->result);
+                it->second.second.resolve(task);
                 pms.erase(it);
                 if (!--cnt) return true;
             }
@@ -70,14 +400,12 @@ class VeriPool {
         workers.resize(nworker);
         for (size_t i = 0; i < nworker; i++)
         {
-            in_queue.reg_handler(workers[i].ec, [this, burst_size](mpmc_queue_t &q) {
+            in_queue.reg_handler(workers[i].ec, [this, burst_size](sign_mpmc_queue_t &q) {
                 size_t cnt = burst_size;
-                VeriTask *task;
+                SignTask *task;
                 while (q.try_dequeue(task))
                 {
-                    HOTSTUFF_LOG_DEBUG("%lx working on %u",
-                                        std::this_thread::get_id(), (uintptr_t)task);
-                    task->result = task->verify();
+                    task->sign();
                     out_queue.enqueue(task);
                     if (!--cnt) return true;
                 }
@@ -87,11 +415,14 @@ class VeriPool {
         for (auto &w: workers)
         {
             w.tcall = new ThreadCall(w.ec);
-            w.handle = std::thread([ec=w.ec]() { ec.dispatch(); });
+            w.handle = std::thread([ec=w.ec]() {
+                thread_layout.enter(THREAD_SIGN);
+                ec.dispatch();
+            });
         }
     }
 
-    ~VeriPool() {
+    ~SignPool() {
         for (auto &w: workers)
             w.tcall->async_call([ec=w.ec](ThreadCall::Handle &) {
                 ec.stop();
@@ -100,7 +431,9 @@ class VeriPool {
             w.handle.join();
     }
 
-    promise_t verify(veritask_ut &&task) {
+    /** The promise resolves with the signed task (SignTask *), which is
+     * freed once the callbacks return. */
+    promise_t sign(signtask_ut &&task) {
         auto ptr = task.get();
         auto ret = pms.insert(std::make_pair(ptr,
                 std::make_pair(std::move(task), promise_t([](promise_t &){}))));
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_TOPOLOGY_H
+#define _HOTSTUFF_TOPOLOGY_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "salticidae/util.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** The dissemination/aggregation tree over the replicas. Proposals flow
+ * from the root to the leaves and votes are aggregated on the way back. */
+class Topology {
+    ReplicaID root;
+    /** breadth-first order, root first */
+    std::vector<ReplicaID> order;
+    std::unordered_map<ReplicaID, ReplicaID> parents;
+    std::unordered_map<ReplicaID, std::vector<ReplicaID>> children;
+    std::unordered_map<ReplicaID, uint32_t> depths;
+
+    void add_edge(ReplicaID parent, ReplicaID child);
+    /** compute the breadth-first order and the depths from the edges */
+    void finalize();
+
+    public:
+    Topology(): root(0) {}
+
+    /** Fill the tree level by level with the replicas in `order` (the first
+     * one is the root). The fan-out of level `l` is `fanouts[l]`, the last
+     * entry applies to all deeper levels, so a single entry gives a k-ary
+     * tree of arbitrary depth. */
+    static Topology from_order(const std::vector<ReplicaID> &order,
+                                const std::vector<uint32_t> &fanouts);
+
+    /** Read an explicit tree over `nreplicas` replicas. Every line lists
+     * the children of a replica as `<parent>: <child> <child> ...`, and
+     * `root <rid>` names the root, which is otherwise the only replica
+     * that is nobody's child. `#` starts a comment. */
+    static Topology from_file(const std::string &fname, size_t nreplicas);
+
+    /** Infer a region-aware tree from a Kollaps experiment description
+     * (e.g. runkauri/topology.xml), which has no notion of a tree. The
+     * replicas are assigned to the services in the order of their "join"
+     * schedule, `root` takes one replica of every region as its children
+     * and the deeper levels prefer children from the region of (or
+     * closest to) their parent. The shape is the one of from_order(), so
+     * the tree is reproduced by from_order(get_order(), fanouts). */
+    static Topology from_kollaps(const std::string &fname, size_t nreplicas,
+                                const std::vector<uint32_t> &fanouts,
+                                ReplicaID root = 0);
+
+    /** The same shape with the replica at the i-th position of the
+     * breadth-first order replaced by `order[i]`. */
+    Topology relabel(const std::vector<ReplicaID> &order) const;
+
+    ReplicaID get_root() const { return root; }
+    bool has_parent(ReplicaID rid) const { return parents.count(rid); }
+    ReplicaID get_parent(ReplicaID rid) const;
+    const std::vector<ReplicaID> &get_children(ReplicaID rid) const;
+    /** all replicas in the subtree of `rid`, excluding itself */
+    std::set<ReplicaID> get_descendants(ReplicaID rid) const;
+    uint32_t get_depth(ReplicaID rid) const;
+    /** depth of the deepest replica */
+    uint32_t get_height() const;
+    /** number of replicas (the root included) that have children */
+    size_t get_ninternal() const;
+    /** the largest number of children on each level */
+    std::vector<uint32_t> get_level_fanouts() const;
+    const std::vector<ReplicaID> &get_order() const { return order; }
+    size_t size() const { return order.size(); }
+    bool is_star() const { return get_ninternal() <= 1; }
+};
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_WAL_H
+#define _HOTSTUFF_WAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "salticidae/event.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** The kinds of records in the write-ahead log of a replica. */
+enum WalRecord {
+    /** height and serialized block */
+    WAL_BLOCK = 'B',
+    /** hash of a committed block */
+    WAL_COMMIT = 'C',
+    /** vheight, b_lock, b_exec and hqc */
+    WAL_STATE = 'S'
+};
+
+/** An append-only log of checksummed records.
+ *
+ * Records are buffered on the event loop and written by a thread of the
+ * log, which flushes everything appended while the previous fdatasync was
+ * running in one go (group commit). A torn or corrupt tail, as left by a
+ * crash, ends the replay. */
+class WriteAheadLog {
+    using seq_queue_t = salticidae::MPSCQueueEventDriven<uint64_t>;
+
+    std::string fname;
+    int fd;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool stopping;
+
+    /* shared with the writer, under `lock` */
+    bytearray_t buffer;
+    uint64_t buffered_seq;
+    /** records that replace the log, written before `buffer` */
+    std::vector<bytearray_t> rewrite_recs;
+    bool rewrite_pending;
+
+    /* event loop side */
+    uint64_t appended_seq;
+    uint64_t durable_seq;
+    size_t file_size;
+    std::deque<std::pair<uint64_t, promise_t>> waiting;
+    seq_queue_t synced;
+
+    /* statistics */
+    std::atomic<size_t> nsync;
+    std::atomic<size_t> nsynced_bytes;
+
+    void run();
+    void write_all(int fd, const bytearray_t &data);
+    static void frame(bytearray_t &out, const bytearray_t &rec);
+
+    public:
+    WriteAheadLog(const EventContext &ec, const std::string &fname);
+    ~WriteAheadLog();
+
+    /** Read the records left by the last run, to be called before the
+     * first append. */
+    std::vector<bytearray_t> replay();
+    void append(const bytearray_t &rec);
+    /** The promise resolves once all appended records are on disk. */
+    promise_t sync();
+    /** Replace the whole log by `recs`: they go to a new file which is
+     * renamed over the old one once it is durable. */
+    void rewrite(std::vector<bytearray_t> &&recs);
+
+    /** bytes in the log, the pending ones included */
+    size_t get_size() const { return file_size; }
+    size_t get_nsync() const { return nsync.load(std::memory_order_relaxed); }
+    size_t get_synced_bytes() const { return nsynced_bytes.load(std::memory_order_relaxed); }
+};
+
+}
+
+#endif
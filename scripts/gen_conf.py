@@ -17,9 +17,33 @@ if __name__ == "__main__":
     parser.add_argument('--pace-maker', type=str, default='dummy')
     parser.add_argument('--crypto', type=str, default='bls')
     parser.add_argument('--nworker', type=int, default=6)
+    parser.add_argument('--nsigner', type=int, default=1)
+    parser.add_argument('--thread-layout', type=str, default=None)
+    parser.add_argument('--prune-depth', type=int, default=None)
+    parser.add_argument('--prune-mem', type=int, default=0)
+    parser.add_argument('--wal-dir', type=str, default=None)
+    parser.add_argument('--blk-store', type=str, default=None)
+    parser.add_argument('--sync-batch', type=int, default=None)
+    parser.add_argument('--sync-gap', type=int, default=None)
     parser.add_argument('--fanout', type=int, default=10)
     parser.add_argument('--pipedepth', type=int, default=0)
     parser.add_argument('--pipelatency', type=int, default=10)
+    parser.add_argument('--auto-pipeline', action='store_true')
+    parser.add_argument('--tree-reopt-period', type=float, default=0)
+    parser.add_argument('--tree-relay-timeout', type=float, default=0)
+    parser.add_argument('--level-fanout', type=str, default=None)
+    parser.add_argument('--topology', type=str, default=None)
+    parser.add_argument('--tree-file', type=str, default=None)
+    parser.add_argument('--relay-policy', type=str, default='full')
+    parser.add_argument('--trees', type=int, default=1)
+    parser.add_argument('--erasure', action='store_true')
+    parser.add_argument('--optimistic-verify', action='store_true')
+    parser.add_argument('--veri-batch', type=float, default=0)
+    parser.add_argument('--link-delay', type=float, default=0)
+    parser.add_argument('--link-jitter', type=float, default=0)
+    parser.add_argument('--link-bandwidth', type=float, default=0)
+    parser.add_argument('--link-loss', type=float, default=0)
+    parser.add_argument('--link', type=str, action='append', default=[])
 
     args = parser.parse_args()
 
@@ -69,6 +93,22 @@ if __name__ == "__main__":
         main_conf.write("block-size = {}\n".format(args.block_size))
     if args.nworker is not None:
         main_conf.write("nworker = {}\n".format(args.nworker))
+    if args.nsigner is not None:
+        main_conf.write("nsigner = {}\n".format(args.nsigner))
+    if args.thread_layout is not None:
+        main_conf.write("thread-layout = {}\n".format(args.thread_layout))
+    if args.prune_depth is not None:
+        main_conf.write("prune-depth = {}\n".format(args.prune_depth))
+    if args.prune_mem > 0:
+        main_conf.write("prune-mem = {}\n".format(args.prune_mem))
+    if args.wal_dir is not None:
+        main_conf.write("wal-dir = {}\n".format(args.wal_dir))
+    if args.blk_store is not None:
+        main_conf.write("blk-store = {}\n".format(args.blk_store))
+    if args.sync_batch is not None:
+        main_conf.write("sync-batch = {}\n".format(args.sync_batch))
+    if args.sync_gap is not None:
+        main_conf.write("sync-gap = {}\n".format(args.sync_gap))
     if not (args.pace_maker is None):
         main_conf.write("pace-maker = {}\n".format(args.pace_maker))
 
@@ -76,6 +116,38 @@ if __name__ == "__main__":
     main_conf.write("fan-out = {}\n".format(args.fanout))
     main_conf.write("piped_latency = {}\n".format(args.pipelatency))
     main_conf.write("async_blocks = {}\n".format(args.pipedepth))
+    if args.auto_pipeline:
+        main_conf.write("auto-pipeline = true\n")
+    if args.tree_reopt_period > 0:
+        main_conf.write("tree-reopt-period = {}\n".format(args.tree_reopt_period))
+    if args.tree_relay_timeout > 0:
+        main_conf.write("tree-relay-timeout = {}\n".format(args.tree_relay_timeout))
+    if args.level_fanout is not None:
+        main_conf.write("level-fanout = {}\n".format(args.level_fanout))
+    if args.topology is not None:
+        main_conf.write("topology = {}\n".format(args.topology))
+    if args.tree_file is not None:
+        main_conf.write("tree-file = {}\n".format(args.tree_file))
+    if args.erasure:
+        main_conf.write("erasure = true\n")
+    if args.optimistic_verify:
+        main_conf.write("optimistic-verify = true\n")
+    if args.veri_batch > 0:
+        main_conf.write("veri-batch = {}\n".format(args.veri_batch))
+    if args.trees > 1:
+        main_conf.write("trees = {}\n".format(args.trees))
+    if args.relay_policy != 'full':
+        main_conf.write("relay-policy = {}\n".format(args.relay_policy))
+    if args.link_delay > 0:
+        main_conf.write("link-delay = {}\n".format(args.link_delay))
+    if args.link_jitter > 0:
+        main_conf.write("link-jitter = {}\n".format(args.link_jitter))
+    if args.link_bandwidth > 0:
+        main_conf.write("link-bandwidth = {}\n".format(args.link_bandwidth))
+    if args.link_loss > 0:
+        main_conf.write("link-loss = {}\n".format(args.link_loss))
+    for l in args.link:
+        main_conf.write("link = {}\n".format(l))
 
     for r in zip(replicas, keys, tls_keys2[:len(keys)], itertools.count(0)):
         main_conf.write("replica = {}, {}, {}\n".format(r[0], r[1][0], r[2][2]))
@@ -0,0 +1,172 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "hotstuff/affinity.h"
+#include "hotstuff/type.h"
+#include "hotstuff/util.h"
+
+namespace hotstuff {
+
+ThreadLayout thread_layout;
+
+static const char *class_names[THREAD_NCLASSES] = {
+    "main", "verify", "sign", "net", "client", "wal"
+};
+
+std::vector<int> ThreadLayout::parse_cpus(const std::string &spec) {
+    std::string list = spec;
+    if (spec.compare(0, 4, "node") == 0)
+    {
+        std::string fname = "/sys/devices/system/node/" + spec + "/cpulist";
+        std::ifstream f(fname);
+        if (!f || !std::getline(f, list))
+            throw HotStuffError("cannot read the cores of NUMA %s", spec.c_str());
+    }
+    std::vector<int> cpus;
+    for (const auto &range: salticidae::split(list, ","))
+    {
+        auto r = salticidae::trim_all(salticidae::split(range, "-"));
+        try {
+            int lo = std::stoi(r[0]);
+            int hi = r.size() > 1 ? std::stoi(r[1]) : lo;
+            if (r.size() > 2 || lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+                throw std::invalid_argument(range);
+            for (int c = lo; c <= hi; c++)
+                cpus.push_back(c);
+        } catch (std::logic_error &) {
+            throw HotStuffError("invalid core range \"%s\"", range.c_str());
+        }
+    }
+    return cpus;
+}
+
+ThreadLayout ThreadLayout::parse(const std::string &spec) {
+    ThreadLayout layout;
+    for (const auto &entry: salticidae::split(spec, ";"))
+    {
+        auto kv = salticidae::trim_all(salticidae::split(entry, ":"));
+        if (kv.size() == 1 && kv[0].empty()) continue;
+        if (kv.size() != 2)
+            throw HotStuffError("invalid thread layout entry \"%s\"", entry.c_str());
+        size_t cls = 0;
+        while (cls < THREAD_NCLASSES && kv[0] != class_names[cls]) cls++;
+        if (cls == THREAD_NCLASSES)
+            throw HotStuffError("unknown thread class \"%s\"", kv[0].c_str());
+        layout.cpus[cls] = parse_cpus(kv[1]);
+    }
+    return layout;
+}
+
+void ThreadLayout::pin(ThreadClass cls) const {
+    if (cpus[cls].empty()) return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int c: cpus[cls])
+        CPU_SET(c, &mask);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (ret)
+        HOTSTUFF_LOG_WARN("cannot pin a %s thread: %s", class_names[cls], strerror(ret));
+}
+
+void ThreadLayout::enter(ThreadClass cls) const {
+    pin(cls);
+    std::string name = std::string("hs-") + class_names[cls];
+    pthread_setname_np(pthread_self(), name.c_str());
+}
+
+std::string ThreadLayout::to_string() const {
+    std::string s;
+    for (size_t cls = 0; cls < THREAD_NCLASSES; cls++)
+    {
+        if (cpus[cls].empty()) continue;
+        if (!s.empty()) s += ";";
+        s += std::string(class_names[cls]) + ":";
+        for (size_t i = 0; i < cpus[cls].size(); i++)
+            s += (i ? "," : "") + std::to_string(cpus[cls][i]);
+    }
+    return s.empty() ? "unpinned" : s;
+}
+
+ThreadLayout::Scope::Scope(const ThreadLayout &layout, ThreadClass cls) {
+    pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask);
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    layout.enter(cls);
+}
+
+ThreadLayout::Scope::~Scope() {
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    pthread_setname_np(pthread_self(), name);
+}
+
+ThreadCpuStat::ThreadCpuStat() {
+    gettimeofday(&last, nullptr);
+    /* the baseline of the threads already running */
+    sample();
+}
+
+std::map<std::string, std::pair<size_t, double>> ThreadCpuStat::sample() {
+    std::map<std::string, std::pair<size_t, double>> ret;
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    double elapsed = (now.tv_sec - last.tv_sec) + (now.tv_usec - last.tv_usec) / 1e6;
+    last = now;
+    static const double hz = sysconf(_SC_CLK_TCK);
+    const long pid = getpid();
+
+    std::unordered_map<long, unsigned long long> ticks;
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr) return ret;
+    while (struct dirent *ent = readdir(dir))
+    {
+        if (ent->d_name[0] == '.') continue;
+        long tid = std::atol(ent->d_name);
+        std::ifstream f(std::string("/proc/self/task/") + ent->d_name + "/stat");
+        std::string line;
+        if (!std::getline(f, line)) continue;
+        /* "tid (comm) state ppid ...", utime and stime are the 14th and
+         * 15th fields */
+        size_t l = line.find('('), r = line.rfind(')');
+        if (l == std::string::npos || r == std::string::npos) continue;
+        std::string name = tid == pid ? "main" : line.substr(l + 1, r - l - 1);
+        std::istringstream fields(line.substr(r + 2));
+        std::string skip;
+        unsigned long long utime, stime;
+        for (int i = 0; i < 11; i++) fields >> skip;
+        if (!(fields >> utime >> stime)) continue;
+        ticks[tid] = utime + stime;
+        /* a new thread only gets its baseline, all it used before would
+         * count as used in this interval */
+        auto it = last_ticks.find(tid);
+        if (it == last_ticks.end()) continue;
+        unsigned long long used = ticks[tid] - it->second;
+        auto &s = ret[name];
+        s.first++;
+        if (elapsed > 0) s.second += used / hz / elapsed * 100;
+    }
+    closedir(dir);
+    last_ticks = std::move(ticks);
+    return ret;
+}
+
+}
@@ -0,0 +1,252 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hotstuff/blkstore.h"
+#include "hotstuff/util.h"
+
+namespace hotstuff {
+
+static const uint64_t index_magic = 0x31786469736b6c62; /* "blksidx1" */
+
+static bytearray_t hash_bytes(const uint256_t &hash) {
+    DataStream s;
+    s << hash;
+    return std::move(s);
+}
+
+static uint64_t hash_slot(const uint8_t *hash) {
+    uint64_t h;
+    memmove(&h, hash, sizeof(h));
+    return h;
+}
+
+BlockStore::BlockStore(const std::string &dir, size_t seg_size):
+        dir(dir), seg_size(seg_size),
+        idx_map(nullptr), idx_cap(0),
+        hidx_map(nullptr), nbytes(0) {
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+        throw HotStuffError("cannot create %s: %s", dir.c_str(), strerror(errno));
+
+    idx_fd = open((dir + "/index").c_str(), O_RDWR | O_CREAT, 0644);
+    hidx_fd = open((dir + "/hindex").c_str(), O_RDWR | O_CREAT, 0644);
+    if (idx_fd < 0 || hidx_fd < 0)
+        throw HotStuffError("cannot open the index in %s: %s", dir.c_str(), strerror(errno));
+    off_t size = lseek(idx_fd, 0, SEEK_END);
+    if (size < (off_t)sizeof(IndexHeader))
+    {
+        grow_index(1024);
+        *header() = IndexHeader{index_magic, 0, 0, 0};
+    }
+    else
+    {
+        idx_cap = (size - sizeof(IndexHeader)) / sizeof(Entry);
+        idx_map = map_file(idx_fd, sizeof(IndexHeader) + idx_cap * sizeof(Entry), true);
+        if (header()->magic != index_magic)
+            throw HotStuffError("%s/index is not a block index", dir.c_str());
+    }
+
+    for (uint32_t seg = 0; access(seg_name(seg).c_str(), F_OK) == 0; seg++)
+        open_segment(seg, 0);
+    /* drop the entries whose blocks did not make it to the segments */
+    auto &count = header()->count;
+    while (count && entries()[count - 1].len &&
+            (entries()[count - 1].seg >= segs.size() ||
+            entries()[count - 1].offset + entries()[count - 1].len >
+                segs[entries()[count - 1].seg].size))
+        count--;
+    for (const auto &s: segs) nbytes += s.size;
+
+    size = lseek(hidx_fd, 0, SEEK_END);
+    if (size >= (off_t)sizeof(HashHeader))
+    {
+        hidx_map = map_file(hidx_fd, size, true);
+        if (hash_header()->count != count ||
+            sizeof(HashHeader) + hash_header()->cap * sizeof(uint32_t) != (size_t)size)
+            build_hash_index(hash_header()->cap);
+    }
+    else
+        build_hash_index(1024);
+    if (count)
+        HOTSTUFF_LOG_INFO("block store %s: heights %u..%u in %lu segments (%.3f MB)",
+                        dir.c_str(), get_base_height(), get_top_height(),
+                        segs.size(), nbytes / 1048576.0);
+}
+
+BlockStore::~BlockStore() {
+    for (const auto &s: segs)
+    {
+        munmap(s.map, s.map_len);
+        close(s.fd);
+    }
+    munmap(idx_map, sizeof(IndexHeader) + idx_cap * sizeof(Entry));
+    munmap(hidx_map, sizeof(HashHeader) + hash_header()->cap * sizeof(uint32_t));
+    close(idx_fd);
+    close(hidx_fd);
+}
+
+std::string BlockStore::seg_name(uint32_t seg) const {
+    char buff[32];
+    snprintf(buff, sizeof buff, "/seg-%08u", seg);
+    return dir + buff;
+}
+
+uint8_t *BlockStore::map_file(int fd, size_t cap, bool writable) {
+    void *map = mmap(nullptr, cap, PROT_READ | (writable ? PROT_WRITE : 0),
+                    MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        throw HotStuffError("cannot map the block store: %s", strerror(errno));
+    return static_cast<uint8_t *>(map);
+}
+
+void BlockStore::open_segment(uint32_t seg, size_t min_len) {
+    Segment s;
+    s.fd = open(seg_name(seg).c_str(), O_RDWR | O_CREAT, 0644);
+    if (s.fd < 0)
+        throw HotStuffError("cannot open %s: %s", seg_name(seg).c_str(), strerror(errno));
+    s.size = lseek(s.fd, 0, SEEK_END);
+    /* the pages beyond the end of the file fill in as blocks are written */
+    s.map_len = std::max(std::max(seg_size, s.size), min_len);
+    s.map = map_file(s.fd, s.map_len, false);
+    segs.push_back(s);
+}
+
+void BlockStore::grow_index(size_t count) {
+    if (count <= idx_cap) return;
+    size_t ncap = std::max(idx_cap * 2, count);
+    size_t len = sizeof(IndexHeader) + ncap * sizeof(Entry);
+    if (ftruncate(idx_fd, len) < 0)
+        throw HotStuffError("cannot grow the block index: %s", strerror(errno));
+    if (idx_map) munmap(idx_map, sizeof(IndexHeader) + idx_cap * sizeof(Entry));
+    idx_map = map_file(idx_fd, len, true);
+    idx_cap = ncap;
+}
+
+void BlockStore::build_hash_index(size_t cap) {
+    size_t count = header()->count;
+    /* keep the load below one half */
+    size_t ncap = 1024;
+    while (ncap < cap || ncap < count * 2) ncap <<= 1;
+    if (hidx_map) munmap(hidx_map, sizeof(HashHeader) + hash_header()->cap * sizeof(uint32_t));
+    size_t len = sizeof(HashHeader) + ncap * sizeof(uint32_t);
+    if (ftruncate(hidx_fd, 0) < 0 || ftruncate(hidx_fd, len) < 0)
+        throw HotStuffError("cannot grow the hash index: %s", strerror(errno));
+    hidx_map = map_file(hidx_fd, len, true);
+    hash_header()->cap = ncap;
+    for (size_t pos = 0; pos < count; pos++)
+        if (entries()[pos].len) hash_insert(pos);
+    hash_header()->count = count;
+}
+
+void BlockStore::hash_insert(uint64_t pos) {
+    size_t mask = hash_header()->cap - 1;
+    auto s = slots();
+    size_t i = hash_slot(entries()[pos].hash) & mask;
+    while (s[i]) i = (i + 1) & mask;
+    s[i] = pos + 1;
+}
+
+int64_t BlockStore::hash_find(const uint256_t &hash) const {
+    if (!header()->count) return -1;
+    auto hb = hash_bytes(hash);
+    size_t mask = hash_header()->cap - 1;
+    auto s = slots();
+    for (size_t i = hash_slot(hb.data()) & mask; s[i]; i = (i + 1) & mask)
+        if (!memcmp(entries()[s[i] - 1].hash, hb.data(), sizeof(Entry::hash)))
+            return s[i] - 1;
+    return -1;
+}
+
+bool BlockStore::put(const Block &blk) {
+    uint32_t height = blk.get_height();
+    auto &hdr = *header();
+    if (hdr.count && height <= get_top_height()) return false;
+
+    DataStream s;
+    s << blk;
+    bytearray_t data = std::move(s);
+    if (segs.empty() || segs.back().size + data.size() > segs.back().map_len)
+        open_segment(segs.size(), data.size());
+    auto &seg = segs.back();
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t ret = pwrite(seg.fd, data.data() + done, data.size() - done, seg.size + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            throw HotStuffError("cannot write %s: %s", seg_name(segs.size() - 1).c_str(), strerror(errno));
+        }
+        done += ret;
+    }
+
+    if (!hdr.count) hdr.base_height = height;
+    uint64_t pos = height - hdr.base_height;
+    grow_index(pos + 1);
+    /* grow_index() may have moved the mapping */
+    Entry &e = entries()[pos];
+    auto hb = hash_bytes(blk.get_hash());
+    memmove(e.hash, hb.data(), sizeof(e.hash));
+    e.offset = seg.size;
+    e.seg = segs.size() - 1;
+    e.len = data.size();
+    /* the heights skipped, if any, were zero-filled by ftruncate() */
+    header()->count = pos + 1;
+    seg.size += data.size();
+    nbytes += data.size();
+
+    if ((pos + 1) * 2 > hash_header()->cap)
+        build_hash_index(hash_header()->cap * 2);
+    else
+    {
+        hash_insert(pos);
+        hash_header()->count = pos + 1;
+    }
+    return true;
+}
+
+BlockStore::raw_t BlockStore::get_entry(uint64_t pos) const {
+    const Entry &e = entries()[pos];
+    if (!e.len) return raw_t(nullptr, 0);
+    return raw_t(segs[e.seg].map + e.offset, e.len);
+}
+
+BlockStore::raw_t BlockStore::get_raw(const uint256_t &hash) const {
+    int64_t pos = hash_find(hash);
+    return pos < 0 ? raw_t(nullptr, 0) : get_entry(pos);
+}
+
+BlockStore::raw_t BlockStore::get_raw_by_height(uint32_t height) const {
+    if (empty() || height < get_base_height() || height > get_top_height())
+        return raw_t(nullptr, 0);
+    return get_entry(height - get_base_height());
+}
+
+uint256_t BlockStore::get_hash(uint32_t height) const {
+    if (!get_raw_by_height(height).first) return uint256_t();
+    const Entry &e = entries()[height - get_base_height()];
+    return uint256_t(bytearray_t(e.hash, e.hash + sizeof(e.hash)));
+}
+
+}
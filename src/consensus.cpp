@@ -15,11 +15,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <stack>
 
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
+#include "hotstuff/wal.h"
 
 #define LOG_INFO HOTSTUFF_LOG_INFO
 #define LOG_DEBUG HOTSTUFF_LOG_DEBUG
@@ -40,7 +42,15 @@ HotStuffCore::HotStuffCore(ReplicaID id,
         tails{b0},
         vote_disabled(false),
         id(id),
-        storage(new EntityStorage()) {
+        prune_depth(0),
+        prune_max_bytes(0),
+        committed{b0},
+        avg_blk_bytes(0),
+        log_enabled(false),
+        storage(new EntityStorage()),
+        part_pruned(0),
+        part_reclaimed(0),
+        total_reclaimed(0) {
     storage->add_blk(b0);
 }
 
@@ -75,7 +85,7 @@ bool HotStuffCore::on_deliver_blk(const block_t &blk) {
     }
     blk->parents.clear();
     for (const auto &hash: blk->parent_hashes) {
-        if (!piped_queue.empty() && std::find(piped_queue.begin(), piped_queue.end(), hash) != piped_queue.end()) {
+        if (pipeline.contains(hash)) {
             block_t piped_block = storage->find_blk(hash);
             blk->parents.push_back(piped_block);
         }
@@ -179,13 +189,34 @@ void HotStuffCore::update(const block_t &nblk) {
     {
         const block_t &blk = *it;
         blk->decision = 1;
+        if (pruning())
+        {
+            committed.push_back(blk);
+            avg_blk_bytes = avg_blk_bytes == 0 ? blk->get_mem_size() :
+                            0.99 * avg_blk_bytes + 0.01 * blk->get_mem_size();
+        }
+        if (log_enabled)
+        {
+            log_chain(blk);
+            DataStream s;
+            s << (uint8_t)WAL_COMMIT << blk->get_hash();
+            do_log(std::move(s));
+        }
         do_consensus(blk);
         LOG_PROTO("commit %s", std::string(*blk).c_str());
         for (size_t i = 0; i < blk->cmds.size(); i++)
             do_decide(Finality(id, 1, i, blk->height,
                                 blk->cmds[i], blk->get_hash()));
     }
+    if (log_enabled)
+    {
+        /* below the new b_exec, the log needs them no more */
+        logged.erase(b_exec->get_hash());
+        for (size_t i = 1; i < commit_queue.size(); i++)
+            logged.erase(commit_queue[i]->get_hash());
+    }
     b_exec = blk;
+    if (pruning()) prune_cut();
 }
 
 block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
@@ -200,7 +231,7 @@ block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
     /* create the new block */
 
     block_t bnew;
-    if (piped_queue.empty()) {
+    if (pipeline.empty()) {
         LOG_PROTO("b_piped is null");
         bnew = storage->add_blk(
                 new Block(parents, cmds,
@@ -211,7 +242,7 @@ block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
                 ));
     } else {
         auto newParents = std::vector<block_t>(parents);
-        block_t piped_block = storage->find_blk(piped_queue.back());
+        block_t piped_block = storage->find_blk(pipeline.back());
 
         if (newParents[0]->height <= piped_block->height) {
             LOG_PROTO("b_piped is not null");
@@ -227,7 +258,7 @@ block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
                 ));
     }
 
-    b_normal_height = bnew->get_height();
+    pipeline.normal_height = bnew->get_height();
 
     LOG_PROTO("propose %s", std::string(*bnew).c_str());
     Proposal prop = process_block(bnew, true);
@@ -261,6 +292,7 @@ Proposal HotStuffCore::process_block(const block_t& bnew, bool adjustHeight)
             throw std::runtime_error("new block should be higher than vheight");
         vheight = bnew->height;
     }
+    log_state();
 
     if (storage->find_blk(bnew_hash) == nullptr) {
         LOG_PROTO("not in storage!");
@@ -268,9 +300,9 @@ Proposal HotStuffCore::process_block(const block_t& bnew, bool adjustHeight)
 
     LOG_PROTO("before On receive vote");
 
-    on_receive_vote(
-            Vote(id, bnew_hash,
-                 create_part_cert(*priv_key, bnew_hash), this));
+    async_create_part_cert(*priv_key, bnew_hash).then([this, bnew_hash](PartCert *pc) {
+        on_receive_vote(Vote(id, bnew_hash, part_cert_bt(pc), this));
+    });
     LOG_PROTO("after On receive vote");
     on_propose_(prop);
     LOG_PROTO("after on propose");
@@ -312,9 +344,11 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
 
     on_receive_proposal_(prop);
     if (opinion && !vote_disabled) {
-        do_vote(prop,
-                Vote(id, bnew->get_hash(),
-                     create_part_cert(*priv_key, bnew->get_hash()), this));
+        log_state();
+        const uint256_t bnew_hash = bnew->get_hash();
+        async_create_part_cert(*priv_key, bnew_hash).then([this, prop, bnew_hash](PartCert *pc) {
+            do_vote(prop, Vote(id, bnew_hash, part_cert_bt(pc), this));
+        });
     }
 }
 
@@ -343,16 +377,22 @@ void HotStuffCore::on_receive_vote(const Vote &vote) {
         LOG_WARN("vote for block not proposed by itself");
         qc = create_quorum_cert(blk->get_hash());
     }
+    /* the votes of the others may have completed it while signing */
+    if (qc->has_n(config.nmajority)) return;
 
     qc->add_part(config, vote.voter, *vote.cert);
     if (qc->has_n(config.nmajority))
     {
         qc->compute();
-        update_hqc(blk, qc);
-        on_qc_finish(blk);
+        finish_qc(blk);
     }
 }
 
+promise_t HotStuffCore::async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) {
+    PartCert *pc = create_part_cert(priv_key, blk_hash).unwrap();
+    return promise_t([pc](promise_t &pm) { pm.resolve(pc); });
+}
+
 /*** end HotStuff protocol logic ***/
 void HotStuffCore::on_init(uint32_t nfaulty) {
 
@@ -387,6 +427,204 @@ void HotStuffCore::prune(uint32_t staleness) {
     }
 }
 
+void HotStuffCore::prune_cut() {
+    /* the in-flight pipelined blocks and the 3-chain need a margin */
+    size_t min_keep = std::max(config.async_blocks, 0) + 10;
+    /* a depth of 0 keeps all, unless over the byte cap */
+    size_t keep = prune_depth ? std::max((size_t)prune_depth, min_keep) : committed.size();
+    if (prune_max_bytes && avg_blk_bytes > 0)
+    {
+        double excess = storage->get_blk_cache_size() - prune_max_bytes / avg_blk_bytes;
+        if (excess > 0)
+            keep = std::max(committed.size() - std::min((size_t)excess, committed.size()), min_keep);
+    }
+    if (committed.size() <= keep) return;
+    while (committed.size() > keep)
+        committed.pop_front();
+    /* the lowest kept block becomes the root, everything below is left to
+     * prune_step() */
+    const block_t &root = committed.front();
+    for (auto &p: root->parents)
+        prune_garbage.push_back(std::move(p));
+    root->parents.clear();
+    root->qc_ref = nullptr;
+    /* another chance for the blocks some later block still referred to */
+    for (auto &blk: prune_held)
+        prune_garbage.push_back(std::move(blk));
+    prune_held.clear();
+    schedule_prune();
+}
+
+void HotStuffCore::release_pruned(const block_t &blk) {
+    do_prune(blk);
+    qc_waiting.erase(blk);
+    tails.erase(blk);
+    proposal_time.erase(blk->get_hash());
+    stats.erase(blk->get_hash());
+    logged.erase(blk->get_hash());
+    size_t bytes = blk->get_mem_size();
+    if (storage->try_release_blk(blk))
+    {
+        part_pruned++;
+        part_reclaimed += bytes;
+        total_reclaimed += bytes;
+    }
+    else if (storage->find_blk(blk->get_hash()) == blk && blk != b0)
+        prune_held.push_back(blk);
+}
+
+bool HotStuffCore::prune_step(size_t budget) {
+    for (; budget && !prune_garbage.empty(); budget--)
+    {
+        block_t blk = std::move(prune_garbage.back());
+        prune_garbage.pop_back();
+        /* depth-first, a block goes after its parents are detached */
+        for (auto &p: blk->parents)
+            prune_garbage.push_back(std::move(p));
+        blk->parents.clear();
+        blk->qc_ref = nullptr;
+        blk->voted.clear();
+        release_pruned(blk);
+    }
+    return !prune_garbage.empty();
+}
+
+void HotStuffCore::log_chain(const block_t &blk) {
+    std::vector<block_t> chain;
+    for (block_t b = blk; b != b0 && !logged.count(b->get_hash());
+            b = b->parents[0])
+    {
+        chain.push_back(b);
+        if (b->parents.empty()) break;
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); it++)
+    {
+        const block_t &b = *it;
+        DataStream s;
+        s << (uint8_t)WAL_BLOCK << htole(b->height) << *b;
+        do_log(std::move(s));
+        logged.insert(b->get_hash());
+    }
+}
+
+bytearray_t HotStuffCore::state_record() const {
+    DataStream s;
+    s << (uint8_t)WAL_STATE << htole(vheight)
+      << b_lock->get_hash() << b_exec->get_hash()
+      << hqc.first->get_hash() << *hqc.second;
+    return std::move(s);
+}
+
+void HotStuffCore::log_state() {
+    if (!log_enabled) return;
+    log_chain(b_lock);
+    log_chain(hqc.first);
+    do_log(state_record());
+}
+
+std::vector<bytearray_t> HotStuffCore::log_snapshot() {
+    std::vector<block_t> blks;
+    for (const auto &hash: logged)
+    {
+        block_t blk = storage->find_blk(hash);
+        /* forks left below b_exec are dropped too */
+        if (blk && blk->height >= b_exec->height) blks.push_back(blk);
+    }
+    if (!logged.count(b_exec->get_hash()) && b_exec != b0)
+        blks.push_back(b_exec);
+    logged.clear();
+    for (const auto &blk: blks)
+        logged.insert(blk->get_hash());
+    /* parents go before their children */
+    std::sort(blks.begin(), blks.end(), BlockHeightCmp());
+    std::vector<bytearray_t> recs;
+    for (const auto &blk: blks)
+    {
+        DataStream s;
+        s << (uint8_t)WAL_BLOCK << htole(blk->height) << *blk;
+        recs.push_back(std::move(s));
+    }
+    for (const auto &blk: blks)
+    {
+        if (blk->decision != 1) continue;
+        DataStream s;
+        s << (uint8_t)WAL_COMMIT << blk->get_hash();
+        recs.push_back(std::move(s));
+    }
+    recs.push_back(state_record());
+    return recs;
+}
+
+size_t HotStuffCore::restore(const std::vector<bytearray_t> &recs) {
+    struct timeval start, end;
+    gettimeofday(&start, nullptr);
+    size_t nblks = 0, ncommits = 0;
+    for (const auto &rec: recs)
+    {
+        DataStream s(rec.data(), rec.data() + rec.size());
+        uint8_t type;
+        s >> type;
+        if (type == WAL_BLOCK)
+        {
+            uint32_t height;
+            Block _blk;
+            s >> height;
+            _blk.unserialize(s, this);
+            block_t blk = storage->find_blk(_blk.get_hash());
+            if (blk == nullptr)
+                blk = storage->add_blk(std::move(_blk), config);
+            if (blk->delivered) continue;
+            blk->height = letoh(height);
+            /* the chain starts at the oldest block in the log */
+            blk->parents.clear();
+            for (const auto &hash: blk->parent_hashes)
+            {
+                block_t p = storage->find_blk(hash);
+                if (p == nullptr || !p->delivered) break;
+                blk->parents.push_back(p);
+            }
+            blk->qc_ref = storage->find_blk(blk->qc->get_obj_hash());
+            for (const auto &p: blk->parents) tails.erase(p);
+            tails.insert(blk);
+            blk->delivered = true;
+            logged.insert(blk->get_hash());
+            nblks++;
+        }
+        else if (type == WAL_COMMIT)
+        {
+            uint256_t hash;
+            s >> hash;
+            block_t blk = storage->find_blk(hash);
+            if (blk == nullptr || blk->decision == 1) continue;
+            blk->decision = 1;
+            if (pruning()) committed.push_back(blk);
+            b_exec = blk;
+            ncommits++;
+        }
+        else if (type == WAL_STATE)
+        {
+            uint32_t _vheight;
+            uint256_t lock_hash, exec_hash, hqc_hash;
+            s >> _vheight >> lock_hash >> exec_hash >> hqc_hash;
+            quorum_cert_bt qc = parse_quorum_cert(s);
+            vheight = std::max(vheight, letoh(_vheight));
+            block_t blk;
+            if ((blk = storage->find_blk(lock_hash)) && blk->height >= b_lock->height)
+                b_lock = blk;
+            if ((blk = storage->find_blk(hqc_hash)) && blk->height > hqc.first->height)
+                hqc = std::make_pair(blk, std::move(qc));
+        }
+        else
+            throw HotStuffError("unknown log record %d", type);
+    }
+    gettimeofday(&end, nullptr);
+    LOG_INFO("recovered %lu blocks and %lu commits from %lu records in %.3f ms: %s",
+            nblks, ncommits, recs.size(),
+            (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) / 1e3,
+            std::string(*this).c_str());
+    return nblks;
+}
+
 void HotStuffCore::add_replica(ReplicaID rid, const PeerId &peer_id,
                                 pubkey_bt &&pub_key) {
     config.add_replica(rid,
@@ -424,6 +662,17 @@ void HotStuffCore::on_qc_finish(const block_t &blk) {
     }
 }
 
+void HotStuffCore::finish_qc(const block_t &blk) {
+    for (const auto &hash: pipeline.certify(blk->get_hash()))
+    {
+        block_t b = hash == blk->get_hash() ? blk : storage->find_blk(hash);
+        if (b != blk)
+            HOTSTUFF_LOG_PROTO("finish reordered piped block %s", get_hex10(hash).c_str());
+        update_hqc(b, b->self_qc);
+        on_qc_finish(b);
+    }
+}
+
 promise_t HotStuffCore::async_wait_proposal() {
     return propose_waiting.then([](const Proposal &prop) {
         return prop;
@@ -479,6 +728,7 @@ void HotStuffCore::set_fanout(int32_t fanout) {
 void HotStuffCore::set_piped_latency(int32_t piped_latency, int32_t async_blocks) {
     config.piped_latency = piped_latency;
     config.async_blocks = async_blocks;
+    pipeline.reserve(async_blocks + 2);
 }
 
 }
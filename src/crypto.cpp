@@ -27,6 +27,36 @@ namespace hotstuff {
     secp256k1_context_t secp256k1_default_sign_ctx = new Secp256k1Context(true);
     secp256k1_context_t secp256k1_default_verify_ctx = new Secp256k1Context(false);
 
+    HashPointCacheBLS bls_hash_points;
+    VeriLedgerBLS bls_veri_ledger;
+    TypedSlabPool<bls::G1Element> bls_g1_slab("bls g1");
+    TypedSlabPool<bls::G2Element> bls_g2_slab("bls g2");
+    SlabPool PubKeyBLS::slab("pubkey", sizeof(PubKeyBLS));
+    SlabPool SigSecBLSAgg::slab("sig", sizeof(SigSecBLSAgg));
+    SlabPool PartCertBLSAgg::slab("part cert", sizeof(PartCertBLSAgg));
+    SlabPool QuorumCertAggBLS::slab("qc", sizeof(QuorumCertAggBLS));
+
+    bls::G2Element HashPointCacheBLS::get(const uint256_t &msg) {
+        {
+            std::lock_guard<std::mutex> _(mlock);
+            auto it = points.find(msg);
+            if (it != points.end()) return it->second;
+        }
+        /* map outside the lock, a concurrent miss only costs a second map */
+        bls::G2Element point = bls::PopSchemeMPL::HashToPoint(arrToVec(msg.to_bytes()));
+        std::lock_guard<std::mutex> _(mlock);
+        if (points.insert(std::make_pair(msg, point)).second)
+        {
+            order.push_back(msg);
+            if (order.size() > capacity)
+            {
+                points.erase(order.front());
+                order.pop_front();
+            }
+        }
+        return point;
+    }
+
     QuorumCertSecp256k1::QuorumCertSecp256k1(
             const ReplicaConfig &config, const uint256_t &obj_hash) :
             QuorumCert(), obj_hash(obj_hash), rids(config.nreplicas) {
@@ -68,25 +98,215 @@ namespace hotstuff {
         });
     }
 
+    uint256_t VeriLedgerBLS::vote_key(const uint256_t &obj_hash,
+                                    const bls::G1Element &pub,
+                                    const bls::G2Element &sig) {
+        DataStream s;
+        s << obj_hash;
+        auto p = pub.Serialize();
+        auto g = sig.Serialize();
+        s.put_data(p.data(), p.data() + p.size());
+        s.put_data(g.data(), g.data() + g.size());
+        return s.get_hash();
+    }
+
+    uint256_t VeriLedgerBLS::qc_key(const uint256_t &obj_hash,
+                                    const salticidae::Bits &rids,
+                                    const bls::G2Element &sig) {
+        DataStream s;
+        s << obj_hash << rids;
+        auto g = sig.Serialize();
+        s.put_data(g.data(), g.data() + g.size());
+        return s.get_hash();
+    }
+
+    bool VeriLedgerBLS::has(const uint256_t &key) {
+        std::lock_guard<std::mutex> _(mlock);
+        return proven.count(key);
+    }
+
+    void VeriLedgerBLS::add(const uint256_t &key) {
+        std::lock_guard<std::mutex> _(mlock);
+        if (!proven.insert(key).second) return;
+        order.push_back(key);
+        if (order.size() > capacity)
+        {
+            proven.erase(order.front());
+            order.pop_front();
+        }
+    }
+
+    bool BLSVeriTask::verify_batch(const std::vector<BatchVeriTask *> &tasks) {
+        const size_t n = tasks.size();
+        std::unordered_map<const uint256_t, size_t> slots;
+        /* the points are arrays themselves, hence no vectors */
+        std::unique_ptr<g1_t[]> g1s(new g1_t[n + 1]);
+        std::unique_ptr<g2_t[]> g2s(new g2_t[n + 1]);
+        g1_t pub;
+        g2_t sig, sum;
+        bn_t r;
+        bn_new(r);
+        g2_set_infty(sum);
+
+        size_t m = 0;
+        for (auto t: tasks)
+        {
+            auto task = static_cast<BLSVeriTask *>(t);
+            uint64_t w = 0;
+            while (w == 0)
+                if (RAND_bytes((uint8_t *)&w, sizeof(w)) != 1)
+                    throw std::runtime_error("RAND_bytes failed");
+            bn_set_dig(r, w);
+            task->get_pub().ToNative(&pub);
+            g1_mul(pub, pub, r);
+            task->get_sig().ToNative(&sig);
+            g2_mul(sig, sig, r);
+            g2_add(sum, sum, sig);
+
+            auto it = slots.find(task->get_msg());
+            if (it == slots.end())
+            {
+                slots.insert(std::make_pair(task->get_msg(), m));
+                g1_copy(g1s[m], pub);
+                bls_hash_points.get(task->get_msg()).ToNative(&g2s[m]);
+                m++;
+            }
+            else
+                g1_add(g1s[it->second], g1s[it->second], pub);
+        }
+        bls::G1Element::Generator().Negate().ToNative(&g1s[m]);
+        g2_copy(g2s[m], sum);
+        m++;
+
+        /* the product of all pairings must be the unity, at most 250 per
+         * multi-pairing as in CoreMPL::NativeVerify */
+        gt_t res, tmp;
+        gt_set_unity(res);
+        for (size_t i = 0; i < m; i += 250)
+        {
+            pc_map_sim(tmp, g1s.get() + i, g2s.get() + i, std::min(m - i, (size_t)250));
+            gt_mul(res, res, tmp);
+        }
+        bool valid = gt_is_unity(res);
+
+        bn_free(r);
+        return valid;
+    }
+
     QuorumCertAggBLS::QuorumCertAggBLS(
             const ReplicaConfig &config, const uint256_t &obj_hash) :
             QuorumCert(), obj_hash(obj_hash), rids(config.nreplicas){
         rids.clear();
     }
 
+    std::string PubKeyAggCacheBLS::make_key(const salticidae::Bits &rids) {
+        std::string key((rids.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids[i] == 1) key[i >> 3] |= (char)(1 << (i & 7));
+        return key;
+    }
+
+    const bls::G1Affine &PubKeyAggCacheBLS::get(const ReplicaConfig &config, const salticidae::Bits &rids) {
+        std::string key = make_key(rids);
+        auto it = aggs.find(key);
+        if (it != aggs.end())
+        {
+            last_key = std::move(key);
+            last_rids = rids;
+            return it->second;
+        }
+
+        std::vector<size_t> added, removed;
+        size_t nset = 0;
+        auto lit = aggs.find(last_key);
+        for (size_t i = 0; i < rids.size(); i++)
+        {
+            if (rids[i] == 1) nset++;
+            if (lit == aggs.end() || i >= last_rids.size()) continue;
+            if (rids[i] == 1 && last_rids[i] == 0) added.push_back(i);
+            else if (rids[i] == 0 && last_rids[i] == 1) removed.push_back(i);
+        }
+
+        bls::G1Element agg = bls::G1Element::Infinity();
+        if (lit != aggs.end() && last_rids.size() == rids.size() &&
+            added.size() + removed.size() < nset)
+        {
+            /* patch the aggregate of the last bitmap */
+            agg = lit->second.GetElement();
+            for (size_t i: added)
+                agg = agg + *static_cast<const PubKeyBLS &>(config.get_pubkey(i)).data;
+            for (size_t i: removed)
+                agg = agg + static_cast<const PubKeyBLS &>(config.get_pubkey(i)).data->Negate();
+        }
+        else
+        {
+            for (size_t i = 0; i < rids.size(); i++)
+                if (rids[i] == 1)
+                    agg = agg + *static_cast<const PubKeyBLS &>(config.get_pubkey(i)).data;
+        }
+
+        if (order.size() >= capacity)
+        {
+            aggs.erase(order.front());
+            order.pop_front();
+        }
+        order.push_back(key);
+        auto &aff = aggs.emplace(key, bls::G1Affine(agg)).first->second;
+        last_key = std::move(key);
+        last_rids = rids;
+        return aff;
+    }
+
+    bool QuorumCertAggBLS::vote_proven(const ReplicaConfig &config, ReplicaID rid,
+                                        const bls::G2Element &sig) const {
+        const auto &pub = static_cast<const PubKeyBLS &>(config.get_pubkey(rid));
+        return bls_veri_ledger.has(VeriLedgerBLS::vote_key(obj_hash, *pub.data, sig));
+    }
+
+    void QuorumCertAggBLS::fold_pending() {
+        if (pending.empty()) return;
+        int k = 0;
+        g2_t pts[fold_batch];
+        g2_t acc;
+        /* the point at infinity (z = 0) would zero the shared inversion,
+         * and adds nothing anyway */
+        for (const auto &p: pending)
+        {
+            p.ToNative(&pts[k]);
+            if (!g2_is_infty(pts[k])) k++;
+        }
+        /* partial aggregates come out of projective additions: bring them
+         * to z = 1 together, with one inversion for the whole batch */
+        if (k) ep2_norm_sim(pts, pts, k);
+        if (agg == nullptr)
+            g2_set_infty(acc);
+        else
+            agg->ToNative(&acc);
+        for (int i = 0; i < k; i++)
+            g2_add(acc, acc, pts[i]);
+        if (agg == nullptr)
+            agg = bls_g2_slab.create(bls::G2Element::FromNative(&acc));
+        else
+            *agg = bls::G2Element::FromNative(&acc);
+        pending.clear();
+    }
+
     bool QuorumCertAggBLS::verify(const ReplicaConfig &config) {
         if (theSig == nullptr) return false;
         //HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",i, get_hex10(obj_hash).c_str());
 
+        if (n == 0) return false;
+        uint256_t key = VeriLedgerBLS::qc_key(obj_hash, rids, *theSig->data);
+        if (proven || bls_veri_ledger.has(key))
+        {
+            bls_veri_ledger.add(key);
+            return true;
+        }
+
         struct timeval timeStart,timeEnd;
         gettimeofday(&timeStart, nullptr);
 
-        vector<bls::G1Element> pubs;
-        for (unsigned int i = 0; i < rids.size(); i++) {
-            if (rids[i] == 1) {
-                pubs.push_back(*static_cast<const PubKeyBLS &>(config.get_pubkey(i)).data);
-            }
-        }
+        const bls::G1Affine &pub = config.bls_agg_pubs.get(config, rids);
 
         gettimeofday(&timeEnd, nullptr);
 
@@ -97,7 +317,7 @@ namespace hotstuff {
 
         gettimeofday(&timeStart, nullptr);
 
-        bool res = bls::PopSchemeMPL::FastAggregateVerify(pubs, arrToVec(obj_hash.to_bytes()), *theSig->data);
+        bool res = bls::PopSchemeMPL::VerifyAffine(pub, bls_hash_points.get(obj_hash), *theSig->data);
 
         gettimeofday(&timeEnd, nullptr);
 
@@ -105,33 +325,34 @@ namespace hotstuff {
                   << ((timeEnd.tv_sec - timeStart.tv_sec) * 1000000 + timeEnd.tv_usec - timeStart.tv_usec)
                   << " us to execute."
                   << std::endl;
-        
+
+        if (res) bls_veri_ledger.add(key);
         return res;
     }
 
     promise_t QuorumCertAggBLS::verify(const ReplicaConfig &config, VeriPool &vpool) {
         if (theSig == nullptr)
             return promise_t([](promise_t &pm) { pm.resolve(false); });
-        std::vector<promise_t> vpm;
-
-        struct timeval timeStart,timeEnd;
-        gettimeofday(&timeStart, nullptr);
-
-        vector<bls::G1Element> pubs;
-        for (unsigned int i = 0; i < rids.size(); i++) {
-            if (rids[i] == 1) {
-                pubs.push_back(*static_cast<const PubKeyBLS &>(config.get_pubkey(i)).data);
-            }
+        if (n == 0)
+            return promise_t([](promise_t &pm) { pm.resolve(false); });
+        uint256_t key = VeriLedgerBLS::qc_key(obj_hash, rids, *theSig->data);
+        if (proven || bls_veri_ledger.has(key))
+        {
+            bls_veri_ledger.add(key);
+            return promise_t([](promise_t &pm) { pm.resolve(true); });
         }
+        std::vector<promise_t> vpm;
 
+        const bls::G1Affine &pub = config.bls_agg_pubs.get(config, rids);
 
         //HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s", i, get_hex10(obj_hash).c_str());
 
-        vpm.push_back(vpool.verify(new SigVeriTaskBLSAgg(obj_hash, pubs, *theSig)));
+        vpm.push_back(vpool.verify(new SigVeriTaskBLSAgg(obj_hash, pub, *theSig)));
 
-        return promise::all(vpm).then([](const promise::values_t &values) {
+        return promise::all(vpm).then([key](const promise::values_t &values) {
             for (const auto &v: values)
                 if (!promise::any_cast<bool>(v)) return false;
+            bls_veri_ledger.add(key);
             return true;
         });
 
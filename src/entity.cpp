@@ -19,6 +19,8 @@
 
 namespace hotstuff {
 
+SlabPool Block::slab("block", sizeof(Block));
+
 void Block::serialize(DataStream &s) const {
     s << htole((uint32_t)parent_hashes.size());
     for (const auto &hash: parent_hashes)
@@ -29,6 +31,22 @@ void Block::serialize(DataStream &s) const {
     s << *qc << htole((uint32_t)extra.size()) << extra;
 }
 
+size_t Block::get_mem_size() const {
+    size_t size = sizeof(Block) + extra.capacity() +
+        (parent_hashes.capacity() + cmds.capacity()) * sizeof(uint256_t) +
+        parents.capacity() * sizeof(block_t) +
+        /* a node of the hash set per voter */
+        voted.size() * (sizeof(ReplicaID) + 2 * sizeof(void *));
+    for (const auto *cert: {&qc, &self_qc})
+    {
+        if (*cert == nullptr) continue;
+        DataStream s;
+        s << **cert;
+        size += s.size();
+    }
+    return size;
+}
+
 void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
     uint32_t n;
     s >> n;
@@ -0,0 +1,145 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "hotstuff/erasure.h"
+
+namespace hotstuff {
+
+/* GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 */
+struct GF256 {
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GF256() {
+        unsigned x = 1;
+        for (unsigned i = 0; i < 255; i++)
+        {
+            exp[i] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        for (unsigned i = 255; i < 512; i++)
+            exp[i] = exp[i - 255];
+        log[0] = 0;
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const {
+        if (a == 0 || b == 0) return 0;
+        return exp[log[a] + log[b]];
+    }
+
+    uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+static const GF256 gf;
+
+/* dst += c * src */
+static void mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+    if (c == 0) return;
+    const uint8_t lc = gf.log[c];
+    for (size_t i = 0; i < len; i++)
+        if (src[i]) dst[i] ^= gf.exp[gf.log[src[i]] + lc];
+}
+
+ReedSolomon::ReedSolomon(size_t k, size_t n): k(k), n(n) {
+    if (k == 0 || k > n || n > 256)
+        throw HotStuffError("invalid Reed-Solomon code (%lu, %lu)", k, n);
+    /* any k rows of [I; C] are independent for a Cauchy matrix C with
+     * distinct x_i = k + i, y_j = j */
+    parity.resize(n - k, std::vector<uint8_t>(k));
+    for (size_t i = 0; i < n - k; i++)
+        for (size_t j = 0; j < k; j++)
+            parity[i][j] = gf.inv((uint8_t)((k + i) ^ j));
+}
+
+std::vector<bytearray_t> ReedSolomon::encode(const bytearray_t &data) const {
+    const size_t clen = chunk_size(data.size());
+    std::vector<bytearray_t> chunks(n, bytearray_t(clen, 0));
+    for (size_t j = 0; j < k; j++)
+    {
+        size_t off = j * clen;
+        if (off < data.size())
+            memmove(chunks[j].data(), data.data() + off, std::min(clen, data.size() - off));
+    }
+    for (size_t i = 0; i < n - k; i++)
+        for (size_t j = 0; j < k; j++)
+            mul_add(chunks[k + i].data(), chunks[j].data(), parity[i][j], clen);
+    return chunks;
+}
+
+bool ReedSolomon::decode(const std::vector<std::pair<uint16_t, bytearray_t>> &chunks,
+                        size_t len, bytearray_t &data) const {
+    const size_t clen = chunk_size(len);
+    std::vector<const std::pair<uint16_t, bytearray_t> *> used;
+    std::vector<bool> seen(n, false);
+    for (const auto &c: chunks)
+    {
+        if (c.first >= n || seen[c.first] || c.second.size() != clen) continue;
+        seen[c.first] = true;
+        used.push_back(&c);
+        if (used.size() == k) break;
+    }
+    if (used.size() < k) return false;
+
+    /* the rows of the encoding matrix that produced the chunks at hand */
+    std::vector<std::vector<uint8_t>> m(k, std::vector<uint8_t>(k, 0));
+    std::vector<std::vector<uint8_t>> inv(k, std::vector<uint8_t>(k, 0));
+    for (size_t r = 0; r < k; r++)
+    {
+        uint16_t idx = used[r]->first;
+        if (idx < k) m[r][idx] = 1;
+        else m[r] = parity[idx - k];
+        inv[r][r] = 1;
+    }
+    /* Gauss-Jordan elimination */
+    for (size_t col = 0; col < k; col++)
+    {
+        size_t piv = col;
+        while (piv < k && m[piv][col] == 0) piv++;
+        if (piv == k) return false;
+        std::swap(m[piv], m[col]);
+        std::swap(inv[piv], inv[col]);
+        uint8_t s = gf.inv(m[col][col]);
+        for (size_t j = 0; j < k; j++)
+        {
+            m[col][j] = gf.mul(m[col][j], s);
+            inv[col][j] = gf.mul(inv[col][j], s);
+        }
+        for (size_t r = 0; r < k; r++)
+        {
+            if (r == col || m[r][col] == 0) continue;
+            uint8_t f = m[r][col];
+            for (size_t j = 0; j < k; j++)
+            {
+                m[r][j] ^= gf.mul(f, m[col][j]);
+                inv[r][j] ^= gf.mul(f, inv[col][j]);
+            }
+        }
+    }
+
+    data.assign(k * clen, 0);
+    for (size_t j = 0; j < k; j++)
+        for (size_t r = 0; r < k; r++)
+            mul_add(data.data() + j * clen, used[r]->second.data(), inv[j][r], clen);
+    data.resize(len);
+    return true;
+}
+
+}
@@ -31,11 +31,13 @@ using salticidae::static_pointer_cast;
 namespace hotstuff {
 
 const opcode_t MsgPropose::opcode;
-MsgPropose::MsgPropose(const Proposal &proposal) { serialized << proposal; }
+MsgPropose::MsgPropose(const Proposal &proposal, uint8_t tree): tree(tree) {
+    serialized << tree << proposal;
+}
 void MsgPropose::postponed_parse(HotStuffCore *hsc) {
     proposal.hsc = hsc;
     HOTSTUFF_LOG_PROTO("Size of the block: %lld", serialized.size());
-    serialized >> proposal;
+    serialized >> tree >> proposal;
 }
 
 const opcode_t MsgRelay::opcode;
@@ -68,9 +70,14 @@ MsgReqBlock::MsgReqBlock(DataStream &&s) {
 }
 
 const opcode_t MsgRespBlock::opcode;
-MsgRespBlock::MsgRespBlock(const std::vector<block_t> &blks) {
-    serialized << htole((uint32_t)blks.size());
+MsgRespBlock::MsgRespBlock(const std::vector<block_t> &blks,
+                        const std::vector<BlockStore::raw_t> &raw) {
+    serialized << htole((uint32_t)(blks.size() + raw.size()));
     for (auto blk: blks) serialized << *blk;
+    /* copied over from the mapped segments as they are, the blocks are
+     * not decoded and encoded again */
+    for (const auto &r: raw)
+        serialized.put_data(r.first, r.first + r.second);
 }
 
 void MsgRespBlock::postponed_parse(HotStuffCore *hsc) {
@@ -86,6 +93,164 @@ void MsgRespBlock::postponed_parse(HotStuffCore *hsc) {
     }
 }
 
+const opcode_t MsgPing::opcode;
+MsgPing::MsgPing(uint64_t sent_us, uint32_t resp_size):
+        sent_us(sent_us), resp_size(resp_size) {
+    serialized << htole(sent_us) << htole(resp_size);
+}
+
+MsgPing::MsgPing(DataStream &&s) {
+    s >> sent_us >> resp_size;
+    sent_us = letoh(sent_us);
+    resp_size = letoh(resp_size);
+}
+
+const opcode_t MsgPong::opcode;
+MsgPong::MsgPong(uint64_t sent_us, uint32_t resp_size,
+                const std::vector<std::pair<ReplicaID, uint32_t>> &vote_lats):
+        sent_us(sent_us), resp_size(resp_size), vote_lats(vote_lats) {
+    serialized << htole(sent_us) << htole(resp_size);
+    serialized << htole((uint32_t)vote_lats.size());
+    for (const auto &l: vote_lats)
+        serialized << htole(l.first) << htole(l.second);
+    /* the padding makes the probe measure the uplink of the responder */
+    serialized << bytearray_t(resp_size);
+}
+
+MsgPong::MsgPong(DataStream &&s) {
+    uint32_t size;
+    s >> sent_us >> resp_size >> size;
+    sent_us = letoh(sent_us);
+    resp_size = letoh(resp_size);
+    size = letoh(size);
+    vote_lats.resize(size);
+    for (auto &l: vote_lats)
+    {
+        s >> l.first >> l.second;
+        l.first = letoh(l.first);
+        l.second = letoh(l.second);
+    }
+}
+
+const opcode_t MsgTree::opcode;
+MsgTree::MsgTree(uint32_t epoch, const std::vector<ReplicaID> &order,
+                const std::vector<uint32_t> &fanouts,
+                const std::vector<uint256_t> &pending):
+        epoch(epoch), order(order), fanouts(fanouts), pending(pending) {
+    serialized << htole(epoch) << htole((uint32_t)order.size());
+    for (const auto &rid: order)
+        serialized << htole(rid);
+    serialized << htole((uint32_t)fanouts.size());
+    for (const auto &f: fanouts)
+        serialized << htole(f);
+    serialized << htole((uint32_t)pending.size());
+    for (const auto &h: pending)
+        serialized << h;
+}
+
+MsgTree::MsgTree(DataStream &&s) {
+    uint32_t size;
+    s >> epoch >> size;
+    epoch = letoh(epoch);
+    size = letoh(size);
+    order.resize(size);
+    for (auto &rid: order)
+    {
+        s >> rid;
+        rid = letoh(rid);
+    }
+    s >> size;
+    size = letoh(size);
+    fanouts.resize(size);
+    for (auto &f: fanouts)
+    {
+        s >> f;
+        f = letoh(f);
+    }
+    s >> size;
+    size = letoh(size);
+    pending.resize(size);
+    for (auto &h: pending) s >> h;
+}
+
+const opcode_t MsgChunk::opcode;
+MsgChunk::MsgChunk(const uint256_t &blk_hash, uint8_t tree, uint32_t len, bool relay,
+                const std::vector<std::pair<uint16_t, bytearray_t>> &chunks):
+        blk_hash(blk_hash), tree(tree), len(len), relay(relay), chunks(chunks) {
+    serialized << blk_hash << tree << htole(len) << (uint8_t)relay;
+    serialized << htole((uint32_t)chunks.size());
+    for (const auto &c: chunks)
+        serialized << htole(c.first) << htole((uint32_t)c.second.size()) << c.second;
+}
+
+MsgChunk::MsgChunk(DataStream &&s) {
+    uint8_t _relay;
+    uint32_t size;
+    s >> blk_hash >> tree >> len >> _relay >> size;
+    len = letoh(len);
+    relay = _relay;
+    size = letoh(size);
+    chunks.resize(size);
+    for (auto &c: chunks)
+    {
+        uint32_t clen;
+        s >> c.first >> clen;
+        c.first = letoh(c.first);
+        clen = letoh(clen);
+        auto base = s.get_data_inplace(clen);
+        c.second = bytearray_t(base, base + clen);
+    }
+}
+
+const opcode_t MsgReqSync::opcode;
+MsgReqSync::MsgReqSync(const uint256_t &anchor, uint32_t low, uint32_t high):
+        anchor(anchor), low(low), high(high) {
+    serialized << anchor << htole(low) << htole(high);
+}
+
+MsgReqSync::MsgReqSync(DataStream &&s) {
+    s >> anchor >> low >> high;
+    low = letoh(low);
+    high = letoh(high);
+}
+
+const opcode_t MsgReqVote::opcode;
+MsgReqVote::MsgReqVote(const uint256_t &blk_hash): blk_hash(blk_hash) {
+    serialized << blk_hash;
+}
+
+MsgReqVote::MsgReqVote(DataStream &&s) {
+    s >> blk_hash;
+}
+
+const opcode_t MsgRespSync::opcode;
+MsgRespSync::MsgRespSync(const uint256_t &anchor, uint32_t anchor_height,
+                        uint32_t low, uint32_t high,
+                        uint32_t nblks, const bytearray_t &payload):
+        anchor(anchor), anchor_height(anchor_height), low(low), high(high) {
+    serialized << anchor << htole(anchor_height)
+               << htole(low) << htole(high)
+               << htole(nblks) << payload;
+}
+
+void MsgRespSync::postponed_parse(HotStuffCore *hsc) {
+    uint32_t size;
+    serialized >> anchor >> anchor_height >> low >> high >> size;
+    anchor_height = letoh(anchor_height);
+    low = letoh(low);
+    high = letoh(high);
+    size = letoh(size);
+    blks.resize(size);
+    for (auto &b: blks)
+    {
+        Block _blk;
+        serialized >> b.first;
+        b.first = letoh(b.first);
+        _blk.unserialize(serialized, hsc);
+        b.second = hsc->storage->add_blk(std::move(_blk), hsc->get_config());
+    }
+}
+
 void HotStuffBase::exec_command(uint256_t cmd_hash, commit_cb_t callback) {
     cmd_pending.enqueue(std::make_pair(cmd_hash, callback));
 }
@@ -122,6 +287,7 @@ bool HotStuffBase::on_deliver_blk(const block_t &blk) {
         part_parent_size += blk->get_parent_hashes().size();
         part_delivered++;
         delivered++;
+        delivered_height = std::max(delivered_height, blk->get_height());
     }
     else
     {
@@ -176,7 +342,9 @@ promise_t HotStuffBase::async_fetch_blk(const uint256_t &blk_hash,
     return static_cast<promise_t &>(it->second);
 }
 
-promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash, const PeerId &replica) {
+promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
+                                        const PeerId &replica,
+                                        bool fetch_now) {
     if (storage->is_blk_delivered(blk_hash))
         return promise_t([this, &blk_hash](promise_t pm) {
             pm.resolve(storage->find_blk(blk_hash));
@@ -187,7 +355,17 @@ promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash, const PeerI
     BlockDeliveryContext pm{[](promise_t){}};
     it = blk_delivery_waiting.insert(std::make_pair(blk_hash, pm)).first;
     /* otherwise the on_deliver_batch will resolve */
-    async_fetch_blk(blk_hash, &replica).then([this, replica](block_t blk) {
+    async_fetch_blk(blk_hash, &replica, fetch_now).then([this, replica](block_t blk) {
+        /* a missing parent may be the first of many, catch up with them
+         * in ranges rather than one round trip each; how far below it is
+         * shows only once a replica proves to have it */
+        if (sync_batch)
+            for (const auto &phash: blk->get_parent_hashes())
+                if (!storage->is_blk_fetched(phash))
+                {
+                    start_sync(phash, replica);
+                    break;
+                }
         /* qc_ref should be fetched */
         std::vector<promise_t> pms;
         const auto &qc = blk->get_qc();
@@ -195,12 +373,20 @@ promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash, const PeerI
         if (blk == get_genesis())
             pms.push_back(promise_t([](promise_t &pm){ pm.resolve(true); }));
         else
+        {
+            VeriPool::LaneGuard _(vpool, VERI_BLOCK);
             pms.push_back(blk->verify(this, vpool));
-        pms.push_back(async_fetch_blk(qc->get_obj_hash(), &replica));
+        }
+        /* hold back only the fetches the catch-up answers, the others
+         * (e.g. a fork above it) go ahead */
+        const auto &qc_hash = qc->get_obj_hash();
+        pms.push_back(async_fetch_blk(qc_hash, &replica, !in_sync(qc_hash)));
         /* the parents should be delivered */
         for (const auto &phash: blk->get_parent_hashes())
-            pms.push_back(async_deliver_blk(phash, replica));
+            pms.push_back(async_deliver_blk(phash, replica, !in_sync(phash)));
         promise::all(pms).then([this, blk](const promise::values_t values) {
+            /* the catch-up may have delivered it meanwhile */
+            if (blk->is_delivered()) return;
             auto ret = promise::any_cast<bool>(values[0]) && this->on_deliver_blk(blk);
             if (!ret)
                 HOTSTUFF_LOG_WARN("verification failed during async delivery");
@@ -213,19 +399,34 @@ void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
     const PeerId &peer = conn->get_peer_id();
     if (peer.is_null()) return;
     auto stream = msg.serialized;
+    const auto &route = routes[msg.tree % routes.size()];
 
-    if (!childPeers.empty()) {
+    if (!route.children.empty()) {
         MsgPropose relay = MsgPropose(stream, true);
-        for (const PeerId &peerId : childPeers) {
-            pn.send_msg(relay, peerId);
+        for (const PeerId &peerId : route.children) {
+            send_msg(relay, peerId);
         }
     }
 
     msg.postponed_parse(this);
+    deliver_proposal(msg, peer);
+}
+
+void HotStuffBase::deliver_proposal(MsgPropose &msg, const PeerId &peer) {
     auto &prop = msg.proposal;
+    const auto &route = routes[msg.tree % routes.size()];
 
     block_t blk = prop.blk;
     if (!blk) return;
+    blk_tree[blk->get_hash()] = msg.tree % routes.size();
+
+    if ((tree_period > 0 || relay_policy == RELAY_DEADLINE) && !route.children.empty())
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        vote_wait_start[blk->get_hash()] = now;
+    }
+    relay_track(blk->get_hash());
 
     promise::all(std::vector<promise_t>{
         async_deliver_blk(blk->get_hash(), peer)
@@ -242,8 +443,9 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
     if (peer.is_null()) return;
     msg.postponed_parse(this);
     //HOTSTUFF_LOG_PROTO("received vote");
+    record_vote_arrival(msg.vote.voter, msg.vote.blk_hash);
 
-    if (id == pmaker->get_proposer() && !piped_queue.empty() && std::find(piped_queue.begin(), piped_queue.end(), msg.vote.blk_hash) != piped_queue.end()) {
+    if (id == pmaker->get_proposer() && pipeline.contains(msg.vote.blk_hash)) {
         HOTSTUFF_LOG_PROTO("piped block");
         block_t blk = storage->find_blk(msg.vote.blk_hash);
         if (!blk->delivered) {
@@ -254,10 +456,9 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
 
     block_t blk = get_potentially_not_delivered_blk(msg.vote.blk_hash);
 
-    if (!blk->delivered && blk->self_qc == nullptr) {
+    /* the own vote joins once it is signed (see add_own_part) */
+    if (blk->self_qc == nullptr) {
         blk->self_qc = create_quorum_cert(blk->get_hash());
-        part_cert_bt part = create_part_cert(*priv_key, blk->get_hash());
-        blk->self_qc->add_part(config, id, *part);
 
         std::cout << "create cert: " << msg.vote.blk_hash.to_hex() << " " << &blk->self_qc << std::endl;
     }
@@ -281,7 +482,9 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
     RcObj<Vote> v(new Vote(std::move(msg.vote)));
     promise::all(std::vector<promise_t>{
         async_deliver_blk(v->blk_hash, peer),
-        v->verify(vpool),
+        optimistic_verify ?
+            promise_t([](promise_t &pm) { pm.resolve(true); }) :
+            v->verify(vpool),
     }).then([this, blk, v=std::move(v), timeStart](const promise::values_t values) {
         if (!promise::any_cast<bool>(values[1]))
             LOG_WARN("invalid vote from %d", v->voter);
@@ -290,56 +493,67 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
 
       if (id != pmaker->get_proposer() ) {
 
-        if (cert->has_n(numberOfChildren + 1)) {
+        auto rit = relay_state.find(v->blk_hash);
+        if (rit != relay_state.end() && rit->second.forwarded) {
+          /* the partial aggregate already went up, send the late vote after it */
+          quorum_cert_bt delta = create_quorum_cert(v->blk_hash);
+          delta->add_part(config, v->voter, *v->cert);
+          cert->add_part(config, v->voter, *v->cert);
+          if (optimistic_verify)
+            opt_record(v->blk_hash, quorum_cert_bt(delta->clone()));
+          relay_delta(blk, std::move(delta));
+          return;
+        }
+
+        if (cert->has_n(get_route(v->blk_hash).nsubtree + 1)) {
           return;
         }
 
         cert->add_part(config, v->voter, *v->cert);
+        if (optimistic_verify) {
+          quorum_cert_bt part = create_quorum_cert(v->blk_hash);
+          part->add_part(config, v->voter, *v->cert);
+          opt_record(v->blk_hash, std::move(part));
+        }
 
-        if (!cert->has_n(numberOfChildren + 1)) {
+        if (!relay_ready(blk)) {
           return;
         }
         std::cout <<  " got enough votes: " << v->blk_hash.to_hex().c_str() <<  std::endl;
 
-        if (!piped_queue.empty()) {
-
-          for (auto hash = std::begin(piped_queue); hash != std::end(piped_queue); ++hash) {
-            block_t b = storage->find_blk(*hash);
-            if (b->delivered && b->qc->has_n(config.nmajority)) {
-              piped_queue.erase(hash);
-              HOTSTUFF_LOG_PROTO("Confirm Piped block");
-            }
-          }
-
-          if (blk->hash == piped_queue.front()){
-            piped_queue.pop_front();
-            HOTSTUFF_LOG_PROTO("Reset Piped block");
-          }
-          else {
-            HOTSTUFF_LOG_PROTO("Failed resetting piped block, wasn't front!!!");
-          }
+        if (pipeline.contains(blk->hash)) {
+          pipeline.erase(blk->hash);
+          HOTSTUFF_LOG_PROTO("Reset Piped block");
         }
 
         cert->compute();
-        if (!cert->verify(config)) {
+        if (!cert->verify(config) && (!opt_blame(blk) || !relay_ready(blk))) {
           HOTSTUFF_LOG_PROTO("Error, Invalid Sig!!!");
           return;
         }
 
         std::cout <<  " send relay message: " << v->blk_hash.to_hex().c_str() <<  std::endl;
-        pn.send_msg(MsgRelay(VoteRelay(v->blk_hash, blk->self_qc->clone(), this)), parentPeer);
+        relay_forward(blk);
         return;
       }
 
       cert->add_part(config, v->voter, *v->cert);
+      if (optimistic_verify) {
+        quorum_cert_bt part = create_quorum_cert(v->blk_hash);
+        part->add_part(config, v->voter, *v->cert);
+        opt_record(v->blk_hash, std::move(part));
+      }
       if (cert != nullptr && cert->get_obj_hash() == blk->get_hash()) {
         if (cert->has_n(config.nmajority)) {
           cert->compute();
-          if (id != 0 && !cert->verify(config)) {
-            throw std::runtime_error("Invalid Sigs in intermediate signature!");
+          if ((optimistic_verify || id != 0) && !cert->verify(config)) {
+            if (!optimistic_verify)
+              throw std::runtime_error("Invalid Sigs in intermediate signature!");
+            /* wait for more votes if the valid ones fall short */
+            if (!opt_blame(blk) || !blk->self_qc->has_n(config.nmajority)) return;
           }
-          update_hqc(blk, cert);
-          on_qc_finish(blk);
+          opt_parts.erase(blk->get_hash());
+          finish_qc(blk);
         }
       }
 
@@ -378,8 +592,11 @@ void HotStuffBase::vote_relay_handler(MsgRelay &&msg, const Net::conn_t &conn) {
     if (peer.is_null()) return;
     msg.postponed_parse(this);
     //std::cout << "vote relay handler: " << msg.vote.blk_hash.to_hex() << std::endl;
+    auto rit = peer_rids.find(peer);
+    if (rit != peer_rids.end())
+        record_vote_arrival(rit->second, msg.vote.blk_hash);
 
-    if (id == pmaker->get_proposer() && !piped_queue.empty() && std::find(piped_queue.begin(), piped_queue.end(), msg.vote.blk_hash) != piped_queue.end()) {
+    if (id == pmaker->get_proposer() && pipeline.contains(msg.vote.blk_hash)) {
         HOTSTUFF_LOG_PROTO("piped block");
         block_t blk = storage->find_blk(msg.vote.blk_hash);
         if (!blk->delivered) {
@@ -389,43 +606,14 @@ void HotStuffBase::vote_relay_handler(MsgRelay &&msg, const Net::conn_t &conn) {
     }
 
     block_t blk = get_potentially_not_delivered_blk(msg.vote.blk_hash);
-    if (!blk->delivered && blk->self_qc == nullptr) {
+    if (blk->self_qc == nullptr) {
         blk->self_qc = create_quorum_cert(blk->get_hash());
-        part_cert_bt part = create_part_cert(*priv_key, blk->get_hash());
-        blk->self_qc->add_part(config, id, *part);
 
         std::cout << "create cert: " << msg.vote.blk_hash.to_hex() << " " << &blk->self_qc << std::endl;
     }
 
     if (blk->self_qc->has_n(config.nmajority)) {
         std::cout << "bye vote relay handler: " << msg.vote.blk_hash.to_hex() << " " << &blk->self_qc << std::endl;
-        if (id == pmaker->get_proposer() && blk->hash == piped_queue.front()) {
-            piped_queue.pop_front();
-            HOTSTUFF_LOG_PROTO("Reset Piped block");
-
-            if (!rdy_queue.empty()) {
-                auto curr_blk = blk;
-                bool foundChildren = true;
-                while (foundChildren) {
-                    foundChildren = false;
-                    for (const auto &hash : rdy_queue) {
-                        block_t rdy_blk = storage->find_blk(hash);
-                        if (rdy_blk->get_parent_hashes()[0] == curr_blk->hash) {
-                            HOTSTUFF_LOG_PROTO("Resolved block in rdy queue %s", hash.to_hex().c_str());
-                            rdy_queue.erase(std::find(rdy_queue.begin(), rdy_queue.end(), hash));
-                            piped_queue.erase(std::find(piped_queue.begin(), piped_queue.end(), hash));
-
-                            update_hqc(rdy_blk, rdy_blk->self_qc);
-                            on_qc_finish(rdy_blk);
-                            foundChildren = true;
-                            curr_blk = rdy_blk;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-
         /*if (id == get_pace_maker()->get_proposer()) {
             gettimeofday(&timeEnd, NULL);
             long usec = ((timeEnd.tv_sec - timeStart.tv_sec) * 1000000 + timeEnd.tv_usec - timeStart.tv_usec);
@@ -439,9 +627,13 @@ void HotStuffBase::vote_relay_handler(MsgRelay &&msg, const Net::conn_t &conn) {
 
     //auto &vote = msg.vote;
     RcObj<VoteRelay> v(new VoteRelay(std::move(msg.vote)));
+    /* the aggregates of the subtrees complete the round, check them first */
+    VeriPool::LaneGuard _(vpool, VERI_QC);
     promise::all(std::vector<promise_t>{
             async_deliver_blk(v->blk_hash, peer),
-            v->cert->verify(config, vpool),
+            optimistic_verify ?
+                promise_t([](promise_t &pm) { pm.resolve(true); }) :
+                v->cert->verify(config, vpool),
     }).then([this, blk, v=std::move(v), timeStart](const promise::values_t& values) {
         struct timeval timeEnd;
 
@@ -451,22 +643,36 @@ void HotStuffBase::vote_relay_handler(MsgRelay &&msg, const Net::conn_t &conn) {
         std::cout << "got relay and verified" << std::endl;
 
         if (cert != nullptr && cert->get_obj_hash() == blk->get_hash() && !cert->has_n(config.nmajority)) {
-            if (id != pmaker->get_proposer() && cert->has_n(numberOfChildren + 1))
+            if (id != pmaker->get_proposer())
             {
-                return;
+                auto rit = relay_state.find(v->blk_hash);
+                if (rit != relay_state.end() && rit->second.forwarded)
+                {
+                    /* pass the late aggregate of a subtree on as a delta */
+                    if (!merge_or_request(blk, *v->cert)) return;
+                    if (optimistic_verify)
+                        opt_record(v->blk_hash, quorum_cert_bt(v->cert->clone()));
+                    relay_delta(blk, quorum_cert_bt(v->cert->clone()));
+                    return;
+                }
+                if (cert->has_n(get_route(v->blk_hash).nsubtree + 1)) return;
             }
 
-            cert->merge_quorum(*v->cert);
+            if (!merge_or_request(blk, *v->cert)) return;
+            if (optimistic_verify)
+                opt_record(v->blk_hash, quorum_cert_bt(v->cert->clone()));
 
             std::cout << "merge quorum " << std::endl;
             if (id != pmaker->get_proposer()) {
-                if (!cert->has_n(numberOfChildren + 1)) return;
+                if (!relay_ready(blk)) return;
                 cert->compute();
                 if (!cert->verify(config)) {
-                    throw std::runtime_error("Invalid Sigs in intermediate signature!");
+                    if (!opt_blame(blk))
+                        throw std::runtime_error("Invalid Sigs in intermediate signature!");
+                    if (!relay_ready(blk)) return;
                 }
                 std::cout << "Send Vote Relay: " << v->blk_hash.to_hex() << std::endl;
-                pn.send_msg(MsgRelay(VoteRelay(v->blk_hash, cert.get()->clone(), this)), parentPeer);
+                relay_forward(blk);
                 return;
             }
 
@@ -484,67 +690,15 @@ void HotStuffBase::vote_relay_handler(MsgRelay &&msg, const Net::conn_t &conn) {
             }
 
             cert->compute();
-            if (!cert->verify(config)) {
+            if (!cert->verify(config) &&
+                (!opt_blame(blk) || !cert->has_n(config.nmajority))) {
                 HOTSTUFF_LOG_PROTO("Error, Invalid Sig!!!");
                 return;
             }
+            opt_parts.erase(blk->get_hash());
 
-            if (!piped_queue.empty()) {
-                if (blk->hash == piped_queue.front()) {
-                    piped_queue.pop_front();
-                    HOTSTUFF_LOG_PROTO("Reset Piped block");
-
-                    std::cout << "go to town: " << std::endl;
-
-                    update_hqc(blk, cert);
-                    on_qc_finish(blk);
-
-                    if (!rdy_queue.empty()) {
-                        auto curr_blk = blk;
-                        bool foundChildren = true;
-                        while (foundChildren) {
-                            foundChildren = false;
-                            for (const auto &hash : rdy_queue) {
-                                block_t rdy_blk = storage->find_blk(hash);
-                                if (rdy_blk->get_parent_hashes()[0] == curr_blk->hash) {
-                                    HOTSTUFF_LOG_PROTO("Resolved block in rdy queue %s", hash.to_hex().c_str());
-                                    rdy_queue.erase(std::find(rdy_queue.begin(), rdy_queue.end(), hash));
-                                    piped_queue.erase(std::find(piped_queue.begin(), piped_queue.end(), hash));
-
-                                    update_hqc(rdy_blk, rdy_blk->self_qc);
-                                    on_qc_finish(rdy_blk);
-                                    foundChildren = true;
-                                    curr_blk = rdy_blk;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-                else {
-                    auto place = std::find(piped_queue.begin(), piped_queue.end(), blk->hash);
-                    if (place != piped_queue.end()) {
-                        HOTSTUFF_LOG_PROTO("Failed resetting piped block, wasn't front! Adding to rdy_queue %s", blk->hash.to_hex().c_str());
-                        rdy_queue.push_back(blk->hash);
-
-                        // Don't finish this block until the previous one was finished.
-                        return;
-                    }
-                    else {
-                        std::cout << "go to town: " << std::endl;
-
-                        update_hqc(blk, cert);
-                        on_qc_finish(blk);
-                    }
-                }
-            }
-            else
-            {
-                std::cout << "go to town: " << std::endl;
-
-                update_hqc(blk, cert);
-                on_qc_finish(blk);
-            }
+            std::cout << "go to town: " << std::endl;
+            finish_qc(blk);
             
             /*if (id == get_pace_maker()->get_proposer()) {
                 gettimeofday(&timeEnd, NULL);
@@ -585,16 +739,27 @@ void HotStuffBase::req_blk_handler(MsgReqBlock &&msg, const Net::conn_t &conn) {
     if (replica.is_null()) return;
     auto &blk_hashes = msg.blk_hashes;
     std::vector<promise_t> pms;
+    std::vector<uint256_t> stored;
     for (const auto &h: blk_hashes)
-        pms.push_back(async_fetch_blk(h, nullptr));
-    promise::all(pms).then([replica, this](const promise::values_t values) {
+    {
+        /* pruned from memory, but still on disk */
+        if (blk_store && !storage->is_blk_fetched(h) && blk_store->contains(h))
+            stored.push_back(h);
+        else
+            pms.push_back(async_fetch_blk(h, nullptr));
+    }
+    promise::all(pms).then([replica, this, stored=std::move(stored)](const promise::values_t values) {
         std::vector<block_t> blks;
         for (auto &v: values)
         {
             auto blk = promise::any_cast<block_t>(v);
             blks.push_back(blk);
         }
-        pn.send_msg(MsgRespBlock(blks), replica);
+        std::vector<BlockStore::raw_t> raw;
+        for (const auto &h: stored)
+            raw.push_back(blk_store->get_raw(h));
+        part_store_served += raw.size();
+        send_msg(MsgRespBlock(blks, raw), replica);
     });
 }
 
@@ -604,238 +769,1746 @@ void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &) {
         if (blk) on_fetch_blk(blk);
 }
 
-bool HotStuffBase::conn_handler(const salticidae::ConnPool::conn_t &conn, bool connected) {
-    if (connected)
+void HotStuffBase::req_sync_handler(MsgReqSync &&msg, const Net::conn_t &conn) {
+    const PeerId peer = conn->get_peer_id();
+    if (peer.is_null()) return;
+    /* a storm of replicas catching up must not starve the live tree */
+    if (sync_backlog.size() >= 64)
     {
-        auto cert = conn->get_peer_cert();
-        //SALTICIDAE_LOG_INFO("%s", salticidae::get_hash(cert->get_der()).to_hex().c_str());
-        return (!cert) || valid_tls_certs.count(salticidae::get_hash(cert->get_der()));
+        LOG_WARN("sync backlog full, dropping a request");
+        return;
     }
-    return true;
+    sync_backlog.push_back(std::make_pair(peer, std::move(msg)));
+    serve_sync();
 }
 
-void HotStuffBase::print_stat() const {
-    LOG_INFO("===== begin stats =====");
-    LOG_INFO("-------- queues -------");
-    LOG_INFO("blk_fetch_waiting: %lu", blk_fetch_waiting.size());
-    LOG_INFO("blk_delivery_waiting: %lu", blk_delivery_waiting.size());
-    LOG_INFO("decision_waiting: %lu", decision_waiting.size());
-    LOG_INFO("-------- misc ---------");
-    LOG_INFO("fetched: %lu", fetched);
-    LOG_INFO("delivered: %lu", delivered);
-    LOG_INFO("cmd_cache: %lu", storage->get_cmd_cache_size());
-    LOG_INFO("blk_cache: %lu", storage->get_blk_cache_size());
-    LOG_INFO("------ misc (10s) -----");
-    LOG_INFO("fetched: %lu", part_fetched);
-    LOG_INFO("delivered: %lu", part_delivered);
-    LOG_INFO("decided: %lu", part_decided);
-    LOG_INFO("gened: %lu", part_gened);
-    LOG_INFO("avg. parent_size: %.3f",
-            part_delivered ? part_parent_size / double(part_delivered) : 0);
-    LOG_INFO("delivery time: %.3f avg, %.3f min, %.3f max",
-            part_delivered ? part_delivery_time / double(part_delivered) : 0,
-            part_delivery_time_min == double_inf ? 0 : part_delivery_time_min,
-            part_delivery_time_max);
-
-    part_parent_size = 0;
-    part_fetched = 0;
-    part_delivered = 0;
-    part_decided = 0;
-    part_gened = 0;
-    part_delivery_time = 0;
-    part_delivery_time_min = double_inf;
-    part_delivery_time_max = 0;
-#ifdef HOTSTUFF_MSG_STAT
-    LOG_INFO("--- replica msg. (10s) ---");
-    size_t _nsent = 0;
-    size_t _nrecv = 0;
-    for (const auto &replica: peers)
+void HotStuffBase::serve_sync() {
+    if (sync_serve_rate > 0)
     {
-        try {
-            auto conn = pn.get_peer_conn(replica);
-            if (conn == nullptr) continue;
-            size_t ns = conn->get_nsent();
-            size_t nr = conn->get_nrecv();
-            size_t nsb = conn->get_nsentb();
-            size_t nrb = conn->get_nrecvb();
-            conn->clear_msgstat();
-            LOG_INFO("%s: %u(%u), %u(%u), %u",
-                     get_hex10(replica).c_str(), ns, nsb, nr, nrb, part_fetched_replica[replica]);
-            _nsent += ns;
-            _nrecv += nr;
-            part_fetched_replica[replica] = 0;
-        }
-        catch (...) { }
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        double elapsed = (now.tv_sec - sync_refill.tv_sec) +
+                        (now.tv_usec - sync_refill.tv_usec) / 1e6;
+        sync_refill = now;
+        /* bursts of up to a tenth of a second */
+        sync_tokens = std::min(sync_tokens + elapsed * sync_serve_rate,
+                                sync_serve_rate / 10);
     }
-    nsent += _nsent;
-    nrecv += _nrecv;
-    LOG_INFO("sent: %lu", _nsent);
-    LOG_INFO("recv: %lu", _nrecv);
-    LOG_INFO("--- replica msg. total ---");
-    LOG_INFO("sent: %lu", nsent);
-    LOG_INFO("recv: %lu", nrecv);
-#endif
-    LOG_INFO("====== end stats ======");
-}
-
-HotStuffBase::HotStuffBase(uint32_t blk_size,
-                    ReplicaID rid,
-                    privkey_bt &&priv_key,
-                    NetAddr listen_addr,
-                    pacemaker_bt pmaker,
-                    EventContext ec,
-                    size_t nworker,
-                    const Net::Config &netconfig):
-        HotStuffCore(rid, std::move(priv_key)),
-        listen_addr(listen_addr),
-        blk_size(blk_size),
-        ec(ec),
-        tcall(ec),
-        vpool(ec, nworker),
-        pn(ec, netconfig),
-        pmaker(std::move(pmaker)),
-
-        fetched(0), delivered(0),
-        nsent(0), nrecv(0),
-        part_parent_size(0),
-        part_fetched(0),
-        part_delivered(0),
-        part_decided(0),
-        part_gened(0),
-        part_delivery_time(0),
-        part_delivery_time_min(double_inf),
-        part_delivery_time_max(0)
-{
-    /* register the handlers for msg from replicas */
-    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_handler, this, _1, _2));
-    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_handler, this, _1, _2));
-    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_blk_handler, this, _1, _2));
-    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_blk_handler, this, _1, _2));
-    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_relay_handler, this, _1, _2));
-    pn.reg_conn_handler(salticidae::generic_bind(&HotStuffBase::conn_handler, this, _1, _2));
-    pn.start();
-    pn.listen(listen_addr);
-}
-
-void HotStuffBase::do_broadcast_proposal(const Proposal &prop) {
-    pn.multicast_msg(MsgPropose(prop), std::vector(childPeers.begin(), childPeers.end()));
+    /* no answer beyond a burst, or a single one would overdraw the
+     * bucket for seconds */
+    size_t max_bytes = sync_serve_rate > 0 ? sync_serve_rate / 10 : SIZE_MAX;
+    while (!sync_backlog.empty() && (sync_serve_rate <= 0 || sync_tokens > 0))
+    {
+        auto req = std::move(sync_backlog.front());
+        sync_backlog.pop_front();
+        sync_tokens -= serve_sync_req(req.first, req.second, max_bytes);
+    }
+    if (!sync_backlog.empty())
+        sync_serve_timer.add(-sync_tokens / sync_serve_rate + 1e-3);
 }
 
-void HotStuffBase::do_vote(Proposal prop, const Vote &vote) {
-    //HOTSTUFF_LOG_PROTO("do vote");
-
-    pmaker->beat_resp(prop.proposer).then([this, vote, prop](ReplicaID proposer) {
-
-        if (proposer == get_id())
+size_t HotStuffBase::serve_sync_req(const PeerId &peer, const MsgReqSync &msg,
+                                    size_t max_bytes) {
+    block_t blk = storage->find_blk(msg.anchor);
+    uint32_t anchor_height = blk && blk->is_delivered() ? blk->get_height() : 0;
+    DataStream payload;
+    uint32_t n = 0;
+    if (anchor_height && msg.low <= msg.high)
+    {
+        uint32_t high = std::min(msg.high, anchor_height);
+        /* the highest blocks of the range, the requester asks for the rest */
+        uint32_t low = std::max(msg.low, high >= sync_max_blocks ? high - sync_max_blocks + 1 : 0);
+        uint32_t lowest = high + 1;
+        /* at least one block, whatever its size */
+        auto full = [&]() { return n && payload.size() >= max_bytes; };
+        for (; blk; blk = blk->parents.empty() ? nullptr : blk->parents[0])
         {
-            throw HotStuffError("unreachable line");
-        }
-
-        if (childPeers.empty()) {
-            //HOTSTUFF_LOG_PROTO("send vote");
-            pn.send_msg(MsgVote(vote), parentPeer);
-        } else {
-            block_t blk = get_delivered_blk(vote.blk_hash);
-            if (blk->self_qc == nullptr)
+            if (blk->height < low || full()) break;
+            if (blk->height <= high)
             {
-                //HOTSTUFF_LOG_PROTO("create cert");
-                blk->self_qc = create_quorum_cert(prop.blk->get_hash());
-                blk->self_qc->add_part(config, vote.voter, *vote.cert);
+                payload << htole(blk->height) << *blk;
+                n++;
             }
+            lowest = blk->height;
         }
-    });
+        /* below the pruned chain, the committed blocks are on disk */
+        if (blk == nullptr && blk_store)
+            for (uint32_t h = std::min(lowest, high + 1); h-- > low && !full();)
+            {
+                auto raw = blk_store->get_raw_by_height(h);
+                if (!raw.first) break;
+                payload << htole(h);
+                payload.put_data(raw.first, raw.first + raw.second);
+                n++;
+            }
+    }
+    bytearray_t data = std::move(payload);
+    send_msg(MsgRespSync(msg.anchor, anchor_height, msg.low, msg.high, n, data), peer);
+    part_sync_served++;
+    part_sync_served_blks += n;
+    return data.size();
 }
 
-void HotStuffBase::do_consensus(const block_t &blk) {
-    pmaker->on_consensus(blk);
+void HotStuffBase::start_sync(const uint256_t &anchor, const PeerId &origin) {
+    if (sync_active) return;
+    sync_active = true;
+    sync.anchor = anchor;
+    sync.origin = origin;
+    sync.anchor_height = 0;
+    /* the blocks below are here already */
+    sync.next = delivered_height + 1;
+    /* the top of the range is the anchor, whatever its height */
+    sync.todo.clear();
+    sync.todo.push_back(std::make_pair(sync.next, UINT32_MAX));
+    sync.inflight.clear();
+    sync.unlinked.clear();
+    sync.linked = 0;
+    sync.bad.clear();
+    sync.blks.clear();
+    sync.delivering = false;
+    sync.nretries = 0;
+    sync.ndelivered = 0;
+    gettimeofday(&sync.start, nullptr);
+    LOG_INFO("catching up from height %u to %.10s",
+            sync.next, get_hex(anchor).c_str());
+    sync_request();
+    sync_timer.add(sync_timeout / 2);
 }
 
-void HotStuffBase::do_decide(Finality &&fin) {
-    part_decided++;
-    state_machine_execute(fin);
-    auto it = decision_waiting.find(fin.cmd_hash);
-    if (it != decision_waiting.end())
+void HotStuffBase::sync_request() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    while (sync.inflight.size() < sync_parallel && !sync.todo.empty())
     {
-        it->second(std::move(fin));
-        decision_waiting.erase(it);
+        auto range = sync.todo.front();
+        sync.todo.pop_front();
+        /* spread over the replicas but the one that sent the proposal,
+         * which is busy leading, and those that answered off the chain;
+         * they are only the last resort */
+        PeerId peer;
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            peer = peers[sync_peer++ % peers.size()];
+            if (!sync.bad.count(peer) &&
+                (peer != sync.origin || sync.nretries >= peers.size() - 1))
+                break;
+        }
+        sync.inflight[range.first] = SyncRange{range.second, peer, now};
+        send_msg(MsgReqSync(sync.anchor, range.first, range.second), peer);
     }
 }
 
-HotStuffBase::~HotStuffBase() {}
-
-void HotStuffBase::start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas, bool ec_loop) {
-
-    std::set<uint16_t> children;
-    auto size = replicas.size();
-
-    childPeers.clear();
-    for (size_t i = 0; i < size; i++) {
+void HotStuffBase::resp_sync_handler(MsgRespSync &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    msg.postponed_parse(this);
+    if (!sync_active || msg.anchor != sync.anchor) return;
+    auto it = sync.inflight.find(msg.low);
+    if (it == sync.inflight.end() || it->second.high != msg.high) return;
+    sync.inflight.erase(it);
+    if (!msg.anchor_height)
+    {
+        /* the replica does not have the anchor (yet), ask another one */
+        if (++sync.nretries > sync_max_retries)
+        {
+            end_sync(false);
+            return;
+        }
+        sync.todo.push_front(std::make_pair(msg.low, msg.high));
+        sync_request();
+        return;
+    }
 
-        auto cert_hash = std::move(std::get<2>(replicas[i]));
-        salticidae::PeerId peer{cert_hash};
-        valid_tls_certs.insert(cert_hash);
-        auto &addr = std::get<0>(replicas[i]);
+    /* the highest blocks of the range, each the first parent of the one
+     * above; the heights are as claimed until they link to the anchor */
+    uint32_t top = std::min(msg.high, msg.anchor_height);
+    SyncAnswer ans{{}, peer};
+    bool chained = true;
+    for (const auto &b: msg.blks)
+    {
+        if (b.first < msg.low) break;
+        if (b.second == nullptr || b.first != top - ans.blks.size() ||
+            (!ans.blks.empty() &&
+                (ans.blks.back()->get_parent_hashes().empty() ||
+                ans.blks.back()->get_parent_hashes()[0] != b.second->get_hash())))
+        {
+            chained = false;
+            break;
+        }
+        ans.blks.push_back(b.second);
+        if (b.first == msg.low) break;
+    }
+    /* the first request asks for the anchor itself on top */
+    bool probe = msg.high == UINT32_MAX;
+    if (!chained || (probe && !ans.blks.empty() &&
+                    ans.blks[0]->get_hash() != sync.anchor))
+    {
+        if (sync_reject(msg.low, msg.high, peer)) sync_request();
+        return;
+    }
+    uint32_t lowest = top + 1 - ans.blks.size();
+    if (lowest > msg.low)
+    {
+        /* a partial answer, or none from a replica that pruned the blocks */
+        if (ans.blks.empty() && ++sync.nretries > sync_max_retries)
+        {
+            end_sync(false);
+            return;
+        }
+        uint32_t batch = std::min(sync_batch, sync_max_blocks);
+        for (uint32_t l = msg.low; l < lowest; l += batch)
+            sync.todo.push_back(std::make_pair(l, std::min(l + batch - 1, lowest - 1)));
+        std::sort(sync.todo.begin(), sync.todo.end());
+    }
+    if (!ans.blks.empty())
+    {
+        sync.unlinked[top] = std::move(ans);
+        sync_link();
+        if (!sync_active) return;
+    }
+    sync_request();
+    sync_deliver();
+}
+
+void HotStuffBase::sync_link() {
+    bool found = false;
+    if (!sync.linked)
+    {
+        /* nothing trusted before the answer with the anchor on top */
+        auto it = sync.unlinked.begin();
+        while (it != sync.unlinked.end() &&
+                it->second.blks[0]->get_hash() != sync.anchor) it++;
+        if (it == sync.unlinked.end()) return;
+        sync.anchor_height = it->first;
+        sync.linked = it->first + 1;
+        sync.expect = sync.anchor;
+        /* answers above the anchor are off the chain */
+        sync.unlinked.erase(std::next(it), sync.unlinked.end());
+        found = true;
+    }
+    while (!sync.unlinked.empty() && sync.linked > sync.next)
+    {
+        auto it = std::prev(sync.unlinked.end());
+        uint32_t top = it->first;
+        auto &blks = it->second.blks;
+        /* overlapping an answer linked already */
+        if (top >= sync.linked)
+        {
+            size_t over = top - sync.linked + 1;
+            if (over < blks.size())
+            {
+                SyncAnswer rest{std::vector<block_t>(blks.begin() + over, blks.end()),
+                                it->second.peer};
+                sync.unlinked.erase(it);
+                sync.unlinked[top - over] = std::move(rest);
+            }
+            else
+                sync.unlinked.erase(it);
+            continue;
+        }
+        /* waiting for the ones in between */
+        if (top + 1 < sync.linked) break;
+        if (blks[0]->get_hash() != sync.expect)
+        {
+            PeerId peer = it->second.peer;
+            uint32_t low = top + 1 - blks.size();
+            sync.unlinked.erase(it);
+            if (!sync_reject(low, top, peer)) return;
+            continue;
+        }
+        for (const auto &blk: blks)
+            sync.blks[--sync.linked] = blk;
+        const auto &parents = blks.back()->get_parent_hashes();
+        sync.expect = parents.empty() ? uint256_t() : parents[0];
+        sync.unlinked.erase(it);
+    }
+    if (found)
+    {
+        if (sync.anchor_height <= sync.next - 1 + sync_min_gap)
+        {
+            /* within the pipeline, the rest is fetched one by one */
+            end_sync(true);
+            return;
+        }
+        LOG_INFO("the anchor is at height %u", sync.anchor_height);
+    }
+}
+
+bool HotStuffBase::sync_reject(uint32_t low, uint32_t high, const PeerId &peer) {
+    LOG_WARN("blocks %u to %u caught up with are off the chain of the anchor", low, high);
+    sync.bad.insert(peer);
+    if (++sync.nretries > sync_max_retries)
+    {
+        end_sync(false);
+        return false;
+    }
+    if (!sync.linked)
+    {
+        /* the heights claimed so far are not to be trusted */
+        sync.todo.clear();
+        sync.unlinked.clear();
+        sync.todo.push_back(std::make_pair(sync.next, UINT32_MAX));
+        return true;
+    }
+    sync.todo.push_back(std::make_pair(low, high));
+    std::sort(sync.todo.begin(), sync.todo.end());
+    return true;
+}
+
+void HotStuffBase::sync_deliver() {
+    if (!sync_active || sync.delivering) return;
+    std::vector<block_t> run;
+    for (auto it = sync.blks.find(sync.next);
+            it != sync.blks.end() && it->first == sync.next + run.size() &&
+            run.size() < sync_batch; it++)
+        run.push_back(it->second);
+    if (run.empty())
+    {
+        if (sync.anchor_height && sync.next > sync.anchor_height)
+            end_sync(true);
+        else if (sync.inflight.empty() && sync.todo.empty())
+            end_sync(false);
+        return;
+    }
+    /* the QCs of the whole run go to the verifiers together */
+    std::vector<promise_t> pms;
+    {
+        VeriPool::LaneGuard _(vpool, VERI_BLOCK);
+        for (const auto &blk: run)
+            pms.push_back(blk->is_delivered() ?
+                promise_t([](promise_t &pm) { pm.resolve(true); }) :
+                blk->verify(this, vpool));
+    }
+    sync.delivering = true;
+    promise::all(pms).then([this, run](const promise::values_t &values) {
+        sync.delivering = false;
+        if (!sync_active) return;
+        for (size_t i = 0; i < run.size(); i++)
+        {
+            const block_t &blk = run[i];
+            sync.blks.erase(sync.next++);
+            if (blk->is_delivered()) continue;
+            if (!promise::any_cast<bool>(values[i]))
+            {
+                LOG_WARN("invalid qc in a block caught up with");
+                end_sync(false);
+                return;
+            }
+            bool ready = storage->is_blk_fetched(blk->get_qc()->get_obj_hash());
+            for (const auto &p: blk->get_parent_hashes())
+                ready = ready && storage->is_blk_delivered(p);
+            if (!ready)
+            {
+                /* off the chain of the anchor, e.g. an uncle */
+                sync.delivering = true;
+                on_fetch_blk(blk);
+                async_deliver_blk(blk->get_hash(), sync.origin).then([this]() {
+                    sync.delivering = false;
+                    sync_deliver();
+                });
+                return;
+            }
+            on_deliver_blk(blk);
+            on_fetch_blk(blk);
+            sync.ndelivered++;
+            part_sync_caught_up++;
+        }
+        sync_deliver();
+    });
+}
+
+void HotStuffBase::end_sync(bool done) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    double elapsed = (now.tv_sec - sync.start.tv_sec) +
+                    (now.tv_usec - sync.start.tv_usec) / 1e6;
+    if (done)
+    {
+        if (sync.ndelivered)
+            LOG_INFO("caught up with %lu blocks in %.3f sec", sync.ndelivered, elapsed);
+    }
+    else
+        LOG_WARN("catch-up stopped at height %u after %.3f sec, fetching the rest one by one",
+                sync.next, elapsed);
+    sync_active = false;
+    sync_timer.del();
+    for (const auto &b: sync.blks)
+        on_fetch_blk(b.second);
+    sync.blks.clear();
+    sync.unlinked.clear();
+    sync.inflight.clear();
+    sync.todo.clear();
+    /* the fetches held back meanwhile */
+    for (auto &f: blk_fetch_waiting)
+        f.second.resend();
+}
+
+void HotStuffBase::on_sync_timer(TimerEvent &) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    for (auto it = sync.inflight.begin(); it != sync.inflight.end();)
+    {
+        const auto &sent = it->second.sent;
+        if ((now.tv_sec - sent.tv_sec) + (now.tv_usec - sent.tv_usec) / 1e6 > sync_timeout)
+        {
+            sync.todo.push_back(std::make_pair(it->first, it->second.high));
+            sync.nretries++;
+            it = sync.inflight.erase(it);
+        }
+        else it++;
+    }
+    if (sync.nretries > sync_max_retries)
+    {
+        end_sync(false);
+        return;
+    }
+    std::sort(sync.todo.begin(), sync.todo.end());
+    sync_request();
+    sync_timer.add(sync_timeout / 2);
+}
+
+void HotStuffBase::ping_handler(MsgPing &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    if (peer.is_null()) return;
+    std::vector<std::pair<ReplicaID, uint32_t>> vote_lats;
+    std::set<PeerId> children;
+    for (const auto &route: routes)
+        children.insert(route.children.begin(), route.children.end());
+    for (const auto &child: children)
+    {
+        auto it = link_stats.find(peer_rids[child]);
+        if (it != link_stats.end() && it->second.vote_lat > 0)
+            vote_lats.push_back(std::make_pair(it->first, (uint32_t)(it->second.vote_lat * 1e6)));
+    }
+    send_msg(MsgPong(msg.sent_us, msg.resp_size, vote_lats), peer);
+}
+
+void HotStuffBase::pong_handler(MsgPong &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    if (peer.is_null()) return;
+    auto it = peer_rids.find(peer);
+    if (it == peer_rids.end()) return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double rtt = (now.tv_sec * 1000000 + now.tv_usec - (int64_t)msg.sent_us) / 1e6;
+    auto &stat = link_stats[it->second];
+    if (msg.resp_size == 0)
+    {
+        stat.alive = true;
+        stat.probe_rtt = rtt;
+        stat.rtt = stat.rtt == 0 ? rtt : 0.8 * stat.rtt + 0.2 * rtt;
+    }
+    else if (stat.probe_rtt > 0)
+    {
+        /* the extra time of the padded probe is spent on the responder's uplink */
+        double bw = msg.resp_size / std::max(rtt - stat.probe_rtt, 1e-6);
+        stat.bw = stat.bw == 0 ? bw : 0.8 * stat.bw + 0.2 * bw;
+    }
+    /* the parents know best how late their children's votes arrive */
+    for (const auto &l: msg.vote_lats)
+        link_stats[l.first].vote_lat = l.second / 1e6;
+}
+
+void HotStuffBase::tree_handler(MsgTree &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    if (peer.is_null()) return;
+    auto it = peer_rids.find(peer);
+    if (it == peer_rids.end() || it->second != pmaker->get_proposer()) return;
+    if (msg.epoch <= tree_epoch) return;
+    std::vector<bool> seen(config.nreplicas, false);
+    for (const auto &rid: msg.order)
+    {
+        if (rid >= seen.size() || seen[rid])
+        {
+            LOG_WARN("invalid tree order from %d", it->second);
+            return;
+        }
+        seen[rid] = true;
+    }
+    if (msg.order.size() != config.nreplicas || msg.order[0] != it->second ||
+        msg.fanouts.empty() ||
+        std::find(msg.fanouts.begin(), msg.fanouts.end(), 0) != msg.fanouts.end())
+    {
+        LOG_WARN("invalid tree order from %d", it->second);
+        return;
+    }
+    LOG_INFO("switching to tree epoch %u", msg.epoch);
+    apply_tree(msg.epoch, msg.order, msg.fanouts, msg.pending);
+}
+
+void HotStuffBase::record_vote_arrival(ReplicaID rid, const uint256_t &blk_hash) {
+    auto it = vote_wait_start.find(blk_hash);
+    if (it == vote_wait_start.end()) return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double lat = (now.tv_sec - it->second.tv_sec) + (now.tv_usec - it->second.tv_usec) / 1e6;
+    auto &stat = link_stats[rid];
+    stat.vote_lat = stat.vote_lat == 0 ? lat : 0.8 * stat.vote_lat + 0.2 * lat;
+}
+
+void HotStuffBase::set_auto_pipeline(bool enable) {
+    if (!enable)
+    {
+        pipe_tuner = nullptr;
+        return;
+    }
+    pipe_tuner = new PipelineTuner(config.async_blocks > 0 ? config.async_blocks : 32,
+                                    config.piped_latency / 1e3);
+    set_piped_latency(pipe_tuner->get_gap_ms(), pipe_tuner->get_depth());
+}
+
+void HotStuffBase::on_pipe_qc(const timeval &sent) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double lat = (now.tv_sec - sent.tv_sec) + (now.tv_usec - sent.tv_usec) / 1e6;
+    part_pipe_qcs++;
+    part_pipe_lat += lat;
+    if (!pipe_tuner->on_qc(lat, now.tv_sec + now.tv_usec / 1e6)) return;
+    HOTSTUFF_LOG_PROTO("pipeline: depth %u, gap %d ms",
+                        pipe_tuner->get_depth(), pipe_tuner->get_gap_ms());
+    set_piped_latency(pipe_tuner->get_gap_ms(), pipe_tuner->get_depth());
+}
+
+std::vector<std::pair<uint16_t, bytearray_t>> HotStuffBase::subtree_chunks(
+        const Topology &tree, ReplicaID rid,
+        const std::vector<std::pair<uint16_t, bytearray_t>> &chunks) const {
+    std::set<uint16_t> wanted{chunk_of(rid)};
+    for (const auto &d: tree.get_descendants(rid))
+        wanted.insert(chunk_of(d));
+    std::vector<std::pair<uint16_t, bytearray_t>> res;
+    for (const auto &c: chunks)
+        if (wanted.erase(c.first)) res.push_back(c);
+    return res;
+}
+
+void HotStuffBase::prune_chunk_state(const timeval &now) {
+    /* forget the blocks that were never rebuilt, they are fetched instead */
+    for (auto it = chunk_state.begin(); it != chunk_state.end();)
+    {
+        if (now.tv_sec - it->second.start.tv_sec > ent_waiting_timeout)
+            it = chunk_state.erase(it);
+        else
+            it++;
+    }
+}
+
+void HotStuffBase::send_chunks(const Proposal &prop, uint8_t tree) {
+    bytearray_t payload = MsgPropose(prop, tree).serialized;
+    auto encoded = chunk_code.encode(payload);
+    std::vector<std::pair<uint16_t, bytearray_t>> chunks;
+    for (size_t i = 0; i < encoded.size(); i++)
+        chunks.push_back(std::make_pair((uint16_t)i, std::move(encoded[i])));
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    prune_chunk_state(now);
+    const uint256_t blk_hash = prop.blk->get_hash();
+    auto &cs = chunk_state[blk_hash];
+    cs.start = now;
+    cs.relayed = true;
+    cs.done = true;
+
+    const Topology &t = trees[tree];
+    for (const auto &c: t.get_children(id))
+        send_msg(MsgChunk(blk_hash, tree, payload.size(), true,
+                            subtree_chunks(t, c, chunks)),
+                    config.get_peer_id(c));
+    /* no subtree holds the chunk of the proposer, it shares it itself
+     * like every relay does */
+    multicast_msg(MsgChunk(blk_hash, tree, payload.size(), false,
+                            {chunks[chunk_of(id)]}), peers);
+}
+
+void HotStuffBase::chunk_handler(MsgChunk &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    if (peer.is_null() || !erasure) return;
+    auto rit = peer_rids.find(peer);
+    if (rit == peer_rids.end()) return;
+    auto it = chunk_state.find(msg.blk_hash);
+    if (it == chunk_state.end())
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        prune_chunk_state(now);
+        it = chunk_state.insert(std::make_pair(msg.blk_hash, ChunkState())).first;
+        it->second.start = now;
+    }
+    auto &cs = it->second;
+    if (msg.relay)
+    {
+        /* the subtree chunks come from the parent only, and with them the
+         * length and the tree; the chunks shared meanwhile wait for them */
+        if (peer != routes[msg.tree % routes.size()].parent || cs.known) return;
+        cs.tree = msg.tree % trees.size();
+        cs.len = msg.len;
+        cs.known = true;
+        /* relay even if the block was rebuilt already (from the chunks the
+         * others shared), the subtree depends on it */
+        if (!cs.relayed)
+        {
+            cs.relayed = true;
+            /* hand every child the chunks of its subtree */
+            const Topology &tree = trees[cs.tree];
+            for (const auto &c: tree.get_children(id))
+                send_msg(MsgChunk(msg.blk_hash, msg.tree, msg.len, true,
+                                    subtree_chunks(tree, c, msg.chunks)),
+                            config.get_peer_id(c));
+            /* and share the own chunk with everyone else */
+            for (const auto &c: msg.chunks)
+            {
+                if (c.first != chunk_of(id)) continue;
+                multicast_msg(MsgChunk(msg.blk_hash, msg.tree, msg.len, false, {c}), peers);
+                break;
+            }
+        }
+        if (cs.done) return;
+        for (auto &c: msg.chunks)
+            cs.chunks.push_back(std::move(c));
+    }
+    else
+    {
+        /* every replica shares its own chunk, once */
+        if (!cs.senders.insert(rit->second).second || cs.done) return;
+        for (auto &c: msg.chunks)
+        {
+            if (c.first != chunk_of(rit->second)) continue;
+            cs.chunks.push_back(std::move(c));
+            break;
+        }
+    }
+    try_decode(msg.blk_hash, peer);
+}
+
+void HotStuffBase::try_decode(const uint256_t &blk_hash, const PeerId &peer) {
+    auto &cs = chunk_state[blk_hash];
+    /* every failed attempt waits for one more chunk */
+    if (!cs.known || cs.chunks.size() < chunk_code.get_k() + cs.attempts) return;
+    /* and starts at another one, to leave out a corrupted chunk */
+    auto chunks = cs.chunks;
+    std::rotate(chunks.begin(), chunks.begin() + cs.attempts % chunks.size(), chunks.end());
+    bytearray_t payload;
+    if (!chunk_code.decode(chunks, cs.len, payload)) return;
+
+    MsgPropose msg(DataStream(std::move(payload)));
+    bool valid = false;
+    try {
+        msg.postponed_parse(this);
+        valid = msg.proposal.blk != nullptr && msg.proposal.blk->get_hash() == blk_hash;
+    } catch (std::exception &) {}
+    if (!valid)
+    {
+        LOG_WARN("chunks of %s do not rebuild the block", get_hex10(blk_hash).c_str());
+        cs.attempts++;
+        part_decode_failed++;
+        return;
+    }
+    cs.done = true;
+    cs.chunks.clear();
+    part_decoded++;
+    deliver_proposal(msg, peer);
+}
+
+void HotStuffBase::relay_track(const uint256_t &blk_hash) {
+    if (relay_policy == RELAY_FULL || get_route(blk_hash).children.empty() ||
+        id == pmaker->get_proposer())
+        return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    /* forget the blocks whose subtree completed, or never did */
+    for (auto it = relay_state.begin(); it != relay_state.end();)
+    {
+        if (it->second.done)
+            it = relay_state.erase(it);
+        else if (now.tv_sec - it->second.start.tv_sec > ent_waiting_timeout)
+        {
+            vote_wait_start.erase(it->first);
+            it = relay_state.erase(it);
+        }
+        else
+            it++;
+    }
+    if (relay_state.count(blk_hash)) return;
+    auto &rs = relay_state[blk_hash];
+    rs.start = now;
+    if (relay_policy == RELAY_DEADLINE)
+    {
+        rs.timer = TimerEvent(ec, [this, blk_hash](TimerEvent &) {
+            on_relay_deadline(blk_hash);
+        });
+        rs.timer.add(relay_deadline_for_children(get_tree(blk_hash)));
+    }
+}
+
+double HotStuffBase::relay_deadline_for_children(uint8_t tree) const {
+    std::vector<double> lats;
+    for (const auto &rid: trees[tree].get_children(id))
+    {
+        auto it = link_stats.find(rid);
+        if (it != link_stats.end() && it->second.vote_lat > 0)
+            lats.push_back(it->second.vote_lat);
+    }
+    if (lats.empty()) return relay_base_deadline;
+    /* the median, so that a straggler does not stretch the deadline of its
+     * siblings; the children of deeper levels answer faster, so the deadline
+     * shrinks towards the leaves */
+    std::nth_element(lats.begin(), lats.begin() + lats.size() / 2, lats.end());
+    return lats[lats.size() / 2] * relay_deadline_slack;
+}
+
+void HotStuffBase::on_relay_deadline(const uint256_t &blk_hash) {
+    auto it = relay_state.find(blk_hash);
+    if (it == relay_state.end() || it->second.done) return;
+    it->second.expired = true;
+    if (it->second.forwarded) return;
+    /* without the own vote yet, the next vote that arrives goes up */
+    block_t blk = storage->find_blk(blk_hash);
+    if (blk == nullptr || blk->self_qc == nullptr) return;
+    auto &cert = blk->self_qc;
+    cert->compute();
+    if (!cert->verify(config) && !opt_blame(blk))
+    {
+        LOG_WARN("invalid partial aggregate for %s", get_hex10(blk_hash).c_str());
+        return;
+    }
+    relay_forward(blk);
+}
+
+bool HotStuffBase::relay_ready(const block_t &blk) {
+    auto &cert = blk->self_qc;
+    const uint32_t subtree = get_route(blk->get_hash()).nsubtree + 1;
+    if (cert->has_n(subtree)) return true;
+    switch (relay_policy)
+    {
+        case RELAY_THRESHOLD:
+        {
+            /* every subtree may miss its share of the votes the quorum can
+             * do without, so the quorum stays reachable from the partials */
+            uint32_t slack = subtree * (config.nreplicas - config.nmajority) / config.nreplicas;
+            return cert->has_n(subtree - slack);
+        }
+        case RELAY_DEADLINE:
+        {
+            auto it = relay_state.find(blk->get_hash());
+            return it != relay_state.end() && it->second.expired;
+        }
+        default:
+            return false;
+    }
+}
+
+void HotStuffBase::relay_forward(const block_t &blk) {
+    const uint256_t &blk_hash = blk->get_hash();
+    const auto &route = get_route(blk_hash);
+    send_msg(MsgRelay(VoteRelay(blk_hash, blk->self_qc->clone(), this)), route.parent);
+    if (blk->self_qc->has_n(route.nsubtree + 1))
+    {
+        relay_done(blk_hash);
+        opt_parts.erase(blk_hash);
+        return;
+    }
+    part_relay_early++;
+    auto it = relay_state.find(blk_hash);
+    if (it != relay_state.end())
+        it->second.forwarded = true;
+}
+
+void HotStuffBase::relay_delta(const block_t &blk, quorum_cert_bt &&delta) {
+    const uint256_t &blk_hash = blk->get_hash();
+    const auto &route = get_route(blk_hash);
+    delta->compute();
+    part_relay_delta++;
+    send_msg(MsgRelay(VoteRelay(blk_hash, std::move(delta), this)), route.parent);
+    if (blk->self_qc->has_n(route.nsubtree + 1))
+    {
+        relay_done(blk_hash);
+        opt_parts.erase(blk_hash);
+    }
+}
+
+void HotStuffBase::relay_done(const uint256_t &blk_hash) {
+    /* may be within the deadline callback of the entry, which the timer
+     * still refers to; the next relay_track() erases it */
+    auto it = relay_state.find(blk_hash);
+    if (it == relay_state.end()) return;
+    it->second.done = true;
+    it->second.forwarded = false;
+}
+
+bool HotStuffBase::merge_or_request(const block_t &blk, const QuorumCert &qc) {
+    if (blk->self_qc->merge_quorum(qc)) return true;
+    part_relay_conflict++;
+    auto signers = blk->self_qc->get_signers();
+    std::vector<PeerId> dests;
+    for (const auto &rid: qc.get_signers())
+        if (rid != id && std::find(signers.begin(), signers.end(), rid) == signers.end())
+            dests.push_back(config.get_peer_id(rid));
+    LOG_WARN("cannot merge an aggregate for %s, requesting %lu votes",
+            get_hex10(blk->get_hash()).c_str(), dests.size());
+    if (!dests.empty())
+        multicast_msg(MsgReqVote(blk->get_hash()), dests);
+    return false;
+}
+
+void HotStuffBase::opt_record(const uint256_t &blk_hash, quorum_cert_bt &&part) {
+    if (!optimistic_verify) return;
+    opt_entry(blk_hash).parts.push_back(std::move(part));
+}
+
+HotStuffBase::OptParts &HotStuffBase::opt_entry(const uint256_t &blk_hash) {
+    auto it = opt_parts.find(blk_hash);
+    if (it == opt_parts.end())
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        /* forget the blocks whose certificate never completed */
+        for (auto it2 = opt_parts.begin(); it2 != opt_parts.end();)
+        {
+            if (now.tv_sec - it2->second.start.tv_sec > ent_waiting_timeout)
+                it2 = opt_parts.erase(it2);
+            else
+                it2++;
+        }
+        it = opt_parts.insert(std::make_pair(blk_hash, OptParts())).first;
+        it->second.start = now;
+    }
+    return it->second;
+}
+
+bool HotStuffBase::opt_parts_valid(const uint256_t &blk_hash,
+                                    const std::vector<quorum_cert_bt> &parts,
+                                    size_t lo, size_t hi) {
+    quorum_cert_bt qc = create_quorum_cert(blk_hash);
+    /* overlapping parts do not merge, and are no valid set either */
+    for (size_t i = lo; i < hi; i++)
+        if (!qc->merge_quorum(*parts[i])) return false;
+    qc->compute();
+    return qc->verify(config);
+}
+
+void HotStuffBase::opt_bisect(const uint256_t &blk_hash,
+                            const std::vector<quorum_cert_bt> &parts,
+                            size_t lo, size_t hi, std::vector<bool> &bad) {
+    /* [lo, hi) is known to contain an invalid part, unless empty (no
+     * parts were recorded) */
+    if (hi <= lo) return;
+    if (hi - lo == 1)
+    {
+        bad[lo] = true;
+        return;
+    }
+    size_t mid = (lo + hi) / 2;
+    if (!opt_parts_valid(blk_hash, parts, lo, mid))
+        opt_bisect(blk_hash, parts, lo, mid, bad);
+    if (!opt_parts_valid(blk_hash, parts, mid, hi))
+        opt_bisect(blk_hash, parts, mid, hi, bad);
+}
+
+bool HotStuffBase::opt_blame(const block_t &blk) {
+    if (!optimistic_verify) return false;
+    const uint256_t &blk_hash = blk->get_hash();
+    auto it = opt_parts.find(blk_hash);
+    if (it == opt_parts.end()) return false;
+    auto &parts = it->second.parts;
+    part_opt_failed++;
+    std::vector<bool> bad(parts.size(), false);
+    /* the own vote is valid, so the fault is among the parts */
+    opt_bisect(blk_hash, parts, 0, parts.size(), bad);
+
+    quorum_cert_bt cert = create_quorum_cert(blk_hash);
+    /* the own vote as signed already, if it is in yet */
+    if (it->second.own != nullptr)
+        cert->add_part(config, id, *it->second.own);
+    std::vector<quorum_cert_bt> good;
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        if (bad[i])
+        {
+            part_opt_blamed++;
+            continue;
+        }
+        if (!cert->merge_quorum(*parts[i]))
+        {
+            LOG_WARN("dropping an unmergeable part of %s", get_hex10(blk_hash).c_str());
+            continue;
+        }
+        good.push_back(std::move(parts[i]));
+    }
+    LOG_WARN("excluded %lu invalid vote(s) of %s",
+            parts.size() - good.size(), get_hex10(blk_hash).c_str());
+    parts = std::move(good);
+    cert->compute();
+    blk->self_qc = std::move(cert);
+    return blk->self_qc->verify(config);
+}
+
+void HotStuffBase::send_tree_probes() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t now_us = now.tv_sec * 1000000 + now.tv_usec;
+    for (const auto &peer: peers)
+    {
+        link_stats[peer_rids[peer]].alive = false;
+        send_msg(MsgPing(now_us, 0), peer);
+        send_msg(MsgPing(now_us, tree_probe_bytes), peer);
+    }
+}
+
+double HotStuffBase::placement_cost(const LinkStat &stat) const {
+    if (!stat.alive || stat.rtt == 0 || stat.bw == 0) return double_inf;
+    /* time to push a probe-sized proposal to all children, plus how late the
+     * votes of the replica have been arriving */
+    return stat.rtt / 2 + tree_fanouts[0] * tree_probe_bytes / stat.bw + stat.vote_lat;
+}
+
+void HotStuffBase::optimize_tree() {
+    /* no waiting for the pipeline to drain, switch_tree() re-routes the
+     * votes of the in-flight blocks along the new tree */
+    if (tree_star) return;
+    std::vector<ReplicaID> order;
+    size_t nunknown = 0;
+    const auto &tree_order = topo.get_order();
+    for (const auto &rid: tree_order)
+    {
+        if (rid == id) continue;
+        if (placement_cost(link_stats[rid]) == double_inf)
+            nunknown++;
+        order.push_back(rid);
+    }
+    /* silent replicas are pushed to the leaves, unless too many are silent
+     * to tell a fault from links that are not up yet */
+    if (nunknown > config.nreplicas - config.nmajority)
+    {
+        LOG_DEBUG("%lu replicas not measured, keeping the tree", nunknown);
+        return;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](ReplicaID a, ReplicaID b) {
+        return placement_cost(link_stats[a]) < placement_cost(link_stats[b]);
+    });
+    order.insert(order.begin(), id);
+    if (order == tree_order) return;
+
+    /* only move when the inner levels get noticeably better connected */
+    double old_cost = 0, new_cost = 0;
+    for (size_t i = 1; i < topo.get_ninternal(); i++)
+    {
+        old_cost += placement_cost(link_stats[tree_order[i]]);
+        new_cost += placement_cost(link_stats[order[i]]);
+    }
+    if (new_cost > 0.9 * old_cost) return;
+
+    LOG_INFO("re-optimizing tree (inner cost %.3f -> %.3f)", old_cost, new_cost);
+    switch_tree(order, tree_fanouts);
+}
+
+void HotStuffBase::switch_tree(const std::vector<ReplicaID> &order,
+                            const std::vector<uint32_t> &fanouts) {
+    std::vector<uint256_t> pending = pipeline.pending();
+    for (const auto &d: relay_deadline)
+        if (std::find(pending.begin(), pending.end(), d.first) == pending.end())
+            pending.push_back(d.first);
+    LOG_INFO("switching to tree epoch %u", tree_epoch + 1);
+    multicast_msg(MsgTree(tree_epoch + 1, order, fanouts, pending), peers);
+    apply_tree(tree_epoch + 1, order, fanouts, pending);
+}
+
+void HotStuffBase::apply_tree(uint32_t epoch, const std::vector<ReplicaID> &order,
+                            const std::vector<uint32_t> &fanouts,
+                            const std::vector<uint256_t> &pending) {
+    tree_epoch = epoch;
+    build_tree(Topology::from_order(order, fanouts), fanouts);
+    tree_star = topo.is_star();
+
+    /* instead of draining the pipeline, restart the aggregation of the
+     * in-flight blocks along the new tree; the votes collected so far are
+     * kept and travel up the new tree with the own vote */
+    for (const auto &blk_hash: pending)
+    {
+        block_t blk = storage->find_blk(blk_hash);
+        if (blk == nullptr || !blk->delivered || blk->height > vheight) continue;
+        if (blk->self_qc != nullptr && blk->self_qc->has_n(config.nmajority)) continue;
+        const bool collect = id == order[0] || !get_route(blk_hash).children.empty();
+        async_create_part_cert(*priv_key, blk_hash).then([this, blk, collect](PartCert *pc) {
+            part_cert_bt part(pc);
+            const uint256_t &blk_hash = blk->get_hash();
+            if (collect)
+                add_own_part(blk, part);
+            else if (blk->self_qc != nullptr)
+            {
+                /* a former internal node hands up its partial aggregate */
+                blk->self_qc->add_part(config, id, *part);
+                blk->self_qc->compute();
+                send_msg(MsgRelay(VoteRelay(blk_hash, blk->self_qc->clone(), this)),
+                        get_route(blk_hash).parent);
+            }
+            else
+                send_msg(MsgVote(Vote(id, blk_hash, std::move(part), this)),
+                        get_route(blk_hash).parent);
+        });
+    }
+}
+
+void HotStuffBase::req_vote_handler(MsgReqVote &&msg, const Net::conn_t &conn) {
+    const PeerId peer = conn->get_peer_id();
+    if (peer.is_null()) return;
+    block_t blk = storage->find_blk(msg.blk_hash);
+    /* only the blocks voted for, as when votes are re-sent for a new tree */
+    if (blk == nullptr || !blk->delivered || blk->height > vheight) return;
+    async_create_part_cert(*priv_key, msg.blk_hash).then([this, blk, peer](PartCert *pc) {
+        part_cert_bt part(pc);
+        send_msg(MsgVote(Vote(id, blk->get_hash(), std::move(part), this)), peer);
+    });
+}
+
+void HotStuffBase::on_tree_failure() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (!recovering)
+    {
+        recovering = true;
+        recover_start = now;
+    }
+    nreconf++;
+    part_reconf++;
+    /* give the re-voted blocks a fresh deadline */
+    for (auto &d: relay_deadline)
+        d.second = now;
+
+    if (tree_star)
+    {
+        LOG_WARN("missed relay deadline with the star topology");
+        return;
+    }
+    if (++tree_failures >= tree_max_failures)
+    {
+        LOG_WARN("%u trees failed, falling back to a star", tree_failures);
+        switch_tree(topo.get_order(), {(uint32_t)config.nreplicas - 1});
+        return;
+    }
+    /* move the internal nodes of the failed tree to the leaves */
+    std::vector<ReplicaID> order(topo.get_order());
+    size_t ninternal = topo.get_ninternal();
+    if (ninternal > 1)
+        std::rotate(order.begin() + 1, order.begin() + ninternal, order.end());
+    LOG_WARN("missed relay deadline, rotating the internal nodes");
+    switch_tree(order, tree_fanouts);
+}
+
+void HotStuffBase::on_reconf_timer(TimerEvent &) {
+    if (id == pmaker->get_proposer())
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        for (const auto &d: relay_deadline)
+        {
+            double waited = (now.tv_sec - d.second.tv_sec) + (now.tv_usec - d.second.tv_usec) / 1e6;
+            if (waited > tree_relay_timeout)
+            {
+                on_tree_failure();
+                break;
+            }
+        }
+    }
+    reconf_timer.add(tree_relay_timeout / 2);
+}
+
+void HotStuffBase::on_tree_timer(TimerEvent &) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    /* blocks still waiting after this long will not improve the estimate */
+    for (auto it = vote_wait_start.begin(); it != vote_wait_start.end();)
+    {
+        if (now.tv_sec - it->second.tv_sec > ent_waiting_timeout)
+            it = vote_wait_start.erase(it);
+        else
+            it++;
+    }
+
+    bool is_root = id == pmaker->get_proposer();
+    if (tree_probing)
+    {
+        if (is_root) optimize_tree();
+        tree_probing = false;
+        tree_timer.add(tree_period);
+    }
+    else
+    {
+        if (is_root) send_tree_probes();
+        tree_probing = true;
+        tree_timer.add(tree_probe_timeout);
+    }
+}
+
+bool HotStuffBase::conn_handler(const salticidae::ConnPool::conn_t &conn, bool connected) {
+    if (connected)
+    {
+        auto cert = conn->get_peer_cert();
+        //SALTICIDAE_LOG_INFO("%s", salticidae::get_hash(cert->get_der()).to_hex().c_str());
+        return (!cert) || valid_tls_certs.count(salticidae::get_hash(cert->get_der()));
+    }
+    return true;
+}
+
+void HotStuffBase::print_stat() const {
+    LOG_INFO("===== begin stats =====");
+    LOG_INFO("-------- queues -------");
+    LOG_INFO("blk_fetch_waiting: %lu", blk_fetch_waiting.size());
+    LOG_INFO("blk_delivery_waiting: %lu", blk_delivery_waiting.size());
+    LOG_INFO("decision_waiting: %lu", decision_waiting.size());
+    LOG_INFO("veri_queued: %lu (%lu workers, %lu stolen)",
+            vpool.get_queued(), vpool.get_nworker(), vpool.get_nstolen());
+    LOG_INFO("-------- misc ---------");
+    LOG_INFO("fetched: %lu", fetched);
+    LOG_INFO("delivered: %lu", delivered);
+    LOG_INFO("cmd_cache: %lu", storage->get_cmd_cache_size());
+    LOG_INFO("blk_cache: %lu", storage->get_blk_cache_size());
+    LOG_INFO("------ misc (10s) -----");
+    LOG_INFO("fetched: %lu", part_fetched);
+    LOG_INFO("delivered: %lu", part_delivered);
+    LOG_INFO("decided: %lu", part_decided);
+    LOG_INFO("gened: %lu", part_gened);
+    LOG_INFO("avg. parent_size: %.3f",
+            part_delivered ? part_parent_size / double(part_delivered) : 0);
+    LOG_INFO("delivery time: %.3f avg, %.3f min, %.3f max",
+            part_delivered ? part_delivery_time / double(part_delivered) : 0,
+            part_delivery_time_min == double_inf ? 0 : part_delivery_time_min,
+            part_delivery_time_max);
 
-        HotStuffCore::add_replica(i, peer, std::move(std::get<1>(replicas[i])));
-        if (addr != listen_addr) {
-            peers.push_back(peer);
-            pn.add_peer(peer);
-            pn.set_peer_addr(peer, addr);
+    part_parent_size = 0;
+    part_fetched = 0;
+    part_delivered = 0;
+    part_decided = 0;
+    part_gened = 0;
+    part_delivery_time = 0;
+    part_delivery_time_min = double_inf;
+    part_delivery_time_max = 0;
+
+    if (pipe_tuner)
+    {
+        LOG_INFO("-------- pipeline -----");
+        LOG_INFO("depth: %d, gap: %d ms%s (%lu adjustments)",
+                config.async_blocks, config.piped_latency,
+                pipe_tuner->in_startup() ? " (start-up)" : "",
+                pipe_tuner->get_nadjust());
+        LOG_INFO("qc latency: %.3f avg (10s), %.3f floor, %.1f qc/s limit",
+                part_pipe_qcs ? part_pipe_lat / part_pipe_qcs : 0,
+                pipe_tuner->get_base_lat() == double_inf ? 0 : pipe_tuner->get_base_lat(),
+                pipe_tuner->get_rate());
+        /* the delays of the levels below the first one are known from the
+         * probes only (tree-reopt-period) */
+        std::map<uint32_t, std::pair<size_t, std::pair<double, double>>> levels;
+        for (const auto &l: link_stats)
+        {
+            if (l.first >= topo.size() || (l.second.rtt == 0 && l.second.vote_lat == 0))
+                continue;
+            auto &lv = levels[topo.get_depth(l.first)];
+            lv.first++;
+            lv.second.first += l.second.rtt;
+            lv.second.second += l.second.vote_lat;
+        }
+        for (const auto &lv: levels)
+            LOG_INFO("level %u: rtt %.3f, aggregated %.3f avg (%lu replicas)",
+                    lv.first, lv.second.second.first / lv.second.first,
+                    lv.second.second.second / lv.second.first, lv.second.first);
+        part_pipe_qcs = 0;
+        part_pipe_lat = 0;
+    }
+    if (prune_depth)
+    {
+        LOG_INFO("-------- pruning ------");
+        LOG_INFO("kept: %lu committed, %.1f KB/block avg", committed.size(), avg_blk_bytes / 1024);
+        LOG_INFO("pruned: %lu blocks, %.3f MB (10s), %.3f MB total",
+                part_pruned, part_reclaimed / 1048576.0, total_reclaimed / 1048576.0);
+        LOG_INFO("pending: %lu detached, %lu held", prune_garbage.size(), prune_held.size());
+        part_pruned = 0;
+        part_reclaimed = 0;
+    }
+    if (wal != nullptr)
+    {
+        size_t nsync = wal->get_nsync(), bytes = wal->get_synced_bytes();
+        LOG_INFO("-------- wal ------");
+        LOG_INFO("records: %lu (10s), log size %.3f MB",
+                part_wal_records, wal->get_size() / 1048576.0);
+        LOG_INFO("fsyncs: %lu (10s), %.1f records/fsync, %.3f MB written",
+                nsync - part_wal_nsync,
+                nsync > part_wal_nsync ? (double)part_wal_records / (nsync - part_wal_nsync) : 0.0,
+                (bytes - part_wal_bytes) / 1048576.0);
+        part_wal_records = 0;
+        part_wal_nsync = nsync;
+        part_wal_bytes = bytes;
+    }
+    if (blk_store != nullptr)
+    {
+        LOG_INFO("-------- block store ------");
+        if (!blk_store->empty())
+            LOG_INFO("heights: %u..%u", blk_store->get_base_height(), blk_store->get_top_height());
+        LOG_INFO("stored: %lu blocks, %.3f MB in %lu segments",
+                blk_store->get_nblocks(), blk_store->get_bytes() / 1048576.0,
+                blk_store->get_nsegments());
+        LOG_INFO("served: %u (10s)", part_store_served);
+        part_store_served = 0;
+    }
+    if (sync_batch || part_sync_served)
+    {
+        LOG_INFO("-------- sync ------");
+        LOG_INFO("served: %u requests, %lu blocks (10s), %lu queued",
+                part_sync_served, part_sync_served_blks, sync_backlog.size());
+        LOG_INFO("caught up: %lu blocks (10s)%s", part_sync_caught_up,
+                sync_active ? ", catching up" : "");
+        part_sync_served = 0;
+        part_sync_served_blks = 0;
+        part_sync_caught_up = 0;
+    }
+    LOG_INFO("-------- threads ------");
+    for (const auto &t: cpu_stat.sample())
+        LOG_INFO("%s: %lu thread(s), %.1f%% cpu (10s)",
+                t.first.c_str(), t.second.first, t.second.second);
+    LOG_INFO("-------- slab ------");
+    auto slab = SlabPool::get_stats();
+    last_slab.resize(slab.size(), SlabPool::Stat{nullptr, 0, 0, 0, 0, 0});
+    for (size_t i = 0; i < slab.size(); i++)
+    {
+        const auto &st = slab[i];
+        auto &last = last_slab[i];
+        size_t ops = st.nalloc - last.nalloc + st.nfree - last.nfree;
+        LOG_INFO("%s: %lu allocs (10s), %lu live, %.2f%% via the depot, %.3f MB reserved",
+                st.name, st.nalloc - last.nalloc,
+                st.nalloc > st.nfree ? st.nalloc - st.nfree : 0,
+                ops ? 100.0 * (st.nrefill - last.nrefill) / ops : 0.0,
+                st.reserved / 1048576.0);
+        last = st;
+    }
+    if (tree_relay_timeout > 0)
+    {
+        LOG_INFO("-------- tree ---------");
+        LOG_INFO("epoch: %u%s", tree_epoch, tree_star ? " (star)" : "");
+        LOG_INFO("reconfigurations: %lu total, %u (10s)", nreconf, part_reconf);
+        LOG_INFO("unmergeable aggregates: %u (10s)", part_relay_conflict);
+        LOG_INFO("time-to-recover: %.3f avg, %.3f max",
+                part_recovered ? part_recover_time / part_recovered : 0,
+                part_recover_time_max);
+        part_reconf = 0;
+        part_relay_conflict = 0;
+        part_recovered = 0;
+        part_recover_time = 0;
+        part_recover_time_max = 0;
+    }
+    if (relay_policy != RELAY_FULL)
+    {
+        LOG_INFO("-------- relay --------");
+        LOG_INFO("early: %u, deltas: %u (10s)", part_relay_early, part_relay_delta);
+        part_relay_early = 0;
+        part_relay_delta = 0;
+    }
+    if (optimistic_verify)
+    {
+        LOG_INFO("-------- optimistic verification --------");
+        LOG_INFO("failed aggregates: %u, excluded parts: %u (10s)",
+                part_opt_failed, part_opt_blamed);
+        part_opt_failed = 0;
+        part_opt_blamed = 0;
+    }
+    if (erasure)
+    {
+        LOG_INFO("-------- erasure ------");
+        LOG_INFO("rebuilt: %u, failed: %u (10s)", part_decoded, part_decode_failed);
+        part_decoded = 0;
+        part_decode_failed = 0;
+    }
+    if (link_emu)
+    {
+        LOG_INFO("-------- links --------");
+        LOG_INFO("sent: %u, lost: %u, avg. delay: %.3f ms (10s)",
+                part_link_sent, part_link_lost,
+                part_link_sent ? part_link_delay / part_link_sent * 1e3 : 0);
+        part_link_sent = 0;
+        part_link_lost = 0;
+        part_link_delay = 0;
+    }
+#ifdef HOTSTUFF_MSG_STAT
+    LOG_INFO("--- replica msg. (10s) ---");
+    size_t _nsent = 0;
+    size_t _nrecv = 0;
+    for (const auto &replica: peers)
+    {
+        try {
+            auto conn = pn.get_peer_conn(replica);
+            if (conn == nullptr) continue;
+            size_t ns = conn->get_nsent();
+            size_t nr = conn->get_nrecv();
+            size_t nsb = conn->get_nsentb();
+            size_t nrb = conn->get_nrecvb();
+            conn->clear_msgstat();
+            LOG_INFO("%s: %u(%u), %u(%u), %u",
+                     get_hex10(replica).c_str(), ns, nsb, nr, nrb, part_fetched_replica[replica]);
+            _nsent += ns;
+            _nrecv += nr;
+            part_fetched_replica[replica] = 0;
         }
+        catch (...) { }
     }
+    nsent += _nsent;
+    nrecv += _nrecv;
+    LOG_INFO("sent: %lu", _nsent);
+    LOG_INFO("recv: %lu", _nrecv);
+    LOG_INFO("--- replica msg. total ---");
+    LOG_INFO("sent: %lu", nsent);
+    LOG_INFO("recv: %lu", nrecv);
+#endif
+    LOG_INFO("====== end stats ======");
+}
 
-    size_t fanout = config.fanout;
-    auto processesOnLevel = 1;
-    bool done = false;
+HotStuffBase::HotStuffBase(uint32_t blk_size,
+                    ReplicaID rid,
+                    privkey_bt &&priv_key,
+                    NetAddr listen_addr,
+                    pacemaker_bt pmaker,
+                    EventContext ec,
+                    size_t nworker,
+                    const Net::Config &netconfig):
+        HotStuffCore(rid, std::move(priv_key)),
+        listen_addr(listen_addr),
+        blk_size(blk_size),
+        ec(ec),
+        tcall(ec),
+        vpool(ec, nworker),
+        pn(ec, netconfig),
+        pmaker(std::move(pmaker)),
 
-    size_t i = 0;
-    while (i < size) { // 0 // 11
-        if (done) {
-            break;
-        }
-        const size_t remaining = size - i; // 100 // 89
+        fetched(0), delivered(0),
+        nsent(0), nrecv(0),
+        part_parent_size(0),
+        part_fetched(0),
+        part_delivered(0),
+        part_decided(0),
+        part_gened(0),
+        part_delivery_time(0),
+        part_delivery_time_min(double_inf),
+        part_delivery_time_max(0),
+        ntrees(1),
+        next_tree(0),
+        tree_epoch(0),
+        tree_period(0),
+        tree_probe_bytes(65536),
+        tree_probing(false),
+        tree_relay_timeout(0),
+        tree_max_failures(3),
+        tree_failures(0),
+        tree_star(false),
+        recovering(false),
+        nreconf(0),
+        part_reconf(0),
+        part_recovered(0),
+        part_recover_time(0),
+        part_recover_time_max(0),
+        prune_scheduled(false),
+        prune_batch(64),
+        wal_max_bytes(64 << 20),
+        wal_rotating(false),
+        wal_snapshot_size(0),
+        part_wal_records(0),
+        part_wal_nsync(0),
+        part_wal_bytes(0),
+        blk_store_seg(64 << 20),
+        part_store_served(0),
+        sync_batch(0),
+        sync_parallel(4),
+        sync_serve_rate(0),
+        sync_min_gap(64),
+        delivered_height(0),
+        sync_active(false),
+        sync_peer(0),
+        sync_tokens(0),
+        part_sync_served(0),
+        part_sync_served_blks(0),
+        part_sync_caught_up(0),
+        relay_policy(RELAY_FULL),
+        relay_base_deadline(0.1),
+        part_relay_early(0),
+        part_relay_delta(0),
+        part_relay_conflict(0),
+        part_pipe_qcs(0),
+        part_pipe_lat(0),
+        optimistic_verify(false),
+        part_opt_failed(0),
+        part_opt_blamed(0),
+        erasure(false),
+        part_decoded(0),
+        part_decode_failed(0),
+        link_emu(false),
+        link_rng(rid),
+        part_link_sent(0),
+        part_link_lost(0),
+        part_link_delay(0)
+{
+    /* register the handlers for msg from replicas */
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_blk_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_blk_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_relay_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::ping_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::pong_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::tree_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::chunk_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_sync_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_sync_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_vote_handler, this, _1, _2));
+    pn.reg_conn_handler(salticidae::generic_bind(&HotStuffBase::conn_handler, this, _1, _2));
+    {
+        /* the network workers inherit the placement */
+        ThreadLayout::Scope _(thread_layout, THREAD_NET);
+        pn.start();
+    }
+    pn.listen(listen_addr);
+}
 
-        const size_t max_fanout = ceil(remaining / processesOnLevel); //100 // 9
-        auto curr_fanout = std::min(max_fanout, fanout); //10 // 9
+void HotStuffBase::link_enqueue(const PeerId &peer, size_t size, std::function<void()> send) {
+    auto it = link_queues.find(peer);
+    if (it == link_queues.end())
+    {
+        send();
+        return;
+    }
+    auto &lq = it->second;
+    const auto &link = lq.link;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    double now = tv.tv_sec + tv.tv_usec / 1e6;
+    double depart = std::max(now, lq.free_at);
+    if (link.bandwidth > 0)
+        depart += size / link.bandwidth;
+    lq.free_at = depart;
+    double release = depart + link.delay;
+    if (link.jitter > 0)
+        release += std::uniform_real_distribution<double>(0, link.jitter)(link_rng);
+    /* the connection is TCP: a lost segment costs a retransmission timeout */
+    std::bernoulli_distribution lost(link.loss);
+    while (lost(link_rng))
+    {
+        release += std::max(link_rto_min, 2 * link.delay);
+        part_link_lost++;
+    }
+    /* and the messages stay in order */
+    release = std::max(release, lq.last_release);
+    lq.last_release = release;
+    part_link_sent++;
+    part_link_delay += release - now;
+    lq.pending.push_back(std::make_pair(release, std::move(send)));
+    if (lq.pending.size() == 1)
+        lq.timer.add(release - now);
+}
 
-        auto parent_cert_hash = std::move(std::get<2>(replicas[i]));
-        salticidae::PeerId parent_peer{parent_cert_hash};
+void HotStuffBase::link_release(const PeerId &peer) {
+    auto &lq = link_queues[peer];
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    double now = tv.tv_sec + tv.tv_usec / 1e6;
+    while (!lq.pending.empty() && lq.pending.front().first <= now)
+    {
+        auto send = std::move(lq.pending.front().second);
+        lq.pending.pop_front();
+        send();
+    }
+    if (!lq.pending.empty())
+        lq.timer.add(lq.pending.front().first - now);
+}
 
-        auto start = i + processesOnLevel; // 11
-        for (auto counter = 1; counter <= processesOnLevel; counter++) { // 1 run // 10 runs
-            if (done) {
-                break;
-            }
-            for (size_t j = start; j < start + curr_fanout; j++) { // j = 1 -> 10 // j = 11 -> 21 // (i = 11) j = 22 - 32
-                if (j >= size) {
-                    done = true;
-                    break;
-                }
-                auto cert_hash = std::move(std::get<2>(replicas[j]));
-                salticidae::PeerId peer{cert_hash};
-
-                if (id == i) {
-                    HOTSTUFF_LOG_PROTO("Adding Child Process: %lld", j);
-                    children.insert(j);
-                    childPeers.insert(peer);
-                } else if (id == j) {
-                    HOTSTUFF_LOG_PROTO("Setting Parent Process: %lld", i);
-                    parentPeer = parent_peer;
-                } else if (childPeers.find(parent_peer) != childPeers.end()) {
-                    children.insert(j);
-                }
+void HotStuffBase::do_broadcast_proposal(const Proposal &prop) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (tree_period > 0 || pipe_tuner)
+        vote_wait_start[prop.blk->get_hash()] = now;
+    if (pipe_tuner)
+        async_qc_finish(prop.blk).then([this, now]() { on_pipe_qc(now); });
+    if (tree_relay_timeout > 0)
+    {
+        const uint256_t blk_hash = prop.blk->get_hash();
+        relay_deadline[blk_hash] = now;
+        async_qc_finish(prop.blk).then([this, blk_hash]() {
+            if (!relay_deadline.erase(blk_hash)) return;
+            tree_failures = 0;
+            if (recovering)
+            {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                double sec = (now.tv_sec - recover_start.tv_sec) + (now.tv_usec - recover_start.tv_usec) / 1e6;
+                part_recovered++;
+                part_recover_time += sec;
+                part_recover_time_max = std::max(part_recover_time_max, sec);
+                recovering = false;
+                LOG_INFO("recovered after %.3f sec", sec);
             }
-            start += curr_fanout;
-            i++;
-            parent_cert_hash = std::move(std::get<2>(replicas[i]));
-            salticidae::PeerId temp_parent_peer{parent_cert_hash};
-            parent_peer = temp_parent_peer;
-        } // i = 1
-        processesOnLevel = std::min(curr_fanout * processesOnLevel, remaining); // 10
+        });
+    }
+    uint8_t tree = next_tree;
+    next_tree = (next_tree + 1) % routes.size();
+    blk_tree[prop.blk->get_hash()] = tree;
+    if (erasure)
+    {
+        send_chunks(prop, tree);
+        return;
+    }
+    const auto &children = routes[tree].children;
+    multicast_msg(MsgPropose(prop, tree), std::vector(children.begin(), children.end()));
+}
+
+void HotStuffBase::do_vote(Proposal prop, const Vote &vote) {
+    //HOTSTUFF_LOG_PROTO("do vote");
+
+    pmaker->beat_resp(prop.proposer).then([this, vote, prop](ReplicaID proposer) {
+
+        if (proposer == get_id())
+        {
+            throw HotStuffError("unreachable line");
+        }
+
+        const auto &route = get_route(vote.blk_hash);
+        if (route.children.empty()) {
+            //HOTSTUFF_LOG_PROTO("send vote");
+            send_msg(MsgVote(vote), route.parent);
+        } else {
+            //HOTSTUFF_LOG_PROTO("create cert");
+            add_own_part(get_delivered_blk(vote.blk_hash), vote.cert);
+        }
+    });
+}
+
+/* signs an own vote in a SignPool worker */
+class PartCertTask: public SignTask {
+    HotStuffCore *hsc;
+    const PrivKey &priv_key;
+    const uint256_t blk_hash;
+
+    public:
+    part_cert_bt cert;
+
+    PartCertTask(HotStuffCore *hsc, const PrivKey &priv_key, const uint256_t &blk_hash):
+        hsc(hsc), priv_key(priv_key), blk_hash(blk_hash) {}
+
+    void sign() override { cert = hsc->create_part_cert(priv_key, blk_hash); }
+};
+
+promise_t HotStuffBase::async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) {
+    promise_t pm = spool == nullptr ?
+        HotStuffCore::async_create_part_cert(priv_key, blk_hash) :
+        spool->sign(new PartCertTask(this, priv_key, blk_hash)).then([](SignTask *task) {
+            return static_cast<PartCertTask *>(task)->cert.unwrap();
+        });
+    if (wal == nullptr) return pm;
+    /* sign while the state of the vote goes to disk */
+    return promise::all(std::vector<promise_t>{pm, wal->sync()}).then(
+        [](const promise::values_t &values) {
+            return promise::any_cast<PartCert *>(values[0]);
+        });
+}
+
+void HotStuffBase::add_own_part(const block_t &blk, const part_cert_bt &part) {
+    const uint256_t &blk_hash = blk->get_hash();
+    if (optimistic_verify)
+        opt_entry(blk_hash).own = part_cert_bt(part->clone());
+    auto &cert = blk->self_qc;
+    if (cert == nullptr)
+        cert = create_quorum_cert(blk_hash);
+    if (cert->has_n(config.nmajority)) return;
+    if (id == pmaker->get_proposer())
+    {
+        cert->add_part(config, id, *part);
+        /* the own signature may be the last one missing, if the
+         * aggregates of the children came first */
+        if (!cert->has_n(config.nmajority)) return;
+        cert->compute();
+        if (!cert->verify(config) &&
+            (!opt_blame(blk) || !cert->has_n(config.nmajority)))
+        {
+            HOTSTUFF_LOG_PROTO("Error, Invalid Sig!!!");
+            return;
+        }
+        opt_parts.erase(blk_hash);
+        finish_qc(blk);
+        return;
+    }
+
+    /* the children may have been faster than the signature */
+    auto rit = relay_state.find(blk_hash);
+    if (rit != relay_state.end() && rit->second.forwarded)
+    {
+        quorum_cert_bt delta = create_quorum_cert(blk_hash);
+        delta->add_part(config, id, *part);
+        cert->add_part(config, id, *part);
+        relay_delta(blk, std::move(delta));
+        return;
+    }
+    cert->add_part(config, id, *part);
+    if (!relay_ready(blk)) return;
+    cert->compute();
+    if (!cert->verify(config) && (!opt_blame(blk) || !relay_ready(blk)))
+    {
+        HOTSTUFF_LOG_PROTO("Error, Invalid Sig!!!");
+        return;
+    }
+    relay_forward(blk);
+}
+
+void HotStuffBase::do_consensus(const block_t &blk) {
+    blk_tree.erase(blk->get_hash());
+    if (blk_store) blk_store->put(*blk);
+    pmaker->on_consensus(blk);
+}
+
+void HotStuffBase::schedule_prune() {
+    if (prune_scheduled) return;
+    prune_scheduled = true;
+    prune_timer.add(0);
+}
+
+void HotStuffBase::do_prune(const block_t &blk) {
+    const auto &blk_hash = blk->get_hash();
+    blk_tree.erase(blk_hash);
+    opt_parts.erase(blk_hash);
+    vote_wait_start.erase(blk_hash);
+}
+
+void HotStuffBase::do_log(bytearray_t &&rec) {
+    part_wal_records++;
+    wal->append(rec);
+    /* a snapshot larger than wal_max_bytes must not compact on every
+     * record */
+    if (wal->get_size() > wal_snapshot_size + wal_max_bytes && !wal_rotating)
+    {
+        /* not in the middle of a commit */
+        wal_rotating = true;
+        wal_timer.add(0);
+    }
+}
+
+void HotStuffBase::do_decide(Finality &&fin) {
+    part_decided++;
+    state_machine_execute(fin);
+    auto it = decision_waiting.find(fin.cmd_hash);
+    if (it != decision_waiting.end())
+    {
+        it->second(std::move(fin));
+        decision_waiting.erase(it);
+    }
+}
+
+HotStuffBase::~HotStuffBase() {}
+
+void HotStuffBase::build_tree(const Topology &tree, const std::vector<uint32_t> &fanouts) {
+    topo = tree;
+    tree_fanouts = fanouts;
+    const auto &order = topo.get_order();
+
+    /* the other trees shift the replicas of order[1:] by one set of internal
+     * nodes each, as long as the sets stay disjoint */
+    size_t ninner = topo.get_ninternal() - 1;
+    size_t k = ntrees;
+    if (ninner == 0)
+        k = 1;
+    else if (k * ninner > order.size() - 1)
+    {
+        k = std::max<size_t>((order.size() - 1) / ninner, 1);
+        LOG_WARN("only %lu trees with disjoint internal nodes fit", k);
+    }
+    trees.clear();
+    routes.clear();
+    for (size_t t = 0; t < k; t++)
+    {
+        if (t == 0)
+            trees.push_back(topo);
+        else
+        {
+            std::vector<ReplicaID> rotated(order);
+            std::rotate(rotated.begin() + 1, rotated.begin() + 1 + t * ninner, rotated.end());
+            trees.push_back(topo.relabel(rotated));
+        }
+        const Topology &tree = trees.back();
+        TreeRoute route;
+        if (tree.has_parent(id))
+        {
+            HOTSTUFF_LOG_PROTO("Setting Parent Process: %d (tree %lu)", tree.get_parent(id), t);
+            route.parent = config.get_peer_id(tree.get_parent(id));
+        }
+        for (const auto &rid: tree.get_children(id))
+        {
+            HOTSTUFF_LOG_PROTO("Adding Child Process: %d (tree %lu)", rid, t);
+            route.children.insert(config.get_peer_id(rid));
+        }
+        /* a relay waits for the votes of its whole subtree */
+        route.nsubtree = tree.get_descendants(id).size();
+        routes.push_back(std::move(route));
+    }
+    next_tree %= routes.size();
+
+    numberOfChildren = routes[0].nsubtree;
+    HOTSTUFF_LOG_PROTO("total children: %d", numberOfChildren);
+}
+
+uint8_t HotStuffBase::get_tree(const uint256_t &blk_hash) const {
+    auto it = blk_tree.find(blk_hash);
+    return it == blk_tree.end() ? 0 : it->second % routes.size();
+}
+
+void HotStuffBase::start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas, bool ec_loop) {
+
+    auto size = replicas.size();
+
+    std::vector<ReplicaID> order;
+    for (size_t i = 0; i < size; i++) {
+
+        auto cert_hash = std::move(std::get<2>(replicas[i]));
+        salticidae::PeerId peer{cert_hash};
+        valid_tls_certs.insert(cert_hash);
+        auto &addr = std::get<0>(replicas[i]);
+
+        HotStuffCore::add_replica(i, peer, std::move(std::get<1>(replicas[i])));
+        peer_rids.insert(std::make_pair(peer, i));
+        order.push_back(i);
+        if (addr != listen_addr) {
+            peers.push_back(peer);
+            pn.add_peer(peer);
+            pn.set_peer_addr(peer, addr);
+        }
     }
 
-    HOTSTUFF_LOG_PROTO("total children: %d", children.size());
-    numberOfChildren = children.size();
+    for (const auto &peer: peers)
+    {
+        auto it = link_conf.find(peer_rids.at(peer));
+        const LinkEmu &link = it == link_conf.end() ? link_default : it->second;
+        if (link.is_null()) continue;
+        auto &lq = link_queues[peer];
+        lq.link = link;
+        lq.timer = TimerEvent(ec, [this, peer](TimerEvent &) { link_release(peer); });
+        link_emu = true;
+    }
+    if (link_emu)
+        LOG_INFO("emulating %lu outgoing links", link_queues.size());
+
+    /* start from the index-order (or topology file) tree, the root
+     * re-optimizes it later; the proposer is the root, the order starts
+     * with it */
+    ReplicaID proposer = pmaker->get_proposer();
+    if (proposer >= size)
+        throw HotStuffError("proposer %d is not one of the %lu replicas", proposer, size);
+    std::rotate(order.begin(), order.begin() + proposer, order.end());
+    std::vector<uint32_t> fanouts(level_fanouts);
+    if (fanouts.empty())
+        fanouts.push_back(config.fanout);
+    if (!tree_file.empty())
+    {
+        if (!topo_file.empty())
+            throw HotStuffError("both a tree file and a Kollaps topology given");
+        Topology tree = Topology::from_file(tree_file, size);
+        if (tree.get_root() != proposer)
+            throw HotStuffError("the tree in %s is rooted at %d, not at the proposer %d",
+                                tree_file.c_str(), tree.get_root(), proposer);
+        LOG_INFO("tree from %s: root %d, height %u",
+                tree_file.c_str(), tree.get_root(), tree.get_height());
+        build_tree(tree, tree.get_level_fanouts());
+    }
+    else if (!topo_file.empty())
+        build_tree(Topology::from_kollaps(topo_file, size, fanouts, proposer), fanouts);
+    else
+        build_tree(Topology::from_order(order, fanouts), fanouts);
 
     vector<PeerId> newPeers;
     copy(peers.begin(), peers.end(), back_inserter(newPeers));
@@ -846,14 +2519,62 @@ void HotStuffBase::start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>>
         usleep(10);
     }
 
-    std::cout << " total children: " << children.size() << std::endl;
-    numberOfChildren = children.size();
+    std::cout << " total children: " << numberOfChildren << std::endl;
+
+    prune_timer = TimerEvent(ec, [this](TimerEvent &) {
+        /* yield to the other events between the batches */
+        if (prune_step(prune_batch))
+            prune_timer.add(0);
+        else
+            prune_scheduled = false;
+    });
+
+    sync_timer = TimerEvent(ec, std::bind(&HotStuffBase::on_sync_timer, this, _1));
+    sync_serve_timer = TimerEvent(ec, [this](TimerEvent &) { serve_sync(); });
+    sync_tokens = sync_serve_rate / 10;
+    gettimeofday(&sync_refill, nullptr);
+
+    if (tree_period > 0)
+    {
+        tree_timer = TimerEvent(ec, std::bind(&HotStuffBase::on_tree_timer, this, _1));
+        tree_timer.add(tree_probe_timeout);
+    }
+    if (tree_relay_timeout > 0)
+    {
+        reconf_timer = TimerEvent(ec, std::bind(&HotStuffBase::on_reconf_timer, this, _1));
+        reconf_timer.add(tree_relay_timeout / 2);
+    }
 
     /* ((n - 1) + 1 - 1) / 3 */
     uint32_t nfaulty = peers.size() / 3;
     if (nfaulty == 0)
         LOG_WARN("too few replicas in the system to tolerate any failure");
+    if (erasure)
+    {
+        /* replicas share chunks beyond 256 replicas; any k chunks survive
+         * the chunks the faulty replicas withhold or corrupt */
+        size_t nchunks = std::min<size_t>(size, 256);
+        size_t k = std::max<size_t>(nchunks * (size - 2 * nfaulty) / size, 1);
+        chunk_code = ReedSolomon(k, nchunks);
+        LOG_INFO("erasure-coded proposals: any %lu of %lu chunks", k, nchunks);
+    }
     on_init(nfaulty);
+    if (!wal_fname.empty())
+    {
+        wal = new WriteAheadLog(ec, wal_fname);
+        restore(wal->replay());
+        wal_timer = TimerEvent(ec, [this](TimerEvent &) {
+            size_t size = wal->get_size();
+            wal->rewrite(log_snapshot());
+            LOG_INFO("compacted the log from %.3f MB to %.3f MB",
+                    size / 1048576.0, wal->get_size() / 1048576.0);
+            wal_snapshot_size = wal->get_size();
+            wal_rotating = false;
+        });
+        set_logging(true);
+    }
+    if (!blk_store_dir.empty())
+        blk_store = new BlockStore(blk_store_dir, blk_store_seg);
     pmaker->init(this);
     if (ec_loop)
         ec.dispatch();
@@ -897,7 +2618,7 @@ void HotStuffBase::start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>>
 
 void HotStuffBase::beat() {
     pmaker->beat().then([this](ReplicaID proposer) {
-        if (piped_queue.size() > get_config().async_blocks + 1) {
+        if (pipeline.size() > get_config().async_blocks + 1) {
             return;
         }
 
@@ -908,22 +2629,17 @@ void HotStuffBase::beat() {
 
             auto parents = pmaker->get_parents();
 
-            struct timeval current_time;
-            gettimeofday(&current_time, NULL);
             block_t current = pmaker->get_current_proposal();
 
-            if (piped_queue.size() < get_config().async_blocks && current != get_genesis()) {
+            if (pipeline.size() < get_config().async_blocks && current != get_genesis()) {
 
-                if (piped_queue.empty() && ((current_time.tv_sec - last_block_time.tv_sec) * 1000000 + current_time.tv_usec -last_block_time.tv_usec) / 1000 < config.piped_latency) {
+                if (pipeline.empty() && pipeline.since_last_block() < config.piped_latency) {
                     HOTSTUFF_LOG_PROTO("omitting propose");
                 } else {
+                    /* piped blocks are proposed at increasing heights */
                     block_t highest = current;
-                    for (auto p_hash : piped_queue) {
-                        block_t block = storage->find_blk(p_hash);
-                        if (block->height > highest->height) {
-                            highest = block;
-                        }
-                    }
+                    if (!pipeline.empty() && pipeline.back_height() > highest->height)
+                        highest = storage->find_blk(pipeline.back());
 
                     if (parents[0]->height < highest->height) {
                         parents.insert(parents.begin(), highest);
@@ -934,12 +2650,12 @@ void HotStuffBase::beat() {
                                                              parents[0]->height + 1,
                                                              current,
                                                              nullptr));
-                    piped_queue.push_back(piped_block->hash);
+                    pipeline.push(piped_block->hash, piped_block->height);
 
                     Proposal prop(id, piped_block, nullptr);
                     HOTSTUFF_LOG_PROTO("propose piped %s", std::string(*piped_block).c_str());
                     /* broadcast to other replicas */
-                    gettimeofday(&last_block_time, NULL);
+                    pipeline.touch();
                     do_broadcast_proposal(prop);
 
                     /*if (id == get_pace_maker()->get_proposer()) {
@@ -947,10 +2663,10 @@ void HotStuffBase::beat() {
                         long usec = ((timeEnd.tv_sec - timeStart.tv_sec) * 1000000 + timeEnd.tv_usec - timeStart.tv_usec);
                         stats.insert(std::make_pair(piped_block->hash, usec));
                     }*/
-                    piped_submitted = false;
+                    pipeline.submitted = false;
                 }
             } else {
-                gettimeofday(&last_block_time, NULL);
+                pipeline.touch();
                 on_propose(final_buffer, std::move(parents));
             }
         }
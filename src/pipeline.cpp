@@ -0,0 +1,187 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <stdexcept>
+
+#include "hotstuff/pipeline.h"
+
+namespace hotstuff {
+
+PipelineWindow::PipelineWindow(size_t depth):
+        ring(4), head(0), tail(0),
+        normal_height(0), submitted(false), last_block_time{0, 0} {
+    reserve(depth);
+}
+
+void PipelineWindow::resize(size_t cap) {
+    std::vector<Slot> nring(cap);
+    for (uint64_t seq = head; seq < tail; seq++)
+        nring[seq & (cap - 1)] = std::move(slot(seq));
+    ring = std::move(nring);
+}
+
+void PipelineWindow::reserve(size_t depth) {
+    size_t cap = ring.size();
+    while (cap < depth) cap <<= 1;
+    if (cap != ring.size()) resize(cap);
+}
+
+void PipelineWindow::advance() {
+    while (head < tail && slot(head).state == SLOT_FREE) head++;
+}
+
+PipelineWindow::SlotState PipelineWindow::get_state(const uint256_t &hash) const {
+    auto it = index.find(hash);
+    return it == index.end() ? SLOT_FREE : slot(it->second).state;
+}
+
+std::vector<uint256_t> PipelineWindow::pending() const {
+    std::vector<uint256_t> ret;
+    for (uint64_t seq = head; seq < tail; seq++)
+        if (slot(seq).state != SLOT_FREE)
+            ret.push_back(slot(seq).hash);
+    return ret;
+}
+
+void PipelineWindow::push(const uint256_t &hash, uint32_t height) {
+    if (tail - head == ring.size()) resize(ring.size() << 1);
+    auto &s = slot(tail);
+    s.hash = hash;
+    s.height = height;
+    s.state = SLOT_INFLIGHT;
+    index[hash] = tail++;
+}
+
+std::vector<uint256_t> PipelineWindow::certify(const uint256_t &hash) {
+    std::vector<uint256_t> ret;
+    auto it = index.find(hash);
+    if (it == index.end())
+    {
+        ret.push_back(hash);
+        return ret;
+    }
+    auto &s = slot(it->second);
+    if (s.state == SLOT_CERTIFIED) return ret;
+    s.state = SLOT_CERTIFIED;
+    if (it->second != head) return ret;
+    for (; head < tail; head++)
+    {
+        auto &h = slot(head);
+        if (h.state == SLOT_INFLIGHT) break;
+        if (h.state == SLOT_FREE) continue;
+        ret.push_back(h.hash);
+        index.erase(h.hash);
+        h.state = SLOT_FREE;
+    }
+    return ret;
+}
+
+void PipelineWindow::erase(const uint256_t &hash) {
+    auto it = index.find(hash);
+    if (it == index.end()) return;
+    slot(it->second).state = SLOT_FREE;
+    index.erase(it);
+    advance();
+}
+
+long PipelineWindow::since_last_block() const {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return ((now.tv_sec - last_block_time.tv_sec) * 1000000 +
+            now.tv_usec - last_block_time.tv_usec) / 1000;
+}
+
+PipelineTuner::PipelineTuner(uint32_t max_depth, double gap,
+                            double min_gap, double max_gap, double floor_ttl):
+        max_depth(std::max(max_depth, (uint32_t)1)),
+        min_gap(min_gap), max_gap(max_gap), floor_ttl(floor_ttl),
+        gap(std::min(std::max(gap, min_gap), max_gap)), depth(1),
+        qc_lat(0), base_lat(HUGE_VAL), base_stamp(0),
+        rates{}, max_rate(0), round(0), round_start(-1), round_delivered(0),
+        delivered(0), mode(TUNE_STARTUP), startup_rate(0), nflat(0),
+        floor_lat(HUGE_VAL), nadjust(0) {}
+
+void PipelineTuner::next_round(double now) {
+    double rate = (delivered - round_delivered) / (now - round_start);
+    rates[round++ % NROUNDS] = rate;
+    max_rate = *std::max_element(rates, rates + NROUNDS);
+    round_start = now;
+    round_delivered = delivered;
+    switch (mode)
+    {
+    case TUNE_STARTUP:
+        /* three rounds without 25% more means the bottleneck is full */
+        if (max_rate > startup_rate * 1.25)
+        {
+            startup_rate = max_rate;
+            nflat = 0;
+        }
+        else if (++nflat >= 3)
+            mode = TUNE_DRAIN;
+        break;
+    case TUNE_DRAIN:
+        if (qc_lat < base_lat * 1.25) mode = TUNE_CRUISE;
+        break;
+    case TUNE_FLOOR:
+        base_lat = floor_lat;
+        base_stamp = now;
+        mode = TUNE_CRUISE;
+        break;
+    case TUNE_CRUISE:
+        if (now - base_stamp > floor_ttl)
+        {
+            floor_lat = HUGE_VAL;
+            mode = TUNE_FLOOR;
+        }
+    }
+}
+
+bool PipelineTuner::on_qc(double lat, double now) {
+    qc_lat = delivered++ ? 0.875 * qc_lat + 0.125 * lat : lat;
+    floor_lat = std::min(floor_lat, lat);
+    if (lat <= base_lat)
+    {
+        base_lat = lat;
+        base_stamp = now;
+    }
+    if (round_start < 0)
+    {
+        round_start = now;
+        return false;
+    }
+    if (now - round_start < std::max(base_lat, min_gap * 10)) return false;
+    next_round(now);
+
+    /* probe above the rate, then drain what the probe queued */
+    static const double gains[8] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+    double gain = mode == TUNE_STARTUP ? 2 : mode == TUNE_DRAIN ? 0.5 : gains[round % 8];
+    double ngap = max_rate > 0 ? 1 / (max_rate * gain) : gap * 2;
+    ngap = std::min(std::max(ngap, min_gap), max_gap);
+    double bdp = max_rate * base_lat * (mode == TUNE_STARTUP ? 2 * gain : 2);
+    uint32_t ndepth = mode == TUNE_FLOOR ? 1 :
+        (uint32_t)std::min(std::max(std::ceil(bdp), 1.0), (double)max_depth);
+
+    int32_t gap_ms = get_gap_ms();
+    gap = ngap;
+    if (ndepth == depth && gap_ms == get_gap_ms()) return false;
+    depth = ndepth;
+    nadjust++;
+    return true;
+}
+
+}
@@ -0,0 +1,171 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "hotstuff/slab.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+const size_t SlabPool::magazine_size;
+const size_t SlabPool::slab_bytes;
+const size_t SlabPool::max_pools;
+
+/* plain arrays, so that they are still there for the threads exiting
+ * after the static destructors */
+static std::atomic<SlabPool *> pools[SlabPool::max_pools];
+static std::atomic<size_t> npools(0);
+
+struct SlabPool::Cache {
+    Magazine loaded[max_pools];
+    /** either empty or full */
+    Magazine prev[max_pools];
+
+    Cache() {
+        for (size_t i = 0; i < max_pools; i++)
+            loaded[i] = prev[i] = Magazine{nullptr, 0};
+    }
+
+    /* hand the objects of an exiting thread to the other ones */
+    ~Cache() {
+        for (size_t i = 0; i < max_pools; i++)
+        {
+            SlabPool *pool = pools[i].load(std::memory_order_acquire);
+            if (pool == nullptr) continue;
+            if (loaded[i].n) pool->put(loaded[i]);
+            if (prev[i].n) pool->put(prev[i]);
+        }
+    }
+};
+
+SlabPool::SlabPool(const char *name, size_t obj_size):
+        name(name), obj_size(obj_size),
+        depot(nullptr), slab(nullptr), slab_left(0),
+        nslabs(0), nalloc(0), nfree(0), nrefill(0) {
+    static const size_t align = alignof(std::max_align_t);
+    stride = (std::max(obj_size, sizeof(FreeObj)) + align - 1) & ~(align - 1);
+    id = npools.fetch_add(1);
+    if (id >= max_pools)
+        throw HotStuffError("too many slab pools");
+    pools[id].store(this, std::memory_order_release);
+}
+
+SlabPool::Cache &SlabPool::cache() {
+    static thread_local Cache c;
+    return c;
+}
+
+SlabPool::Magazine SlabPool::carve() {
+    Magazine m{nullptr, 0};
+    while (m.n < magazine_size)
+    {
+        if (slab_left < stride)
+        {
+            /* the tail of the last slab, if any, is lost */
+            size_t len = std::max(slab_bytes, stride);
+            slab = static_cast<uint8_t *>(::operator new(len));
+            slab_left = len;
+            nslabs.fetch_add(1, std::memory_order_relaxed);
+        }
+        auto obj = reinterpret_cast<FreeObj *>(slab);
+        obj->next = m.head;
+        m.head = obj;
+        m.n++;
+        slab += stride;
+        slab_left -= stride;
+    }
+    return m;
+}
+
+SlabPool::Magazine SlabPool::get_full() {
+    std::lock_guard<std::mutex> _(lock);
+    nrefill.fetch_add(1, std::memory_order_relaxed);
+    if (depot == nullptr) return carve();
+    Magazine m{depot, depot->n};
+    depot = depot->next_mag;
+    return m;
+}
+
+void SlabPool::put(Magazine m) {
+    std::lock_guard<std::mutex> _(lock);
+    nrefill.fetch_add(1, std::memory_order_relaxed);
+    m.head->next_mag = depot;
+    m.head->n = m.n;
+    depot = m.head;
+}
+
+void *SlabPool::alloc(size_t size) {
+    if (size != obj_size) return ::operator new(size);
+    auto &c = cache();
+    Magazine &loaded = c.loaded[id];
+    if (!loaded.n)
+    {
+        Magazine &prev = c.prev[id];
+        if (prev.n) std::swap(loaded, prev);
+        else loaded = get_full();
+    }
+    FreeObj *obj = loaded.head;
+    loaded.head = obj->next;
+    loaded.n--;
+    nalloc.fetch_add(1, std::memory_order_relaxed);
+    return obj;
+}
+
+void SlabPool::free(void *p, size_t size) {
+    if (p == nullptr) return;
+    if (size != obj_size)
+    {
+        ::operator delete(p);
+        return;
+    }
+    auto &c = cache();
+    Magazine &loaded = c.loaded[id];
+    if (loaded.n == magazine_size)
+    {
+        Magazine &prev = c.prev[id];
+        if (prev.n) put(prev);
+        prev = loaded;
+        loaded = Magazine{nullptr, 0};
+    }
+    auto obj = static_cast<FreeObj *>(p);
+    obj->next = loaded.head;
+    loaded.head = obj;
+    loaded.n++;
+    nfree.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<SlabPool::Stat> SlabPool::get_stats() {
+    std::vector<Stat> ret;
+    size_t n = std::min(npools.load(), max_pools);
+    for (size_t i = 0; i < n; i++)
+    {
+        SlabPool *pool = pools[i].load(std::memory_order_acquire);
+        if (pool == nullptr) continue;
+        ret.push_back(Stat{
+            pool->name, pool->obj_size,
+            pool->nalloc.load(std::memory_order_relaxed),
+            pool->nfree.load(std::memory_order_relaxed),
+            pool->nrefill.load(std::memory_order_relaxed),
+            pool->nslabs.load(std::memory_order_relaxed) *
+                std::max(slab_bytes, pool->stride)});
+    }
+    return ret;
+}
+
+}
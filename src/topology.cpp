@@ -0,0 +1,378 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+
+#include "hotstuff/topology.h"
+
+namespace hotstuff {
+
+void Topology::add_edge(ReplicaID parent, ReplicaID child) {
+    parents[child] = parent;
+    children[parent].push_back(child);
+}
+
+void Topology::finalize() {
+    order.clear();
+    depths.clear();
+    std::queue<ReplicaID> q;
+    q.push(root);
+    depths[root] = 0;
+    while (!q.empty())
+    {
+        ReplicaID rid = q.front();
+        q.pop();
+        order.push_back(rid);
+        auto it = children.find(rid);
+        if (it == children.end()) continue;
+        for (const auto &c: it->second)
+        {
+            depths[c] = depths[rid] + 1;
+            q.push(c);
+        }
+    }
+}
+
+Topology Topology::from_order(const std::vector<ReplicaID> &order,
+                            const std::vector<uint32_t> &fanouts) {
+    if (order.empty() || fanouts.empty())
+        throw HotStuffError("empty topology");
+    Topology t;
+    t.root = order[0];
+    auto size = order.size();
+    size_t processesOnLevel = 1;
+    size_t level = 0;
+    bool done = false;
+
+    size_t i = 0;
+    while (i < size && !done) {
+        const size_t remaining = size - i;
+        size_t fanout = fanouts[std::min(level, fanouts.size() - 1)];
+        /* spread the remaining replicas evenly over the parents of this level */
+        const size_t max_fanout = std::max<size_t>(remaining / processesOnLevel, 1);
+        auto curr_fanout = std::min(max_fanout, fanout);
+
+        auto start = i + processesOnLevel;
+        for (size_t counter = 1; counter <= processesOnLevel; counter++) {
+            if (done) {
+                break;
+            }
+            for (size_t j = start; j < start + curr_fanout; j++) {
+                if (j >= size) {
+                    done = true;
+                    break;
+                }
+                t.add_edge(order[i], order[j]);
+            }
+            start += curr_fanout;
+            i++;
+        }
+        processesOnLevel = std::min(curr_fanout * processesOnLevel, remaining);
+        level++;
+    }
+    t.finalize();
+    return t;
+}
+
+Topology Topology::from_file(const std::string &fname, size_t nreplicas) {
+    std::ifstream f(fname);
+    if (!f)
+        throw HotStuffError("cannot open tree file %s", fname.c_str());
+    Topology t;
+    bool has_root = false;
+    std::string line;
+    for (size_t lineno = 1; std::getline(f, line); lineno++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        std::string head;
+        if (!(ls >> head)) continue;
+        auto parse_rid = [&](const std::string &tok) {
+            size_t end = 0;
+            unsigned long rid = 0;
+            try {
+                rid = std::stoul(tok, &end);
+            } catch (std::logic_error &) {
+                end = 0;
+            }
+            if (end != tok.size() || rid >= nreplicas)
+                throw HotStuffError("%s:%lu: invalid replica \"%s\"",
+                                    fname.c_str(), lineno, tok.c_str());
+            return (ReplicaID)rid;
+        };
+        if (head == "root")
+        {
+            std::string tok;
+            if (has_root || !(ls >> tok))
+                throw HotStuffError("%s:%lu: invalid root", fname.c_str(), lineno);
+            t.root = parse_rid(tok);
+            has_root = true;
+            continue;
+        }
+        if (head.back() != ':')
+            throw HotStuffError("%s:%lu: expected \"<parent>: <children>\"",
+                                fname.c_str(), lineno);
+        ReplicaID parent = parse_rid(head.substr(0, head.size() - 1));
+        if (t.children.count(parent))
+            throw HotStuffError("%s:%lu: children of %d listed twice",
+                                fname.c_str(), lineno, parent);
+        t.children[parent];
+        for (std::string tok; ls >> tok;)
+        {
+            ReplicaID child = parse_rid(tok);
+            if (child == parent || t.parents.count(child))
+                throw HotStuffError("%s:%lu: replica %d has more than one parent",
+                                    fname.c_str(), lineno, child);
+            t.add_edge(parent, child);
+        }
+    }
+    if (!has_root)
+    {
+        size_t nroots = 0;
+        for (size_t rid = 0; rid < nreplicas; rid++)
+            if (!t.parents.count(rid))
+            {
+                t.root = rid;
+                nroots++;
+            }
+        if (nroots != 1)
+            throw HotStuffError("tree file %s has %lu replicas without a parent, name the root",
+                                fname.c_str(), nroots);
+    }
+    else if (t.parents.count(t.root))
+        throw HotStuffError("the root %d in %s has a parent", t.root, fname.c_str());
+    t.finalize();
+    /* whatever is not reachable from the root is detached or in a cycle */
+    if (t.order.size() != nreplicas)
+        throw HotStuffError("tree file %s reaches %lu of %lu replicas from the root",
+                            fname.c_str(), t.order.size(), nreplicas);
+    return t;
+}
+
+Topology Topology::relabel(const std::vector<ReplicaID> &new_order) const {
+    if (new_order.size() != order.size())
+        throw HotStuffError("relabeling %lu replicas with %lu",
+                            order.size(), new_order.size());
+    std::unordered_map<ReplicaID, ReplicaID> label;
+    for (size_t i = 0; i < order.size(); i++)
+        label[order[i]] = new_order[i];
+    Topology t;
+    t.root = label[root];
+    for (const auto &rid: order)
+        for (const auto &c: get_children(rid))
+            t.add_edge(label[rid], label[c]);
+    t.finalize();
+    return t;
+}
+
+/* a minimal scanner for the flat XML Kollaps uses: returns the attributes
+ * of every `<tag ...>` element */
+static std::vector<std::unordered_map<std::string, std::string>>
+xml_elements(const std::string &xml, const std::string &tag) {
+    std::vector<std::unordered_map<std::string, std::string>> res;
+    const std::string open = "<" + tag + " ";
+    size_t pos = 0;
+    while ((pos = xml.find(open, pos)) != std::string::npos)
+    {
+        size_t end = xml.find('>', pos);
+        if (end == std::string::npos) break;
+        std::string body = xml.substr(pos + open.size(), end - pos - open.size());
+        std::unordered_map<std::string, std::string> attrs;
+        size_t p = 0;
+        while ((p = body.find('=', p)) != std::string::npos)
+        {
+            size_t kb = body.find_last_of(" \t\r\n", p);
+            std::string key = body.substr(kb == std::string::npos ? 0 : kb + 1,
+                                        p - (kb == std::string::npos ? 0 : kb + 1));
+            size_t vb = body.find('"', p);
+            size_t ve = vb == std::string::npos ? vb : body.find('"', vb + 1);
+            if (ve == std::string::npos) break;
+            attrs[key] = body.substr(vb + 1, ve - vb - 1);
+            p = ve + 1;
+        }
+        res.push_back(std::move(attrs));
+        pos = end;
+    }
+    return res;
+}
+
+Topology Topology::from_kollaps(const std::string &fname, size_t nreplicas,
+                                const std::vector<uint32_t> &fanouts,
+                                ReplicaID root) {
+    std::ifstream f(fname);
+    if (!f)
+        throw HotStuffError("cannot open topology file %s", fname.c_str());
+    std::stringstream buff;
+    buff << f.rdbuf();
+    std::string xml = buff.str();
+    /* strip the comments, they contain commented-out elements */
+    size_t cpos;
+    while ((cpos = xml.find("<!--")) != std::string::npos)
+    {
+        size_t cend = xml.find("-->", cpos);
+        xml.erase(cpos, cend == std::string::npos ? std::string::npos : cend + 3 - cpos);
+    }
+
+    std::unordered_map<std::string, size_t> bridge_idx;
+    for (auto &b: xml_elements(xml, "bridge"))
+        bridge_idx.insert(std::make_pair(b["name"], bridge_idx.size()));
+    size_t nbridges = bridge_idx.size();
+    if (nbridges == 0)
+        throw HotStuffError("no bridges in topology file %s", fname.c_str());
+
+    /* latencies between the regions (bridges), closed over multiple hops */
+    std::vector<std::vector<double>> lat(nbridges, std::vector<double>(nbridges, 1e18));
+    std::unordered_map<std::string, size_t> service_region;
+    for (size_t b = 0; b < nbridges; b++) lat[b][b] = 0;
+    for (auto &l: xml_elements(xml, "link"))
+    {
+        auto o = bridge_idx.find(l["origin"]);
+        auto d = bridge_idx.find(l["dest"]);
+        if (o != bridge_idx.end() && d != bridge_idx.end())
+        {
+            double ms = std::stod(l["latency"]);
+            lat[o->second][d->second] = std::min(lat[o->second][d->second], ms);
+            lat[d->second][o->second] = std::min(lat[d->second][o->second], ms);
+        }
+        else if (o != bridge_idx.end())
+            service_region[l["dest"]] = o->second;
+        else if (d != bridge_idx.end())
+            service_region[l["origin"]] = d->second;
+    }
+    for (size_t k = 0; k < nbridges; k++)
+        for (size_t a = 0; a < nbridges; a++)
+            for (size_t b = 0; b < nbridges; b++)
+                lat[a][b] = std::min(lat[a][b], lat[a][k] + lat[k][b]);
+
+    /* replicas are numbered in the order the services join */
+    std::vector<size_t> region;
+    for (auto &s: xml_elements(xml, "schedule"))
+    {
+        if (s["action"] != "join") continue;
+        auto it = service_region.find(s["name"]);
+        if (it == service_region.end()) continue;
+        size_t amount = s.count("amount") ? std::stoul(s["amount"]) : 1;
+        for (size_t k = 0; k < amount; k++)
+            region.push_back(it->second);
+    }
+    if (root >= nreplicas)
+        throw HotStuffError("root %d is not among the %lu replicas", root, nreplicas);
+    if (region.size() < nreplicas)
+        throw HotStuffError("topology file %s only places %lu of %lu replicas",
+                            fname.c_str(), region.size(), nreplicas);
+    region.resize(nreplicas);
+
+    /* take the shape of the level-wise tree and only choose which replica
+     * sits at each position, so the result can be rebuilt by from_order()
+     * from its breadth-first order */
+    std::vector<ReplicaID> ident(nreplicas);
+    for (size_t r = 0; r < nreplicas; r++) ident[r] = r;
+    Topology shape = from_order(ident, fanouts);
+    std::vector<ReplicaID> label(nreplicas);
+    std::set<ReplicaID> remaining(ident.begin(), ident.end());
+    remaining.erase(root);
+    std::vector<size_t> root_regions(nbridges, 0);
+    label[shape.get_root()] = root;
+    for (const auto &pos: shape.get_order())
+    {
+        size_t pr = region[label[pos]];
+        bool is_root = pos == shape.get_root();
+        for (const auto &c: shape.get_children(pos))
+        {
+            /* the root spreads over the regions, the inner nodes keep
+             * their subtree within (or close to) their own region */
+            auto cost = [&](ReplicaID r) {
+                if (is_root)
+                    return root_regions[region[r]] * 1e9 + lat[pr][region[r]];
+                return lat[pr][region[r]];
+            };
+            auto best = std::min_element(remaining.begin(), remaining.end(),
+                [&](ReplicaID a, ReplicaID b) { return cost(a) < cost(b); });
+            label[c] = *best;
+            remaining.erase(best);
+            if (is_root) root_regions[region[label[c]]]++;
+        }
+    }
+    return from_order(label, fanouts);
+}
+
+ReplicaID Topology::get_parent(ReplicaID rid) const {
+    auto it = parents.find(rid);
+    if (it == parents.end())
+        throw HotStuffError("replica %d has no parent", rid);
+    return it->second;
+}
+
+const std::vector<ReplicaID> &Topology::get_children(ReplicaID rid) const {
+    static const std::vector<ReplicaID> none;
+    auto it = children.find(rid);
+    return it == children.end() ? none : it->second;
+}
+
+std::set<ReplicaID> Topology::get_descendants(ReplicaID rid) const {
+    std::set<ReplicaID> res;
+    std::vector<ReplicaID> s{rid};
+    while (!s.empty())
+    {
+        ReplicaID r = s.back();
+        s.pop_back();
+        for (const auto &c: get_children(r))
+        {
+            res.insert(c);
+            s.push_back(c);
+        }
+    }
+    return res;
+}
+
+uint32_t Topology::get_depth(ReplicaID rid) const {
+    auto it = depths.find(rid);
+    if (it == depths.end())
+        throw HotStuffError("replica %d is not in the topology", rid);
+    return it->second;
+}
+
+uint32_t Topology::get_height() const {
+    uint32_t h = 0;
+    for (const auto &d: depths) h = std::max(h, d.second);
+    return h;
+}
+
+size_t Topology::get_ninternal() const {
+    size_t n = 0;
+    for (const auto &c: children)
+        if (!c.second.empty()) n++;
+    return n;
+}
+
+std::vector<uint32_t> Topology::get_level_fanouts() const {
+    std::vector<uint32_t> res;
+    for (const auto &c: children)
+    {
+        uint32_t d = get_depth(c.first);
+        if (res.size() <= d) res.resize(d + 1, 0);
+        res[d] = std::max(res[d], (uint32_t)c.second.size());
+    }
+    if (res.empty()) res.push_back(1);
+    return res;
+}
+
+}
@@ -0,0 +1,245 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hotstuff/wal.h"
+#include "hotstuff/affinity.h"
+#include "hotstuff/util.h"
+
+namespace hotstuff {
+
+/* a record is framed as <length (4)> <crc32 (4)> <payload> */
+static const size_t frame_header = 8;
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+    static uint32_t table[256];
+    static bool init = [] {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < len; i++)
+        c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static void put_u32(bytearray_t &out, uint32_t v) {
+    v = htole(v);
+    auto p = reinterpret_cast<const uint8_t *>(&v);
+    out.insert(out.end(), p, p + 4);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v;
+    memmove(&v, p, 4);
+    return letoh(v);
+}
+
+void WriteAheadLog::frame(bytearray_t &out, const bytearray_t &rec) {
+    put_u32(out, rec.size());
+    put_u32(out, crc32(rec.data(), rec.size()));
+    out.insert(out.end(), rec.begin(), rec.end());
+}
+
+WriteAheadLog::WriteAheadLog(const EventContext &ec, const std::string &fname):
+        fname(fname), stopping(false),
+        buffered_seq(0), rewrite_pending(false),
+        appended_seq(0), durable_seq(0), file_size(0),
+        nsync(0), nsynced_bytes(0) {
+    fd = open(fname.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw HotStuffError("cannot open the log %s: %s", fname.c_str(), strerror(errno));
+    file_size = lseek(fd, 0, SEEK_END);
+    synced.reg_handler(ec, [this](seq_queue_t &q) {
+        uint64_t seq;
+        while (q.try_dequeue(seq))
+            durable_seq = std::max(durable_seq, seq);
+        while (!waiting.empty() && waiting.front().first <= durable_seq)
+        {
+            auto pm = std::move(waiting.front().second);
+            waiting.pop_front();
+            pm.resolve();
+        }
+        return false;
+    });
+    writer = std::thread([this]() {
+        thread_layout.enter(THREAD_WAL);
+        run();
+    });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> _(lock);
+        stopping = true;
+    }
+    cv.notify_one();
+    writer.join();
+    close(fd);
+}
+
+std::vector<bytearray_t> WriteAheadLog::replay() {
+    std::vector<bytearray_t> recs;
+    bytearray_t data;
+    uint8_t chunk[1 << 16];
+    ssize_t ret;
+    lseek(fd, 0, SEEK_SET);
+    while ((ret = read(fd, chunk, sizeof(chunk))) > 0)
+        data.insert(data.end(), chunk, chunk + ret);
+    if (ret < 0)
+        throw HotStuffError("cannot read the log %s: %s", fname.c_str(), strerror(errno));
+    size_t pos = 0;
+    while (pos + frame_header <= data.size())
+    {
+        uint32_t len = get_u32(&data[pos]);
+        uint32_t crc = get_u32(&data[pos + 4]);
+        if (pos + frame_header + len > data.size() ||
+            crc32(&data[pos + frame_header], len) != crc)
+            break;
+        recs.push_back(bytearray_t(data.begin() + pos + frame_header,
+                                    data.begin() + pos + frame_header + len));
+        pos += frame_header + len;
+    }
+    if (pos < data.size())
+    {
+        HOTSTUFF_LOG_WARN("dropping %lu bytes of torn log tail", data.size() - pos);
+        if (ftruncate(fd, pos) < 0)
+            throw HotStuffError("cannot truncate the log: %s", strerror(errno));
+    }
+    lseek(fd, pos, SEEK_SET);
+    file_size = pos;
+    return recs;
+}
+
+void WriteAheadLog::append(const bytearray_t &rec) {
+    {
+        std::lock_guard<std::mutex> _(lock);
+        frame(buffer, rec);
+        buffered_seq = ++appended_seq;
+    }
+    file_size += frame_header + rec.size();
+    cv.notify_one();
+}
+
+promise_t WriteAheadLog::sync() {
+    if (durable_seq >= appended_seq)
+        return promise_t([](promise_t &pm) { pm.resolve(); });
+    waiting.push_back(std::make_pair(appended_seq, promise_t([](promise_t &){})));
+    return waiting.back().second;
+}
+
+void WriteAheadLog::rewrite(std::vector<bytearray_t> &&recs) {
+    size_t size = 0;
+    for (const auto &r: recs) size += frame_header + r.size();
+    {
+        std::lock_guard<std::mutex> _(lock);
+        /* the buffered records are older than the snapshot */
+        buffer.clear();
+        rewrite_recs = std::move(recs);
+        rewrite_pending = true;
+        buffered_seq = ++appended_seq;
+    }
+    file_size = size;
+    cv.notify_one();
+}
+
+void WriteAheadLog::write_all(int fd, const bytearray_t &data) {
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        ssize_t ret = write(fd, data.data() + pos, data.size() - pos);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            throw HotStuffError("cannot write the log %s: %s", fname.c_str(), strerror(errno));
+        }
+        pos += ret;
+    }
+}
+
+void WriteAheadLog::run() {
+    for (;;)
+    {
+        bytearray_t data;
+        std::vector<bytearray_t> recs;
+        bool rewriting;
+        uint64_t seq;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            cv.wait(lk, [this]() {
+                return stopping || !buffer.empty() || rewrite_pending;
+            });
+            if (buffer.empty() && !rewrite_pending) return;
+            data.swap(buffer);
+            recs = std::move(rewrite_recs);
+            rewriting = rewrite_pending;
+            rewrite_pending = false;
+            seq = buffered_seq;
+        }
+        /* a failing disk stops the replica rather than let it vote on
+         * state it cannot recover */
+        if (rewriting)
+        {
+            bytearray_t snapshot;
+            for (const auto &r: recs) frame(snapshot, r);
+            snapshot.insert(snapshot.end(), data.begin(), data.end());
+            data.swap(snapshot);
+            std::string tmp = fname + ".tmp";
+            int nfd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (nfd < 0)
+                throw HotStuffError("cannot open the log %s: %s", tmp.c_str(), strerror(errno));
+            write_all(nfd, data);
+            if (fdatasync(nfd) < 0 || rename(tmp.c_str(), fname.c_str()) < 0)
+                throw HotStuffError("cannot replace the log %s: %s", fname.c_str(), strerror(errno));
+            /* make the rename itself durable */
+            std::string dname(fname);
+            int dfd = open(dirname(&dname[0]), O_RDONLY);
+            if (dfd >= 0)
+            {
+                fsync(dfd);
+                close(dfd);
+            }
+            close(fd);
+            fd = nfd;
+        }
+        else
+        {
+            write_all(fd, data);
+            if (fdatasync(fd) < 0)
+                throw HotStuffError("cannot sync the log %s: %s", fname.c_str(), strerror(errno));
+        }
+        nsync.fetch_add(1, std::memory_order_relaxed);
+        nsynced_bytes.fetch_add(data.size(), std::memory_order_relaxed);
+        synced.enqueue(seq);
+    }
+}
+
+}
@@ -0,0 +1,29 @@
+#ifndef _HOTSTUFF_TEST_H
+#define _HOTSTUFF_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+/* unlike assert(), also checks in release builds */
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+/** a fresh directory for the files of a test */
+static inline std::string test_dir(const char *name) {
+    char tmpl[64];
+    snprintf(tmpl, sizeof tmpl, "/tmp/%s-XXXXXX", name);
+    if (mkdtemp(tmpl) == nullptr)
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return tmpl;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "hotstuff/blkstore.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+static uint256_t hash_of(uint32_t i) {
+    bytearray_t b(32, 0);
+    b[0] = i & 0xff;
+    b[1] = (i >> 8) & 0xff;
+    b[31] = 2;
+    return uint256_t(b);
+}
+
+/* blocks of different sizes, so that they straddle the segments */
+static std::vector<block_t> make_chain(uint32_t base, size_t n) {
+    std::vector<block_t> blks;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t height = base + i;
+        blks.push_back(new Block({}, {hash_of(height)},
+                            quorum_cert_bt(new QuorumCertDummy()),
+                            bytearray_t(100 + height * 37 % 400, height & 0xff),
+                            height, nullptr, nullptr));
+    }
+    return blks;
+}
+
+static bytearray_t wire(const block_t &blk) {
+    DataStream s;
+    s << *blk;
+    return std::move(s);
+}
+
+static bool stored(const BlockStore &store, const block_t &blk) {
+    auto raw = store.get_raw(blk->get_hash());
+    auto by_height = store.get_raw_by_height(blk->get_height());
+    bytearray_t data = wire(blk);
+    return raw.first && raw.first == by_height.first &&
+        bytearray_t(raw.first, raw.first + raw.second) == data &&
+        store.get_hash(blk->get_height()) == blk->get_hash();
+}
+
+static size_t file_size(const std::string &fname) {
+    struct stat st;
+    CHECK(stat(fname.c_str(), &st) == 0);
+    return st.st_size;
+}
+
+static std::string seg_name(const std::string &dir, uint32_t seg) {
+    char buff[32];
+    snprintf(buff, sizeof buff, "/seg-%08u", seg);
+    return dir + buff;
+}
+
+static void remove_store(const std::string &dir) {
+    for (uint32_t seg = 0; access(seg_name(dir, seg).c_str(), F_OK) == 0; seg++)
+        unlink(seg_name(dir, seg).c_str());
+    unlink((dir + "/index").c_str());
+    unlink((dir + "/hindex").c_str());
+    rmdir(dir.c_str());
+}
+
+static void test_put_get(const std::string &dir) {
+    auto blks = make_chain(100, 50);
+    {
+        BlockStore store(dir, 4096);
+        CHECK(store.empty());
+        for (const auto &b: blks) CHECK(store.put(*b));
+        /* the same or a lower height again */
+        CHECK(!store.put(*blks[10]));
+        CHECK(!store.put(*blks.back()));
+        CHECK(store.get_base_height() == 100 && store.get_top_height() == 149);
+        CHECK(store.get_nsegments() > 1);
+        for (const auto &b: blks) CHECK(stored(store, b));
+        CHECK(!store.get_raw_by_height(99).first);
+        CHECK(!store.get_raw_by_height(150).first);
+        CHECK(!store.contains(hash_of(7)));
+    }
+    /* everything is found again after reopening */
+    BlockStore store(dir, 4096);
+    CHECK(store.get_nblocks() == 50);
+    for (const auto &b: blks) CHECK(stored(store, b));
+}
+
+static void test_truncated_append(const std::string &dir) {
+    auto blks = make_chain(0, 30);
+    size_t nsegs;
+    {
+        BlockStore store(dir, 4096);
+        for (const auto &b: blks) CHECK(store.put(*b));
+        nsegs = store.get_nsegments();
+    }
+    /* the last block only half written, with its entry in the index */
+    std::string last = seg_name(dir, nsegs - 1);
+    size_t len = wire(blks.back()).size();
+    CHECK(truncate(last.c_str(), file_size(last) - len / 2) == 0);
+    {
+        BlockStore store(dir, 4096);
+        CHECK(store.get_top_height() == 28);
+        CHECK(!store.contains(blks.back()->get_hash()));
+        CHECK(!store.get_raw_by_height(29).first);
+        for (size_t i = 0; i < 29; i++) CHECK(stored(store, blks[i]));
+        /* the height is free again, the new copy goes after the torn one */
+        CHECK(store.put(*blks.back()));
+        CHECK(stored(store, blks.back()));
+        blks.push_back(make_chain(30, 1)[0]);
+        CHECK(store.put(*blks.back()));
+    }
+    BlockStore store(dir, 4096);
+    CHECK(store.get_top_height() == 30);
+    for (const auto &b: blks) CHECK(stored(store, b));
+}
+
+static void test_index_recovery(const std::string &dir) {
+    /* a gap in the heights, skipped blocks stay empty */
+    auto blks = make_chain(0, 20);
+    auto high = make_chain(25, 5);
+    {
+        BlockStore store(dir, 4096);
+        for (const auto &b: blks) CHECK(store.put(*b));
+        for (const auto &b: high) CHECK(store.put(*b));
+    }
+    blks.insert(blks.end(), high.begin(), high.end());
+
+    /* a lost hash index is rebuilt from the height index */
+    unlink((dir + "/hindex").c_str());
+    {
+        BlockStore store(dir, 4096);
+        CHECK(store.get_nblocks() == 30);
+        for (const auto &b: blks) CHECK(stored(store, b));
+        CHECK(!store.get_raw_by_height(22).first);
+    }
+
+    /* a segment lost altogether takes the entries pointing into it along,
+     * and the hash index stale with them is rebuilt */
+    size_t nsegs;
+    {
+        BlockStore store(dir, 4096);
+        nsegs = store.get_nsegments();
+    }
+    CHECK(nsegs > 2);
+    unlink(seg_name(dir, nsegs - 1).c_str());
+    BlockStore store(dir, 4096);
+    CHECK(store.get_nsegments() == nsegs - 1);
+    CHECK(store.get_top_height() < 29);
+    for (const auto &b: blks)
+        CHECK(b->get_height() <= store.get_top_height() ?
+                stored(store, b) : !store.contains(b->get_hash()));
+    CHECK(store.put(*make_chain(40, 1)[0]));
+}
+
+int main() {
+    std::string dir = test_dir("test_blkstore");
+    test_put_get(dir + "/a");
+    test_truncated_append(dir + "/b");
+    test_index_recovery(dir + "/c");
+    for (const char *sub: {"/a", "/b", "/c"})
+        remove_store(dir + sub);
+    rmdir(dir.c_str());
+    printf("ok\n");
+    return 0;
+}
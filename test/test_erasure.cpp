@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+#include "hotstuff/erasure.h"
+#include "test.h"
+
+using namespace hotstuff;
+using chunks_t = std::vector<std::pair<uint16_t, bytearray_t>>;
+
+static bytearray_t random_data(std::mt19937 &gen, size_t len) {
+    bytearray_t data(len);
+    for (auto &b: data) b = gen() & 0xff;
+    return data;
+}
+
+/* keep the chunks of `code` not in `drop` */
+static chunks_t without(const std::vector<bytearray_t> &code,
+                        const std::vector<size_t> &drop) {
+    chunks_t ret;
+    for (size_t i = 0; i < code.size(); i++)
+        if (std::find(drop.begin(), drop.end(), i) == drop.end())
+            ret.push_back(std::make_pair(i, code[i]));
+    return ret;
+}
+
+static void check_decode(const ReedSolomon &rs, const bytearray_t &data,
+                        const chunks_t &chunks) {
+    bytearray_t out;
+    CHECK(rs.decode(chunks, data.size(), out));
+    CHECK(out == data);
+    CHECK(salticidae::get_hash(out) == salticidae::get_hash(data));
+}
+
+static void test_drop_patterns() {
+    std::mt19937 gen(1);
+    /* k = 2f + 1 out of n = 3f + 1, as with the replicas */
+    ReedSolomon rs(7, 10);
+    /* not a multiple of k, so the last chunk is padded */
+    bytearray_t data = random_data(gen, 1000);
+    auto code = rs.encode(data);
+    CHECK(code.size() == 10);
+    for (const auto &c: code)
+        CHECK(c.size() == rs.chunk_size(data.size()));
+
+    /* all the data chunks, i.e. nothing to solve */
+    check_decode(rs, data, without(code, {7, 8, 9}));
+    /* only the parity ones stand in for the data */
+    check_decode(rs, data, without(code, {0, 1, 2}));
+    check_decode(rs, data, without(code, {0, 5, 9}));
+    check_decode(rs, data, without(code, {3, 4, 8}));
+    /* more than needed, in any order */
+    auto chunks = without(code, {6});
+    std::shuffle(chunks.begin(), chunks.end(), gen);
+    check_decode(rs, data, chunks);
+    /* random sets of k */
+    for (int i = 0; i < 100; i++)
+    {
+        std::vector<size_t> idx(10);
+        for (size_t j = 0; j < 10; j++) idx[j] = j;
+        std::shuffle(idx.begin(), idx.end(), gen);
+        check_decode(rs, data, without(code, {idx[0], idx[1], idx[2]}));
+    }
+}
+
+static void test_too_few() {
+    std::mt19937 gen(2);
+    ReedSolomon rs(7, 10);
+    bytearray_t data = random_data(gen, 512);
+    auto code = rs.encode(data);
+    bytearray_t out;
+    CHECK(!rs.decode(without(code, {0, 1, 2, 3}), data.size(), out));
+    /* the same chunk twice is not two */
+    auto chunks = without(code, {0, 1, 2, 3});
+    chunks.push_back(chunks[0]);
+    CHECK(!rs.decode(chunks, data.size(), out));
+    /* a chunk of the wrong length is not counted */
+    chunks = without(code, {0, 1, 2});
+    chunks[0].second.pop_back();
+    CHECK(!rs.decode(chunks, data.size(), out));
+}
+
+static void test_sizes() {
+    std::mt19937 gen(3);
+    for (size_t n: {1, 4, 31, 100})
+    {
+        ReedSolomon rs((n * 2 + 2) / 3, n);
+        for (size_t len: {1, 63, 4096})
+        {
+            bytearray_t data = random_data(gen, len);
+            auto code = rs.encode(data);
+            std::vector<size_t> drop;
+            for (size_t i = 0; i < n - rs.get_k(); i++) drop.push_back(i * 2 % n);
+            std::sort(drop.begin(), drop.end());
+            drop.erase(std::unique(drop.begin(), drop.end()), drop.end());
+            check_decode(rs, data, without(code, drop));
+        }
+    }
+}
+
+int main() {
+    test_drop_patterns();
+    test_too_few();
+    test_sizes();
+    printf("ok\n");
+    return 0;
+}
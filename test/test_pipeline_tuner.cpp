@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+
+#include "hotstuff/pipeline.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+/* A proposer pacing blocks into a bottleneck of `capacity` blocks per
+ * second, each QC coming back `delay` seconds after the block got through.
+ * Time goes in fixed steps, so that every run is the same. */
+struct Sim {
+    PipelineTuner &tuner;
+    double capacity;
+    double delay;
+    double now;
+    double last_send;
+    double link_free;
+    /** (sent, QC) of the blocks in flight, in order */
+    std::deque<std::pair<double, double>> inflight;
+    uint32_t max_depth_seen;
+
+    Sim(PipelineTuner &tuner, double capacity, double delay):
+        tuner(tuner), capacity(capacity), delay(delay), now(0),
+        last_send(-1), link_free(0), max_depth_seen(0) {}
+
+    void step(double dt) {
+        now += dt;
+        while (!inflight.empty() && inflight.front().second <= now)
+        {
+            auto b = inflight.front();
+            inflight.pop_front();
+            tuner.on_qc(b.second - b.first, b.second);
+        }
+        max_depth_seen = std::max(max_depth_seen, tuner.get_depth());
+        if (inflight.size() < tuner.get_depth() &&
+            now - last_send >= tuner.get_gap_ms() / 1000.0)
+        {
+            double start = std::max(now, link_free);
+            link_free = start + 1 / capacity;
+            inflight.push_back(std::make_pair(now, link_free + delay));
+            last_send = now;
+        }
+    }
+
+    /* run until `until` returns true, or for `secs` */
+    template<typename Pred>
+    bool run(double secs, Pred until) {
+        double end = now + secs;
+        while (now < end)
+        {
+            step(1e-4);
+            if (until()) return true;
+        }
+        return false;
+    }
+
+    void run(double secs) { run(secs, []() { return false; }); }
+};
+
+static void test_startup_and_drain() {
+    PipelineTuner tuner(64, 0.05);
+    /* 100 blocks per second, 60 ms with nothing queued */
+    Sim sim(tuner, 100, 0.05);
+    CHECK(tuner.in_startup());
+    CHECK(tuner.get_depth() == 1);
+
+    /* the depth doubles its way up to the bottleneck, then stops */
+    CHECK(sim.run(10, [&]() { return !tuner.in_startup(); }));
+    CHECK(sim.max_depth_seen > 1);
+    CHECK(tuner.get_base_lat() > 0.059 && tuner.get_base_lat() < 0.061);
+    CHECK(tuner.get_rate() > 80 && tuner.get_rate() < 120);
+
+    /* the drain brings the latency back near the floor */
+    CHECK(sim.run(5, [&]() {
+        return tuner.get_qc_lat() < tuner.get_base_lat() * 1.25;
+    }));
+    sim.run(2);
+    /* two floor latencies at the measured rate */
+    CHECK(tuner.get_depth() >= 8 && tuner.get_depth() <= 16);
+    CHECK(tuner.get_gap_ms() >= 8 && tuner.get_gap_ms() <= 14);
+    CHECK(tuner.get_qc_lat() < tuner.get_base_lat() * 2);
+    CHECK(tuner.get_nadjust() > 0);
+}
+
+static void test_depth_clamp() {
+    PipelineTuner tuner(3, 0.05, 0.001, 1);
+    Sim sim(tuner, 1000, 0.1);
+    sim.run(20);
+    /* the link takes far more than three blocks per floor latency */
+    CHECK(sim.max_depth_seen == 3);
+    CHECK(tuner.get_depth() <= 3);
+    /* the gap stays within its bounds as well */
+    PipelineTuner slow(64, 5, 0.001, 0.2);
+    CHECK(slow.get_gap_ms() == 200);
+    Sim sim2(slow, 2, 0.01);
+    sim2.run(20);
+    CHECK(slow.get_gap_ms() <= 200 && slow.get_gap_ms() >= 1);
+}
+
+static void test_floor_expiry() {
+    PipelineTuner tuner(64, 0.05, 0.001, 1, 2);
+    Sim sim(tuner, 100, 0.05);
+    CHECK(sim.run(10, [&]() { return !tuner.in_startup(); }));
+    sim.run(3);
+    double floor = tuner.get_base_lat();
+    CHECK(floor < 0.061);
+
+    /* a longer path: the old floor must expire rather than hold the
+     * depth at half of what the link needs */
+    sim.delay = 0.15;
+    bool probed = false;
+    sim.run(10, [&]() {
+        probed = probed || tuner.get_depth() == 1;
+        return false;
+    });
+    /* one block in flight while the floor is measured again */
+    CHECK(probed);
+    CHECK(tuner.get_base_lat() > 0.159 && tuner.get_base_lat() < 0.2);
+    CHECK(tuner.get_depth() > 16);
+}
+
+int main() {
+    test_startup_and_drain();
+    test_depth_clamp();
+    test_floor_expiry();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdexcept>
+
+#include "hotstuff/pipeline.h"
+#include "test.h"
+
+using namespace hotstuff;
+using hashes_t = std::vector<uint256_t>;
+
+static uint256_t hash_of(uint32_t i) {
+    bytearray_t b(32, 0);
+    b[0] = i & 0xff;
+    b[1] = (i >> 8) & 0xff;
+    b[31] = 1;
+    return uint256_t(b);
+}
+
+static void test_in_order() {
+    PipelineWindow w(4);
+    for (uint32_t i = 0; i < 4; i++) w.push(hash_of(i), 10 + i);
+    CHECK(w.size() == 4);
+    CHECK(w.back() == hash_of(3) && w.back_height() == 13);
+    CHECK(w.pending() == hashes_t({hash_of(0), hash_of(1), hash_of(2), hash_of(3)}));
+    for (uint32_t i = 0; i < 4; i++)
+        CHECK(w.certify(hash_of(i)) == hashes_t({hash_of(i)}));
+    CHECK(w.empty());
+    /* unknown blocks go through as they are */
+    CHECK(w.certify(hash_of(99)) == hashes_t({hash_of(99)}));
+}
+
+static void test_reorder() {
+    PipelineWindow w(8);
+    for (uint32_t i = 0; i < 5; i++) w.push(hash_of(i), i);
+    /* the younger ones wait for the oldest */
+    CHECK(w.certify(hash_of(2)).empty());
+    CHECK(w.certify(hash_of(1)).empty());
+    CHECK(w.certify(hash_of(4)).empty());
+    CHECK(w.get_state(hash_of(2)) == PipelineWindow::SLOT_CERTIFIED);
+    CHECK(w.get_state(hash_of(3)) == PipelineWindow::SLOT_INFLIGHT);
+    /* twice is once */
+    CHECK(w.certify(hash_of(2)).empty());
+    CHECK(w.certify(hash_of(0)) == hashes_t({hash_of(0), hash_of(1), hash_of(2)}));
+    CHECK(w.size() == 2);
+    CHECK(w.get_state(hash_of(0)) == PipelineWindow::SLOT_FREE);
+    CHECK(w.certify(hash_of(3)) == hashes_t({hash_of(3), hash_of(4)}));
+    CHECK(w.empty());
+
+    /* a dropped block is skipped */
+    for (uint32_t i = 5; i < 9; i++) w.push(hash_of(i), i);
+    CHECK(w.certify(hash_of(7)).empty());
+    w.erase(hash_of(6));
+    CHECK(!w.contains(hash_of(6)));
+    CHECK(w.certify(hash_of(5)) == hashes_t({hash_of(5), hash_of(7)}));
+    CHECK(w.pending() == hashes_t({hash_of(8)}));
+}
+
+static void test_ring_wrap() {
+    /* four slots, reused over and over with the head going round */
+    PipelineWindow w;
+    uint32_t next = 0, done = 0;
+    for (int round = 0; round < 100; round++)
+    {
+        while (w.size() < 3) { w.push(hash_of(next), next); next++; }
+        /* the second oldest first, so that the reorder spans the seam */
+        CHECK(w.certify(hash_of(done + 1)).empty());
+        CHECK(w.certify(hash_of(done)) == hashes_t({hash_of(done), hash_of(done + 1)}));
+        done += 2;
+        CHECK(w.pending().front() == hash_of(done));
+    }
+    /* full: the ring grows and keeps the order across the seam */
+    while (w.size() < 11) { w.push(hash_of(next), next); next++; }
+    hashes_t expect;
+    for (uint32_t i = done; i < next; i++) expect.push_back(hash_of(i));
+    CHECK(w.pending() == expect);
+    for (uint32_t i = next; i-- > done + 1;)
+        CHECK(w.certify(hash_of(i)).empty());
+    CHECK(w.certify(hash_of(done)) == expect);
+    CHECK(w.empty());
+}
+
+int main() {
+    test_in_order();
+    test_reorder();
+    test_ring_wrap();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "hotstuff/slab.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+/* the pools are static, as the statistics and the caches of the threads
+ * refer to them until the end */
+static SlabPool::Stat stat_of(const char *name) {
+    for (const auto &s: SlabPool::get_stats())
+        if (!strcmp(s.name, name)) return s;
+    CHECK(false);
+    return SlabPool::Stat{};
+}
+
+static void test_reuse() {
+    static SlabPool pool("reuse", 40);
+    void *a = pool.alloc(40);
+    void *b = pool.alloc(40);
+    CHECK(a != b);
+    /* aligned for anything */
+    CHECK((uintptr_t)a % alignof(std::max_align_t) == 0);
+    pool.free(a, 40);
+    CHECK(pool.alloc(40) == a);
+    /* other sizes (derived classes) are not from the slabs */
+    void *c = pool.alloc(400);
+    pool.free(c, 400);
+    pool.free(nullptr, 40);
+    auto s = stat_of("reuse");
+    CHECK(s.nalloc == 3 && s.nfree == 1);
+    CHECK(s.reserved == SlabPool::slab_bytes);
+}
+
+static void test_cross_thread_free() {
+    static SlabPool pool("cross", 48);
+    const size_t n = SlabPool::magazine_size * 3 + 8;
+    std::vector<void *> objs;
+    std::thread([&]() {
+        for (size_t i = 0; i < n; i++)
+        {
+            objs.push_back(pool.alloc(48));
+            memset(objs.back(), 0xa5, 48);
+        }
+    }).join();
+    CHECK(std::set<void *>(objs.begin(), objs.end()).size() == n);
+
+    /* freed by a thread that allocated none of them, the magazines it
+     * fills go to the depot, the rest when it exits */
+    std::thread([&]() {
+        for (void *p: objs) pool.free(p, 48);
+    }).join();
+    auto s = stat_of("cross");
+    CHECK(s.nalloc == n && s.nfree == n);
+    size_t reserved = s.reserved;
+
+    /* a third thread gets all of them back without a new slab */
+    std::vector<void *> again;
+    std::thread([&]() {
+        for (size_t i = 0; i < n; i++) again.push_back(pool.alloc(48));
+    }).join();
+    std::sort(objs.begin(), objs.end());
+    std::sort(again.begin(), again.end());
+    CHECK(std::set<void *>(again.begin(), again.end()).size() == n);
+    CHECK(objs == again);
+    CHECK(stat_of("cross").reserved == reserved);
+}
+
+static void test_magazine_flush() {
+    static SlabPool pool("flush", 64);
+    void *p = nullptr;
+    std::thread([&]() {
+        p = pool.alloc(64);
+        pool.free(p, 64);
+    }).join();
+    /* one trip for the magazine, one to hand it back at the exit */
+    auto s = stat_of("flush");
+    CHECK(s.nrefill == 2);
+
+    /* the flushed magazine is the first in the depot, with the freed
+     * object at its head */
+    void *q = nullptr;
+    std::thread([&]() {
+        q = pool.alloc(64);
+        pool.free(q, 64);
+    }).join();
+    CHECK(q == p);
+    s = stat_of("flush");
+    CHECK(s.nrefill == 4);
+    CHECK(s.reserved == SlabPool::slab_bytes);
+
+    /* a full magazine moves to the spare, two full ones go to the depot */
+    std::vector<void *> objs;
+    for (size_t i = 0; i < SlabPool::magazine_size * 2 + 1; i++)
+        objs.push_back(pool.alloc(64));
+    size_t nrefill = stat_of("flush").nrefill;
+    for (void *o: objs) pool.free(o, 64);
+    CHECK(stat_of("flush").nrefill - nrefill == 1);
+}
+
+static void test_typed() {
+    struct Obj {
+        int x;
+        std::vector<int> v;
+        Obj(int x): x(x), v(x, x) {}
+    };
+    static TypedSlabPool<Obj> pool("typed");
+    Obj *o = pool.create(5);
+    CHECK(o->x == 5 && o->v.size() == 5);
+    pool.destroy(o);
+    pool.destroy(nullptr);
+    auto s = stat_of("typed");
+    CHECK(s.nalloc == 1 && s.nfree == 1 && s.obj_size == sizeof(Obj));
+}
+
+int main() {
+    test_reuse();
+    test_cross_thread_free();
+    test_magazine_flush();
+    test_typed();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "hotstuff/topology.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+static std::vector<ReplicaID> ident(size_t n) {
+    std::vector<ReplicaID> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    return order;
+}
+
+static std::string write_file(const std::string &dir, const std::string &content) {
+    std::string fname = dir + "/tree";
+    std::ofstream(fname) << content;
+    return fname;
+}
+
+static bool rejects(const std::string &dir, const std::string &content, size_t n) {
+    try {
+        Topology::from_file(write_file(dir, content), n);
+    } catch (HotStuffError &) {
+        return true;
+    }
+    return false;
+}
+
+static void test_level_fanouts() {
+    /* 1 + 3 + 6 + 11: the root has 3 children, the level below 2 each */
+    Topology t = Topology::from_order(ident(21), {3, 2});
+    CHECK(t.get_root() == 0);
+    CHECK(t.size() == 21);
+    CHECK(t.get_children(0) == std::vector<ReplicaID>({1, 2, 3}));
+    CHECK(t.get_children(1) == std::vector<ReplicaID>({4, 5}));
+    CHECK(t.get_parent(9) == 3);
+    auto fanouts = t.get_level_fanouts();
+    CHECK(fanouts.size() == 3);
+    CHECK(fanouts[0] == 3 && fanouts[1] == 2 && fanouts[2] == 2);
+    CHECK(t.get_height() == 3);
+    CHECK(t.get_depth(0) == 0 && t.get_depth(3) == 1 && t.get_depth(9) == 2 && t.get_depth(20) == 3);
+    CHECK(t.get_ninternal() == 1 + 3 + 6);
+
+    /* a single fan-out repeats, a large one gives a star */
+    Topology k = Topology::from_order(ident(13), {3});
+    CHECK(k.get_height() == 2 && k.get_ninternal() == 4);
+    Topology star = Topology::from_order(ident(8), {7});
+    CHECK(star.is_star() && star.get_height() == 1);
+}
+
+static void test_descendants() {
+    Topology t = Topology::from_order(ident(13), {3});
+    CHECK(t.get_descendants(0).size() == 12);
+    CHECK(t.get_descendants(1) == std::set<ReplicaID>({4, 5, 6}));
+    CHECK(t.get_descendants(12).empty());
+    /* the subtrees of the children partition the replicas below the root */
+    size_t total = 0;
+    for (const auto &c: t.get_children(0))
+        total += t.get_descendants(c).size() + 1;
+    CHECK(total == 12);
+
+    /* relabeling keeps the shape */
+    std::vector<ReplicaID> order = ident(13);
+    std::rotate(order.begin() + 1, order.begin() + 4, order.end());
+    Topology r = t.relabel(order);
+    CHECK(r.get_order() == order);
+    CHECK(r.get_level_fanouts() == t.get_level_fanouts());
+    CHECK(r.get_descendants(order[1]).size() == 3);
+    CHECK(r.get_parent(order[5]) == order[1]);
+}
+
+static void test_from_file() {
+    std::string dir = test_dir("test_topology");
+    /* a root other than replica 0, with uneven fan-outs */
+    Topology t = Topology::from_file(write_file(dir,
+        "# three levels\n"
+        "root 2\n"
+        "2: 0 5   # two children\n"
+        "0: 1 3 4\n"
+        "5: 6\n"), 7);
+    CHECK(t.get_root() == 2);
+    CHECK(t.get_order() == std::vector<ReplicaID>({2, 0, 5, 1, 3, 4, 6}));
+    CHECK(t.get_children(0) == std::vector<ReplicaID>({1, 3, 4}));
+    CHECK(t.get_parent(6) == 5 && !t.has_parent(2));
+    CHECK(t.get_height() == 2);
+    CHECK(t.get_level_fanouts() == std::vector<uint32_t>({2, 3}));
+    CHECK(t.get_descendants(0) == std::set<ReplicaID>({1, 3, 4}));
+    CHECK(t.get_descendants(2).size() == 6);
+
+    /* the root is implied when only one replica has no parent */
+    Topology u = Topology::from_file(write_file(dir, "1: 0 2\n0: 3\n"), 4);
+    CHECK(u.get_root() == 1 && u.get_depth(3) == 2);
+
+    CHECK(rejects(dir, "0: 1\n", 3));                 /* 2 is detached */
+    CHECK(rejects(dir, "0: 1 2\n1: 2\n", 3));         /* two parents */
+    CHECK(rejects(dir, "root 0\n0: 1\n1: 2\n2: 0\n", 3));  /* the root has a parent */
+    CHECK(rejects(dir, "root 0\n0: 1\n2: 3\n3: 2\n", 4));  /* a cycle */
+    CHECK(rejects(dir, "0: 1 7\n", 3));               /* out of range */
+    CHECK(rejects(dir, "0 1 2\n", 3));                /* no colon */
+    unlink((dir + "/tree").c_str());
+    rmdir(dir.c_str());
+}
+
+int main() {
+    test_level_fanouts();
+    test_descendants();
+    test_from_file();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <atomic>
+#include <stdexcept>
+
+#include "hotstuff/crypto.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+static uint256_t hash_of(uint32_t i) {
+    bytearray_t b(32, 0);
+    b[0] = i & 0xff;
+    b[1] = (i >> 8) & 0xff;
+    b[31] = 3;
+    return uint256_t(b);
+}
+
+/* a check that counts how it was done */
+struct CountedTask: public BatchVeriTask {
+    static std::atomic<size_t> nbatch;
+    static std::atomic<size_t> nsingle;
+    bool valid;
+    CountedTask(bool valid): valid(valid) {}
+    bool verify() override {
+        nsingle++;
+        return valid;
+    }
+    bool verify_batch(const std::vector<BatchVeriTask *> &tasks) override {
+        nbatch++;
+        for (auto t: tasks)
+            if (!static_cast<CountedTask *>(t)->valid) return false;
+        return true;
+    }
+};
+
+std::atomic<size_t> CountedTask::nbatch(0);
+std::atomic<size_t> CountedTask::nsingle(0);
+
+/* submit `n` tasks, the one at `bad` (if any) invalid, and wait for all */
+static std::vector<bool> run_batch(EventContext &ec, VeriPool &vpool, size_t n, size_t bad) {
+    std::vector<bool> res(n, false);
+    size_t ndone = 0;
+    for (size_t i = 0; i < n; i++)
+        vpool.verify(new CountedTask(i != bad)).then([&, i](bool valid) {
+            res[i] = valid;
+            if (++ndone == n) ec.stop();
+        });
+    ec.dispatch();
+    return res;
+}
+
+static void test_pool_fallback() {
+    EventContext ec;
+    VeriPool vpool(ec, 2);
+    /* a full batch goes at once, the window is never waited for */
+    vpool.set_batch(10, 8);
+
+    auto res = run_batch(ec, vpool, 8, 8);
+    CHECK(res == std::vector<bool>(8, true));
+    CHECK(CountedTask::nbatch == 1 && CountedTask::nsingle == 0);
+
+    /* one bad task fails the batch, every task is then checked on its own
+     * and only the bad one is rejected */
+    res = run_batch(ec, vpool, 8, 5);
+    CHECK(CountedTask::nbatch == 2 && CountedTask::nsingle == 8);
+    for (size_t i = 0; i < 8; i++)
+        CHECK(res[i] == (i != 5));
+}
+
+static void test_bls_batch() {
+    const size_t n = 6;
+    std::vector<PrivKeyBLS> keys(n);
+    std::vector<BoxObj<SigVeriTaskBLS>> tasks;
+    for (size_t i = 0; i < n; i++)
+    {
+        keys[i].from_rand();
+        /* two messages, the tasks on the same one share a pairing */
+        const uint256_t msg = hash_of(i % 2);
+        tasks.push_back(new SigVeriTaskBLS(msg, PubKeyBLS(keys[i]), SigSecBLS(msg, keys[i])));
+    }
+    std::vector<BatchVeriTask *> batch;
+    for (auto &t: tasks) batch.push_back(t.get());
+    CHECK(batch[0]->verify_batch(batch));
+
+    /* a signature on another message than the one checked */
+    const uint256_t msg = hash_of(0);
+    tasks[3] = new SigVeriTaskBLS(msg, PubKeyBLS(keys[3]), SigSecBLS(hash_of(7), keys[3]));
+    batch[3] = tasks[3].get();
+    CHECK(!batch[0]->verify_batch(batch));
+    for (size_t i = 0; i < n; i++)
+        CHECK(batch[i]->verify() == (i != 3));
+    /* and the batch without it is fine again */
+    batch.erase(batch.begin() + 3);
+    CHECK(batch[0]->verify_batch(batch));
+}
+
+int main() {
+    test_pool_fallback();
+    test_bls_batch();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+#include "hotstuff/crypto.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+/* tasks that log their order, the holding ones keep their worker until the
+ * gate opens */
+static std::atomic<bool> gate(true);
+static std::atomic<size_t> nstarted(0);
+static std::atomic<size_t> nchecked(0);
+static std::mutex order_lock;
+static std::vector<int> order;
+
+struct GateTask: public VeriTask {
+    int tag;
+    bool hold;
+    GateTask(int tag, bool hold = true): tag(tag), hold(hold) {}
+    bool verify() override {
+        nstarted++;
+        while (hold && !gate) usleep(1000);
+        {
+            std::lock_guard<std::mutex> _(order_lock);
+            order.push_back(tag);
+        }
+        nchecked++;
+        return true;
+    }
+};
+
+static void reset(bool open) {
+    gate = open;
+    nstarted = 0;
+    nchecked = 0;
+    order.clear();
+}
+
+static void wait_started(size_t n) {
+    while (nstarted < n) usleep(1000);
+}
+
+/* run the loop until all of `pms` are resolved */
+static void resolve(EventContext &ec, std::vector<promise_t> &pms) {
+    size_t ndone = 0, n = pms.size();
+    for (auto &pm: pms)
+        pm.then([&](bool valid) {
+            CHECK(valid);
+            if (++ndone == n) ec.stop();
+        });
+    ec.dispatch();
+    pms.clear();
+}
+
+static void test_lane_order() {
+    EventContext ec;
+    VeriPool vpool(ec, 1);
+    std::vector<promise_t> pms;
+    reset(false);
+    /* the only worker is busy while the lanes fill up */
+    pms.push_back(vpool.verify(new GateTask(-1)));
+    wait_started(1);
+    for (int lane: {VERI_BLOCK, VERI_VOTE, VERI_QC})
+    {
+        VeriPool::LaneGuard _(vpool, (VeriLane)lane);
+        for (int i = 0; i < 3; i++)
+            pms.push_back(vpool.verify(new GateTask(lane * 10 + i)));
+    }
+    gate = true;
+    resolve(ec, pms);
+    /* the lower lanes first, each in the order of submission */
+    CHECK(order == std::vector<int>({-1, 0, 1, 2, 10, 11, 12, 20, 21, 22}));
+}
+
+static void test_steal() {
+    EventContext ec;
+    VeriPool vpool(ec, 2);
+    std::vector<promise_t> pms;
+    reset(false);
+    pms.push_back(vpool.verify(new GateTask(-1)));
+    wait_started(1);
+    /* dealt to both workers, the free one takes the share of the
+     * blocked one as well */
+    for (int i = 0; i < 6; i++)
+        pms.push_back(vpool.verify(new GateTask(i, false)));
+    while (nchecked < 6) usleep(1000);
+    CHECK(vpool.get_nstolen() >= 3);
+    CHECK(vpool.get_queued() == 0);
+    gate = true;
+    resolve(ec, pms);
+    CHECK(order.size() == 7 && order.back() == -1);
+}
+
+static void test_grow() {
+    EventContext ec;
+    VeriPool vpool(ec, 1);
+    /* up to 3 workers, once 2 tasks per worker are queued */
+    vpool.set_max_workers(3, 2);
+    std::vector<promise_t> pms;
+    reset(false);
+    pms.push_back(vpool.verify(new GateTask(0)));
+    wait_started(1);
+    CHECK(vpool.get_nworker() == 1);
+    for (int i = 1; i < 12; i++)
+        pms.push_back(vpool.verify(new GateTask(i)));
+    CHECK(vpool.get_nworker() == 3);
+    /* each extra worker picks up a task of the backlog */
+    wait_started(3);
+    CHECK(vpool.get_queued() == 9);
+    gate = true;
+    resolve(ec, pms);
+    CHECK(order.size() == 12);
+}
+
+int main() {
+    test_lane_order();
+    test_steal();
+    test_grow();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "hotstuff/wal.h"
+#include "test.h"
+
+using namespace hotstuff;
+
+static bytearray_t record(uint8_t type, size_t len, uint8_t fill) {
+    bytearray_t rec(len + 1, fill);
+    rec[0] = type;
+    return rec;
+}
+
+static size_t file_size(const std::string &fname) {
+    struct stat st;
+    CHECK(stat(fname.c_str(), &st) == 0);
+    return st.st_size;
+}
+
+/* the log is flushed by the writer before it is destroyed */
+static std::vector<bytearray_t> reopen(const EventContext &ec, const std::string &fname) {
+    WriteAheadLog wal(ec, fname);
+    return wal.replay();
+}
+
+static void test_replay(const EventContext &ec, const std::string &dir) {
+    std::string fname = dir + "/replay.wal";
+    std::vector<bytearray_t> recs;
+    {
+        WriteAheadLog wal(ec, fname);
+        CHECK(wal.replay().empty());
+        for (size_t i = 0; i < 100; i++)
+        {
+            recs.push_back(record(WAL_BLOCK, i * 37 % 500, i));
+            wal.append(recs.back());
+        }
+        recs.push_back(record(WAL_STATE, 0, 0));
+        wal.append(recs.back());
+    }
+    CHECK(reopen(ec, fname) == recs);
+    /* appending after a replay continues the same log */
+    {
+        WriteAheadLog wal(ec, fname);
+        CHECK(wal.replay() == recs);
+        CHECK(wal.get_size() == file_size(fname));
+        recs.push_back(record(WAL_COMMIT, 32, 0xab));
+        wal.append(recs.back());
+    }
+    CHECK(reopen(ec, fname) == recs);
+    unlink(fname.c_str());
+}
+
+static void test_truncated_tail(const EventContext &ec, const std::string &dir) {
+    std::string fname = dir + "/torn.wal";
+    std::vector<bytearray_t> recs;
+    {
+        WriteAheadLog wal(ec, fname);
+        wal.replay();
+        for (size_t i = 0; i < 10; i++)
+        {
+            recs.push_back(record(WAL_BLOCK, 100, i));
+            wal.append(recs.back());
+        }
+    }
+    size_t full = file_size(fname);
+
+    /* the last record cut short, as by a crash in the middle of a write */
+    CHECK(truncate(fname.c_str(), full - 20) == 0);
+    recs.pop_back();
+    {
+        WriteAheadLog wal(ec, fname);
+        CHECK(wal.replay() == recs);
+        /* the torn bytes are gone, the next record goes right after */
+        CHECK(wal.get_size() == full - (8 + 101));
+        CHECK(file_size(fname) == wal.get_size());
+        recs.push_back(record(WAL_STATE, 10, 0x5a));
+        wal.append(recs.back());
+    }
+    CHECK(reopen(ec, fname) == recs);
+
+    /* half a frame header left */
+    size_t size = file_size(fname);
+    CHECK(truncate(fname.c_str(), size - (8 + 11) + 4) == 0);
+    recs.pop_back();
+    CHECK(reopen(ec, fname) == recs);
+
+    /* a flipped byte ends the replay at the record before it */
+    int fd = open(fname.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    uint8_t b;
+    off_t off = 3 * (8 + 101) + 8 + 50;
+    CHECK(pread(fd, &b, 1, off) == 1);
+    b ^= 0xff;
+    CHECK(pwrite(fd, &b, 1, off) == 1);
+    close(fd);
+    recs.resize(3);
+    CHECK(reopen(ec, fname) == recs);
+    CHECK(file_size(fname) == 3 * (8 + 101));
+    unlink(fname.c_str());
+}
+
+static void test_rewrite(const EventContext &ec, const std::string &dir) {
+    std::string fname = dir + "/rewrite.wal";
+    std::vector<bytearray_t> snapshot{record(WAL_BLOCK, 10, 1), record(WAL_STATE, 10, 2)};
+    {
+        WriteAheadLog wal(ec, fname);
+        wal.replay();
+        for (size_t i = 0; i < 50; i++)
+            wal.append(record(WAL_BLOCK, 1000, i));
+        /* the records before the snapshot are dropped, the ones after kept */
+        auto copy = snapshot;
+        wal.rewrite(std::move(copy));
+        CHECK(wal.get_size() == 2 * (8 + 11));
+        wal.append(record(WAL_COMMIT, 32, 3));
+    }
+    auto recs = reopen(ec, fname);
+    CHECK(recs.size() == 3);
+    CHECK(recs[0] == snapshot[0] && recs[1] == snapshot[1]);
+    CHECK(recs[2] == record(WAL_COMMIT, 32, 3));
+    CHECK(access((fname + ".tmp").c_str(), F_OK) != 0);
+    unlink(fname.c_str());
+}
+
+int main() {
+    EventContext ec;
+    std::string dir = test_dir("test_wal");
+    test_replay(ec, dir);
+    test_truncated_tail(ec, dir);
+    test_rewrite(ec, dir);
+    rmdir(dir.c_str());
+    printf("ok\n");
+    return 0;
+}